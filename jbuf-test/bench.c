@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "jtbuf.h"
+
+//usage: bench [-c] [-n ops]
+//  -c  csv output, one line per result, to compare runs
+//  -n  operations per result(default OPS)
+
+#define FRAME_SIZE 160
+#define PTIME 20
+#define OPS 2000000
+#define MIN_OPS 20000
+#define STREAMS 4096
+
+//frames of a buffer above which a frame size and capacity pair is skipped
+#define MAX_BYTES (256u << 20)
+
+//window of the random reorder pattern
+#define REORDER_WINDOW 16
+
+static const unsigned counts[] = {64,1024,16384,262144};
+static const unsigned stream_counts[] = {64,256,1024};
+static const unsigned frame_sizes[] = {160,1280,8192,65536};
+static const unsigned capacities[] = {64,1024,16384};
+static const int threads[] = {1,2,4,8};
+
+enum{
+  PATTERN_INORDER,
+  PATTERN_SWAP,
+  PATTERN_REVERSE8,
+  PATTERN_RANDOM,
+  PATTERN_COUNT
+};
+
+static const char *pattern_names[] = {"inorder","swap","reverse8","random16"};
+
+static const jb_discard_algo_t discards[] = {
+  JB_DISCARD_NONE, JB_DISCARD_STATIC, JB_DISCARD_PROGRESSIVE
+};
+static const char *discard_names[] = {"none","static","progressive"};
+
+typedef struct
+{
+  double ns;
+  uint64_t cycles;
+} mark_t;
+
+typedef struct
+{
+  jbuf_t *jb;
+  int *seq; //shared seq of a contended buffer, or the own one
+  unsigned long ops;
+  pthread_barrier_t *barrier;
+  mark_t t0, t1;
+} worker_t;
+
+static int csv = 0;
+static unsigned long ops = OPS;
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//TSC ticks, at the reference frequency of the cpu, 0 where there is no TSC
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static void mark(mark_t *m)
+{
+  m->ns = now_ns();
+  m->cycles = cycles();
+}
+
+static void report(const char *bench, unsigned frame_size, unsigned max_count,
+                   const char *pattern, const char *discard, int nthread,
+                   unsigned long n, const mark_t *t0, const mark_t *t1)
+{
+  double ns = n ? (t1->ns - t0->ns) / n : -1;
+  double cyc = n ? (double)(t1->cycles - t0->cycles) / n : -1;
+
+  if (csv) {
+    printf("%s,%u,%u,%s,%s,%d,%.1f,%.0f\n", bench, frame_size, max_count,
+           pattern, discard, nthread, ns, cyc);
+  } else {
+    printf("%-12s %8u %9u %-9s %-12s %7d %9.1f %10.0f\n", bench, frame_size,
+           max_count, pattern, discard, nthread, ns, cyc);
+  }
+}
+
+static void failed(const char *bench, unsigned frame_size, unsigned max_count)
+{
+  printf("%s %u %u: jbuf_create error\n", bench, frame_size, max_count);
+}
+
+//large frames are copied in and out, fewer operations keep the run short
+static unsigned long scaled_ops(unsigned frame_size)
+{
+  unsigned long n = ops * FRAME_SIZE / frame_size;
+
+  return n < MIN_OPS ? (ops < MIN_OPS ? ops : MIN_OPS) : n;
+}
+
+//seq of the i-th frame sent
+static int pattern_seq(int pattern, int i)
+{
+  static int perm[REORDER_WINDOW];
+  static int block = -1;
+  int j, k, tmp;
+
+  switch (pattern) {
+  case PATTERN_SWAP:
+    return i ^ 1;
+  case PATTERN_REVERSE8:
+    return (i & ~7) | (7 - (i & 7));
+  case PATTERN_RANDOM:
+    //a fixed shuffle of every window, the same from run to run
+    if (i / REORDER_WINDOW != block) {
+      block = i / REORDER_WINDOW;
+      srand(block);
+      for (j = 0; j < REORDER_WINDOW; j++) {
+        perm[j] = j;
+      }
+      for (j = REORDER_WINDOW - 1; j > 0; j--) {
+        k = rand() % (j + 1);
+        tmp = perm[j];
+        perm[j] = perm[k];
+        perm[k] = tmp;
+      }
+    }
+    return block * REORDER_WINDOW + perm[i % REORDER_WINDOW];
+  default:
+    return i;
+  }
+}
+
+static jbuf_t* half_full(unsigned frame_size, unsigned max_count,
+                         jb_discard_algo_t discard, char *frame, int *seq)
+{
+  jbuf_t *jb;
+
+  if (jbuf_create(frame_size, PTIME, max_count, &jb)) {
+    return NULL;
+  }
+  jbuf_set_adaptive(jb, max_count / 2, max_count / 2, max_count / 2);
+  jbuf_set_discard(jb, discard);
+  jbuf_reset(jb);
+
+  for (*seq = 0; *seq < (int)max_count / 2; (*seq)++) {
+    jbuf_put_frame3(jb, frame, frame_size, 0, *seq, *seq * PTIME, NULL);
+  }
+  return jb;
+}
+
+//keep the buffer half full, so PUT and GET touch slots far apart
+static void bench_put_get(unsigned frame_size, unsigned max_count, int pattern,
+                          int discard)
+{
+  jbuf_t *jb;
+  char *frame;
+  size_t size;
+  char type;
+  uint32_t bit_info, ts;
+  int seq, base, got;
+  unsigned long i, n = scaled_ops(frame_size);
+  int *seqs;
+  mark_t t0, t1;
+
+  frame = malloc(frame_size);
+  seqs = malloc(n * sizeof(int));
+  if (frame == NULL || seqs == NULL) {
+    printf("malloc error\n");
+    free(frame);
+    free(seqs);
+    return;
+  }
+  memset(frame, 0x55, frame_size);
+
+  jb = half_full(frame_size, max_count, discards[discard], frame, &base);
+  if (jb == NULL) {
+    failed("put+get", frame_size, max_count);
+    free(frame);
+    free(seqs);
+    return;
+  }
+  //out of the timed loop, the shuffle costs more than a put
+  for (i = 0; i < n; i++) {
+    seqs[i] = base + pattern_seq(pattern, (int)i);
+  }
+
+  mark(&t0);
+  for (i = 0; i < n; i++) {
+    seq = seqs[i];
+    jbuf_put_frame3(jb, frame, frame_size, 0, seq, seq * PTIME, NULL);
+    jbuf_get_frame3(jb, frame, &size, &type, &bit_info, &ts, &got);
+  }
+  mark(&t1);
+  report("put+get", frame_size, max_count, pattern_names[pattern],
+         discard_names[discard], 1, n, &t0, &t1);
+
+  jbuf_destroy(jb);
+  free(frame);
+  free(seqs);
+}
+
+//peek every frame of a half full buffer, and remove the head frame while
+//putting one behind
+static void bench_peek_remove(unsigned frame_size, unsigned max_count)
+{
+  jbuf_t *jb;
+  char *frame;
+  const void *p;
+  size_t size;
+  char type;
+  uint32_t bit_info, ts;
+  int seq, got;
+  unsigned long i, n = scaled_ops(frame_size);
+  unsigned half = max_count / 2;
+  mark_t t0, t1;
+
+  frame = malloc(frame_size);
+  if (frame == NULL) {
+    printf("malloc error\n");
+    return;
+  }
+  memset(frame, 0x55, frame_size);
+
+  jb = half_full(frame_size, max_count, JB_DISCARD_NONE, frame, &seq);
+  if (jb == NULL) {
+    failed("peek", frame_size, max_count);
+    free(frame);
+    return;
+  }
+
+  //the frames are not copied, the cost doesn't depend on the frame size
+  mark(&t0);
+  for (i = 0; i < ops; i++) {
+    jbuf_peek_frame(jb, (unsigned)(i % half), &p, &size, &type, &bit_info,
+                    &ts, &got);
+  }
+  mark(&t1);
+  report("peek", frame_size, max_count, "inorder", "none", 1, ops, &t0, &t1);
+
+  mark(&t0);
+  for (i = 0; i < n; i++) {
+    jbuf_put_frame3(jb, frame, frame_size, 0, seq, seq * PTIME, NULL);
+    seq++;
+    jbuf_remove_frame(jb, 1);
+  }
+  mark(&t1);
+  report("put+remove", frame_size, max_count, "inorder", "none", 1, n, &t0,
+         &t1);
+
+  jbuf_destroy(jb);
+  free(frame);
+}
+
+//sequence restarts every few frames, each one resets the framelist
+static void bench_jump(unsigned max_count)
+{
+  jbuf_t *jb;
+  char frame[FRAME_SIZE];
+  int seq = 0;
+  unsigned long i, n = ops / 16;
+  mark_t t0, t1;
+
+  if (jbuf_create(FRAME_SIZE, PTIME, max_count, &jb)) {
+    failed("restart", FRAME_SIZE, max_count);
+    return;
+  }
+  jbuf_set_discard(jb, JB_DISCARD_NONE);
+
+  memset(frame, 0x55, sizeof(frame));
+  mark(&t0);
+  for (i = 0; i < n; i++) {
+    jbuf_put_frame(jb, frame, sizeof(frame), seq++);
+    jbuf_put_frame(jb, frame, sizeof(frame), seq++);
+    jbuf_put_frame(jb, frame, sizeof(frame), seq++);
+    seq += 5000;
+  }
+  mark(&t1);
+  report("restart", FRAME_SIZE, max_count, "jump", "none", 1, n, &t0, &t1);
+
+  jbuf_destroy(jb);
+}
+
+//put+get round robin over many buffers, so every slot access is a cache miss
+static void bench_streams(unsigned max_count)
+{
+  static jbuf_t *jbs[STREAMS];
+  static int seqs[STREAMS];
+  char frame[FRAME_SIZE];
+  char type;
+  unsigned long i, n = ops / STREAMS;
+  int j;
+  mark_t t0, t1;
+
+  memset(frame, 0x55, sizeof(frame));
+  for (j = 0; j < STREAMS; j++) {
+    jbs[j] = half_full(FRAME_SIZE, max_count, JB_DISCARD_NONE, frame, &seqs[j]);
+    if (jbs[j] == NULL) {
+      failed("streams", FRAME_SIZE, max_count);
+      while (j-- > 0) {
+        jbuf_destroy(jbs[j]);
+      }
+      return;
+    }
+  }
+
+  mark(&t0);
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < STREAMS; j++) {
+      jbuf_put_frame(jbs[j], frame, sizeof(frame), seqs[j]++);
+      jbuf_get_frame(jbs[j], frame, &type);
+    }
+  }
+  mark(&t1);
+  report("streams", FRAME_SIZE, max_count, "inorder", "none", 1,
+         n * STREAMS, &t0, &t1);
+
+  for (j = 0; j < STREAMS; j++) {
+    jbuf_destroy(jbs[j]);
+  }
+}
+
+static void* worker_run(void *arg)
+{
+  worker_t *w = (worker_t*) arg;
+  char frame[FRAME_SIZE];
+  size_t size;
+  char type;
+  uint32_t bit_info, ts;
+  unsigned long i;
+  int seq, got;
+
+  memset(frame, 0x55, sizeof(frame));
+  pthread_barrier_wait(w->barrier);
+
+  mark(&w->t0);
+  for (i = 0; i < w->ops; i++) {
+    seq = __atomic_fetch_add(w->seq, 1, __ATOMIC_RELAXED);
+    jbuf_put_frame3(w->jb, frame, sizeof(frame), 0, seq, seq * PTIME, NULL);
+    jbuf_get_frame3(w->jb, frame, &size, &type, &bit_info, &ts, &got);
+  }
+  mark(&w->t1);
+  return NULL;
+}
+
+//put+get from several threads, on one buffer(contended lock) or on a
+//buffer each(uncontended), the time is the one seen by each thread
+static void bench_threads(int nthread, int shared, unsigned max_count)
+{
+  worker_t w[8];
+  pthread_t tid[8];
+  pthread_barrier_t barrier;
+  char frame[FRAME_SIZE];
+  int seqs[8];
+  mark_t t0, t1;
+  int i, started;
+
+  memset(frame, 0x55, sizeof(frame));
+  memset(w, 0, sizeof(w));
+  for (i = 0; i < nthread; i++) {
+    if (i == 0 || !shared) {
+      w[i].jb = half_full(FRAME_SIZE, max_count, JB_DISCARD_NONE, frame,
+                          &seqs[i]);
+      if (w[i].jb == NULL) {
+        failed("threads", FRAME_SIZE, max_count);
+        nthread = i;
+        goto out;
+      }
+      w[i].seq = &seqs[i];
+    } else {
+      w[i].jb = w[0].jb;
+      w[i].seq = w[0].seq;
+    }
+    w[i].ops = ops / 4;
+    w[i].barrier = &barrier;
+  }
+
+  pthread_barrier_init(&barrier, NULL, nthread);
+  for (started = 0; started < nthread; started++) {
+    if (pthread_create(&tid[started], NULL, worker_run, &w[started]) != 0) {
+      printf("pthread_create error\n");
+      //the barrier would never open
+      exit(1);
+    }
+  }
+  for (i = 0; i < nthread; i++) {
+    pthread_join(tid[i], NULL);
+  }
+  pthread_barrier_destroy(&barrier);
+
+  //from the first start to the last end
+  t0 = w[0].t0;
+  t1 = w[0].t1;
+  for (i = 1; i < nthread; i++) {
+    if (w[i].t0.ns < t0.ns) {
+      t0 = w[i].t0;
+    }
+    if (w[i].t1.ns > t1.ns) {
+      t1 = w[i].t1;
+    }
+  }
+  report(shared ? "contended" : "uncontended", FRAME_SIZE, max_count,
+         "inorder", "none", nthread, ops / 4, &t0, &t1);
+
+out:
+  for (i = 0; i < nthread; i++) {
+    if (i == 0 || !shared) {
+      jbuf_destroy(w[i].jb);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned i, j;
+  int opt, k;
+
+  while ((opt = getopt(argc, argv, "cn:")) != -1) {
+    switch (opt) {
+    case 'c':
+      csv = 1;
+      break;
+    case 'n':
+      ops = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      printf("usage: bench [-c] [-n ops]\n");
+      return 1;
+    }
+  }
+  if (ops < 16) {
+    ops = 16;
+  }
+
+  if (csv) {
+    printf("bench,frame_size,max_count,pattern,discard,threads,ns_op,cycles_op\n");
+  } else {
+    printf("%-12s %8s %9s %-9s %-12s %7s %9s %10s\n", "bench", "frame",
+           "max_count", "pattern", "discard", "threads", "ns/op", "cycles/op");
+  }
+
+  for (i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+    for (j = 0; j < sizeof(capacities) / sizeof(capacities[0]); j++) {
+      if ((unsigned long long)frame_sizes[i] * capacities[j] > MAX_BYTES) {
+        continue;
+      }
+      bench_put_get(frame_sizes[i], capacities[j], PATTERN_INORDER, 0);
+    }
+  }
+
+  for (k = 1; k < PATTERN_COUNT; k++) {
+    for (j = 0; j < sizeof(capacities) / sizeof(capacities[0]); j++) {
+      bench_put_get(FRAME_SIZE, capacities[j], k, 0);
+    }
+  }
+
+  for (k = 1; k < (int)(sizeof(discards) / sizeof(discards[0])); k++) {
+    for (j = 0; j < sizeof(capacities) / sizeof(capacities[0]); j++) {
+      bench_put_get(FRAME_SIZE, capacities[j], PATTERN_INORDER, k);
+    }
+  }
+
+  for (i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+    bench_peek_remove(frame_sizes[i], 1024);
+  }
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    bench_jump(counts[i]);
+  }
+
+  for (i = 0; i < sizeof(stream_counts) / sizeof(stream_counts[0]); i++) {
+    bench_streams(stream_counts[i]);
+  }
+
+  for (k = 0; k < (int)(sizeof(threads) / sizeof(threads[0])); k++) {
+    bench_threads(threads[k], 0, 1024);
+    bench_threads(threads[k], 1, 1024);
+  }
+  return 0;
+}
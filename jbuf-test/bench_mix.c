@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "jtbuf.h"
+#include "jtmix.h"
+
+#define SAMPLES 320
+#define PTIME 20
+#define TICKS 2000
+#define VAD_LEVEL 100
+
+static const unsigned members[] = {8,64,256};
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//every participant talks (the worst case of the mixer), or all are idle
+//with a low noise, with or without the voice activity detection
+static double bench_mix(unsigned count, int idle, unsigned vad, double *put)
+{
+  jbuf_mixer_t *mixer;
+  jbuf_t **jbs;
+  int16_t frame[SAMPLES];
+  double t0, t1, tput = 0;
+  unsigned i, j;
+
+  jbs = calloc(count, sizeof(jbuf_t*));
+  if (jbs == NULL || jbuf_mixer_create(SAMPLES, count, &mixer)) {
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    jbuf_create(SAMPLES * 2, PTIME, 50, &jbs[i]);
+    jbuf_set_adaptive(jbs[i], 0, 0, 10);
+    jbuf_set_discard(jbs[i], JB_DISCARD_NONE);
+    jbuf_set_vad(jbs[i], vad);
+    jbuf_mixer_add(mixer, jbs[i]);
+  }
+  for (i = 0; i < SAMPLES; i++) {
+    frame[i] = (int16_t)(idle ? rand() % 20 - 10 : rand() % 20000 - 10000);
+  }
+
+  t1 = 0;
+  for (j = 0; j < TICKS; j++) {
+    t0 = now_ns();
+    for (i = 0; i < count; i++) {
+      jbuf_put_frame(jbs[i], frame, sizeof(frame), j);
+    }
+    tput += now_ns() - t0;
+
+    t0 = now_ns();
+    jbuf_mixer_mix(mixer);
+    t1 += now_ns() - t0;
+  }
+
+  for (i = 0; i < count; i++) {
+    jbuf_destroy(jbs[i]);
+  }
+  jbuf_mixer_destroy(mixer);
+  free(jbs);
+
+  *put = tput / TICKS;
+  return t1 / TICKS;
+}
+
+int main()
+{
+  double mix, put;
+  unsigned i;
+
+  printf("participants mix(us/tick) mix(ns/participant) put(us/tick)\n");
+  for (i = 0; i < sizeof(members) / sizeof(members[0]); i++) {
+    mix = bench_mix(members[i], 0, 0, &put);
+    printf("%u %.1f %.1f %.1f\n", members[i], mix / 1000, mix / members[i], put / 1000);
+  }
+
+  printf("idle participants vad put+mix(ns/participant)\n");
+  for (i = 0; i < sizeof(members) / sizeof(members[0]); i++) {
+    mix = bench_mix(members[i], 1, 0, &put);
+    printf("%u off %.1f\n", members[i], (mix + put) / members[i]);
+    mix = bench_mix(members[i], 1, VAD_LEVEL, &put);
+    printf("%u on %.1f\n", members[i], (mix + put) / members[i]);
+  }
+  return 0;
+}
@@ -1,57 +1,210 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <math.h>
 #include <time.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <arpa/inet.h>
 #include "eloop.h"
 #include "jtbuf.h"
+#include "jtplay.h"
+#include "jttrace.h"
+#include "wpool.h"
 
 #define PACKET_BUF_SIZE 640
 #define PACKET_PTIME 20
 
 eloop_t *loop;
 event_t *node;
-event_t *gtimer;
+jbuf_playout_t *gplay;
 jbuf_t *g_jt;
-char *str[] = {"JB_MISSING_FRAME","JB_NORMAL_FRAME","JB_ZERO_PREFETCH_FRAME","JB_ZERO_EMPTY_FRAME"};
+jbuf_trace_t *g_trace;
+wpool_t *g_pool;
+wport_t *g_port;
+int g_rec_fd = -1;
+off_t g_rec_off;
+char *str[] = {"JB_MISSING_FRAME","JB_NORMAL_FRAME","JB_ZERO_PREFETCH_FRAME","JB_ZERO_EMPTY_FRAME","JB_ZERO_SILENT_FRAME"};
+
+uint32_t now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void record(unsigned op,int seq,char type)
+{
+  jbuf_trace_rec_t rec = {0};
+
+  if (g_trace) {
+    rec.time = now_ms();
+    rec.seq = seq;
+    //16 bit mono PCM
+    rec.ts = op == JB_TRACE_PUT ? seq * (PACKET_BUF_SIZE / 2) : 0;
+    rec.size = op == JB_TRACE_PUT ? PACKET_BUF_SIZE : 0;
+    rec.op = op;
+    rec.type = type;
+    jbuf_trace_write(g_trace, &rec);
+  }
+}
+
+//a played frame written by the pool, the disk never holds up the loop
+typedef struct
+{
+  char frame[PACKET_BUF_SIZE];
+  off_t off;
+  int error;
+} rec_job_t;
+
+void rec_write(void *arg)
+{
+  rec_job_t *job = (rec_job_t*) arg;
+
+  //at its own offset, the jobs may run in any order
+  job->error = pwrite(g_rec_fd, job->frame, PACKET_BUF_SIZE, job->off) != PACKET_BUF_SIZE;
+}
+
+void rec_done(eloop_t *loop,void *arg)
+{
+  rec_job_t *job = (rec_job_t*) arg;
+
+  if (job->error) {
+    printf("record write error\n");
+  }
+  free(job);
+}
 
 void r_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
 {
-  static int seq = 0;
   char buf[PACKET_BUF_SIZE] = {0};
-  read(fd,buf,sizeof(buf));
-  jbuf_put_frame(g_jt,buf,PACKET_BUF_SIZE,++seq);
+  uint32_t seq;
+
+  if (read(fd,buf,sizeof(buf)) != sizeof(buf)) {
+    return;
+  }
+  //the seq is in the payload, the packets may be lost or reordered on the way
+  memcpy(&seq, buf, sizeof(seq));
+  seq = ntohl(seq);
+  jbuf_put_frame(g_jt,buf,PACKET_BUF_SIZE,seq);
+  record(JB_TRACE_PUT,seq,0);
 }
 
-void g_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
+void g_callback(jbuf_playout_t *po,const void *frame,size_t size,char type,void *arg)
 {
-  char type;
-  char buf[PACKET_BUF_SIZE] = {0};
-  jbuf_get_frame(g_jt, buf, &type);
-  printf("get %s\n",str[type]);
+  rec_job_t *job;
+
+  printf("get %s\n",str[(int)type]);
+  record(JB_TRACE_GET,-1,type);
+
+  if (g_pool && (job = malloc(sizeof(rec_job_t))) != NULL) {
+    //the frame is zeroed when not a normal one
+    memcpy(job->frame, frame, PACKET_BUF_SIZE);
+    job->off = g_rec_off;
+    g_rec_off += PACKET_BUF_SIZE;
+    if (wpool_submit(g_pool, g_port, rec_write, rec_done, job) < 0) {
+      free(job);
+    }
+  }
+}
+
+void on_signal(int sig)
+{
+  e_loop_cancel(loop);
 }
 
-int main()
+//usage: c [-r pcm] [trace], the puts and gets are recorded to the trace file,
+//replay it with jbsim; the frames played are recorded to pcm
+int main(int argc,char *argv[])
 {
-  int fd,error = 0;
+  int fd,opt,error = 0;
+  jbuf_trace_hdr_t hdr;
+  wpool_stat_t stat;
+  char *rec = NULL;
+
+  while ((opt = getopt(argc, argv, "r:")) != -1) {
+    switch (opt) {
+    case 'r':
+      rec = optarg;
+      break;
+    default:
+      printf("usage: c [-r pcm] [trace]\n");
+      return -1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
   loop = e_loop_new();
 
   //create jitter buffer
   error = jbuf_create(PACKET_BUF_SIZE, PACKET_PTIME, 40, &g_jt);
   if(error){
-    return NULL;
+    return -1;
   }
   jbuf_set_adaptive(g_jt, 20, 10, 30);
   jbuf_set_discard(g_jt, JB_DISCARD_NONE);
 
   fd = open("/tmp/pc_fifo",O_RDONLY);
   node = e_event_new(E_READ,fd,r_callback,NULL);
-  gtimer = e_event_new(E_TIMER,10,g_callback,NULL);
+
+  //frames are played every ptime while available,
+  //the playout sleeps while the jitter buffer is prefetching or empty
+  gplay = jbuf_playout_new(loop,g_jt,g_callback,NULL);
+
+  if (argc > 1) {
+    hdr.frame_size = PACKET_BUF_SIZE;
+    hdr.ptime = PACKET_PTIME;
+    hdr.clock_rate = PACKET_BUF_SIZE / 2 * 1000 / PACKET_PTIME;
+    if (jbuf_trace_create(argv[1], &hdr, &g_trace) != 0) {
+      printf("can't create %s\n", argv[1]);
+      return -1;
+    }
+    //stop the loop on ctrl-c so the trace is flushed
+    signal(SIGINT, on_signal);
+  }
+
+  if (rec) {
+    g_rec_fd = open(rec, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (g_rec_fd < 0) {
+      printf("can't create %s\n", rec);
+      return -1;
+    }
+    g_pool = wpool_new(1);
+    g_port = g_pool ? wport_new(loop) : NULL;
+    if (g_port == NULL) {
+      printf("can't record to %s\n", rec);
+      if (g_pool) {
+        wpool_free(g_pool);
+      }
+      close(g_rec_fd);
+      return -1;
+    }
+    signal(SIGINT, on_signal);
+  }
 
   e_event_add(loop,node);
-  e_event_add(loop,gtimer);
   e_loop_run(loop);
+
+  if (g_pool) {
+    wpool_stat(g_pool, &stat);
+    printf("record: frames:%lu depth max:%lu wait avg:%.1fus max:%.1fus write avg:%.1fus max:%.1fus\n",
+           stat.completed, stat.depth_max, stat.wait_avg, stat.wait_max, stat.run_avg, stat.run_max);
+
+    //the last writes are waited for, then their completions are called
+    //so that the jobs are freed
+    wpool_free(g_pool);
+    wport_drain(g_port);
+    wport_free(g_port);
+    close(g_rec_fd);
+  }
+
+  if (g_trace) {
+    jbuf_trace_close(g_trace);
+  }
   return 0;
 }
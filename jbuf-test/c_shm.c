@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "eloop.h"
+#include "jtbuf.h"
+#include "jtbuf_shm.h"
+
+#define PACKET_BUF_SIZE 640
+#define PACKET_COUNT 40
+#define PACKET_PREFETCH 20
+#define WAIT_TIMEOUT 1000
+
+eloop_t *loop;
+event_t *gtimer;
+jbuf_shm_t *g_shm;
+char *str[] = {"JB_MISSING_FRAME","JB_NORMAL_FRAME","JB_ZERO_PREFETCH_FRAME","JB_ZERO_EMPTY_FRAME"};
+
+void g_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
+{
+  char type;
+  char buf[PACKET_BUF_SIZE] = {0};
+  jbuf_shm_get_frame(g_shm, buf, NULL, &type, NULL, NULL, NULL);
+  printf("get %s\n",str[(int)type]);
+
+  //nothing to play, sleep on the doorbell until the producer puts enough
+  //frames rather than polling on each tick
+  if(type == JB_ZERO_EMPTY_FRAME || type == JB_ZERO_PREFETCH_FRAME){
+    if(jbuf_shm_wait(g_shm, WAIT_TIMEOUT) < 0)
+      printf("no frame in %d ms\n",WAIT_TIMEOUT);
+  }
+}
+
+int main()
+{
+  int error = 0;
+  loop = e_loop_new();
+
+  //create shared jitter buffer, the producer attaches to it
+  error = jbuf_shm_create("/dev/shm/pc_jbuf", PACKET_BUF_SIZE, PACKET_COUNT,
+                          PACKET_PREFETCH, &g_shm);
+  if(error){
+    return -1;
+  }
+
+  gtimer = e_event_new(E_TIMER,10,g_callback,NULL);
+
+  e_event_add(loop,gtimer);
+  e_loop_run(loop);
+  return 0;
+}
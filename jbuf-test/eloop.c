@@ -31,6 +31,10 @@ struct tag_loop
   fd_set write_set;
   int max_fd;
   int runing;
+  e_clock_t clock; //clock of the timers
+  void *clock_arg; //point to clock data
+  int virtual; //virtual clock, moved by e_loop_advance or to the next timer
+  unsigned int virtual_now; //current time of the virtual clock(ms)
 };
 
 //a event represents READ/WRITE/TIMER
@@ -55,15 +59,32 @@ typedef struct
   void *ptr;
 } hold_t;
 
+//monotonic, so that setting the wall clock doesn't fire or stall the timers
 static time_t poweron = 0;
-static time_t uptime_ms()
+static unsigned int uptime_ms(void *arg)
 {
-  time_t t;
-  struct timeval tv;
-  if (0 == poweron) poweron = time(NULL);
-  gettimeofday(&tv, NULL);
-  t = (tv.tv_sec - poweron) * 1000 + tv.tv_usec / 1000;
-  return t;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (0 == poweron) poweron = ts.tv_sec;
+  return (ts.tv_sec - poweron) * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned int virtual_ms(void *arg)
+{
+  return ((eloop_t*) arg)->virtual_now;
+}
+
+static int has_fds(eloop_t *loop)
+{
+  hold_t *h;
+
+  xlist_for_each_entry(h,&loop->read_head,xlist,hold_t) {
+    if (h->ptr) return 1;
+  }
+  xlist_for_each_entry(h,&loop->write_head,xlist,hold_t) {
+    if (h->ptr) return 1;
+  }
+  return 0;
 }
 
 static void recalculate_max_fd(eloop_t *loop)
@@ -89,11 +110,10 @@ static void recalculate_max_fd(eloop_t *loop)
   }
 }
 
-static void timer_next(eloop_t *loop, struct timeval *tv)
+static event_t* timer_first(eloop_t *loop)
 {
   hold_t *h;
   event_t *e, *p = NULL;
-  time_t now = uptime_ms();
 
   //get first timer
   xlist_for_each_entry(h,&loop->timer_head,xlist,hold_t) {
@@ -113,6 +133,14 @@ static void timer_next(eloop_t *loop, struct timeval *tv)
     }
   }
 
+  return p;
+}
+
+static void timer_next(eloop_t *loop, struct timeval *tv)
+{
+  event_t *p = timer_first(loop);
+  unsigned int now = e_loop_now(loop);
+
   //if timer xlist is empty,use default tv
   if (p == NULL) {
     tv->tv_sec = DEFAULT_TIMEOUT / 1000;
@@ -173,7 +201,7 @@ static void process_timer(eloop_t *loop)
 {
   hold_t *h, *t;
   event_t *e;
-  unsigned int now = uptime_ms();
+  unsigned int now = e_loop_now(loop);
 
   xlist_for_each_entry_safe(h,t,&loop->timer_head,xlist,hold_t) {
     /*the hold point to NULL should be delete and free*/
@@ -248,6 +276,7 @@ eloop_t* e_loop_new(void)
   INIT_XLIST_HEAD(&loop->write_head);
   FD_ZERO(&loop->read_set);
   FD_ZERO(&loop->write_set);
+  loop->clock = uptime_ms;
   return loop;
 }
 
@@ -278,7 +307,7 @@ void e_event_add(eloop_t* loop, event_t *e)
 
   if (e->flag & F_TIMER) {
     //caculate next expire time
-    unsigned int now = uptime_ms();
+    unsigned int now = e_loop_now(loop);
     e->timeout = now + e->value;
     xlist_add(&h->xlist, &loop->timer_head);
   }
@@ -338,44 +367,84 @@ void e_event_mod(eloop_t* loop, event_t *e, long ms)
   }
 }
 
-int e_loop_run(eloop_t* loop)
+//one select and the events ready, select error returns -1
+static int loop_once(eloop_t *loop, struct timeval *tv)
 {
-  int ret = 0;
+  int ret;
   fd_set read_set;
   fd_set write_set;
+
+  //assign fds
+  read_set = loop->read_set;
+  write_set = loop->write_set;
+
+  //printf("picked:%d,%d\n",tv->tv_sec,tv->tv_usec);
+  if ((ret = select(loop->max_fd + 1, &read_set, &write_set, NULL, tv)) < 0){
+    if(errno != EINTR){
+      printf("****************select error**********************\n");
+      printf("max_fd:%d,sec:%ld,usec:%ld\n",loop->max_fd,tv->tv_sec,tv->tv_usec);
+      return -1;
+    }
+    return 0;
+  }
+
+  //Test read fds
+  process_fds(loop, &loop->read_head, &read_set, &loop->read_set);
+
+  //Test write fds
+  process_fds(loop, &loop->write_head, &write_set, &loop->write_set);
+
+  //Test timer
+  process_timer(loop);
+  return ret;
+}
+
+int e_loop_run(eloop_t* loop)
+{
+  int ret = 0;
   struct timeval tv;
+  event_t *p;
 
   loop->runing = 1;
 
   while (loop->runing) {
-    //assign fds
-    read_set = loop->read_set;
-    write_set = loop->write_set;
-
     //pick next expired time
     timer_next(loop, &tv);
 
-    //printf("picked:%d,%d\n",tv.tv_sec,tv.tv_usec);
-    if ((ret = select(loop->max_fd + 1, &read_set, &write_set, NULL,&tv)) < 0){
-      if(errno != EINTR){
-        printf("****************select error**********************\n");
-        printf("max_fd:%d,sec:%ld,usec:%ld\n",loop->max_fd,tv.tv_sec,tv.tv_usec);
-        goto end;
+    //virtual clock doesn't pass by waiting, poll the fds,
+    //and when none is ready jump to the first timer
+    if (loop->virtual) {
+      p = timer_first(loop);
+      if (p == NULL && !has_fds(loop)) {
+        //nothing can happen any more
+        break;
       }
-      continue;
-    }
 
-    //Test read fds
-    process_fds(loop, &loop->read_head, &read_set, &loop->read_set);
+      if (p != NULL) {
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+      }
 
-    //Test write fds
-    process_fds(loop, &loop->write_head, &write_set, &loop->write_set);
+      if (!has_fds(loop)) {
+        //timers only, no need to poll
+        process_timer(loop);
+        ret = 0;
+      }
+      else if ((ret = loop_once(loop, &tv)) < 0) {
+        break;
+      }
 
-    //Test timer
-    process_timer(loop);
+      if (ret == 0 && loop->runing && (p = timer_first(loop)) != NULL && p->timeout > loop->virtual_now) {
+        loop->virtual_now = p->timeout;
+      }
+      continue;
+    }
+
+    if ((ret = loop_once(loop, &tv)) < 0) {
+      break;
+    }
   }
 
- end:
   /*when canceled loop clean hold xlist*/
   clean_xlist(&loop->read_head);
   clean_xlist(&loop->write_head);
@@ -383,6 +452,49 @@ int e_loop_run(eloop_t* loop)
   return ret;
 }
 
+int e_loop_run_once(eloop_t* loop, long ms)
+{
+  struct timeval tv;
+
+  timer_next(loop, &tv);
+
+  //the virtual clock doesn't go on while waiting
+  if (loop->virtual) {
+    ms = 0;
+  }
+  if (ms >= 0 && tv.tv_sec * 1000 + tv.tv_usec / 1000 > ms) {
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+  }
+
+  return loop_once(loop, &tv);
+}
+
+void e_loop_set_clock(eloop_t* loop, e_clock_t fn, void *arg)
+{
+  loop->clock = fn ? fn : uptime_ms;
+  loop->clock_arg = arg;
+  loop->virtual = 0;
+}
+
+void e_loop_set_virtual(eloop_t* loop, unsigned int start)
+{
+  loop->clock = virtual_ms;
+  loop->clock_arg = loop;
+  loop->virtual = 1;
+  loop->virtual_now = start;
+}
+
+void e_loop_advance(eloop_t* loop, unsigned int ms)
+{
+  loop->virtual_now += ms;
+}
+
+unsigned int e_loop_now(eloop_t* loop)
+{
+  return loop->clock(loop->clock_arg);
+}
+
 void e_loop_cancel(eloop_t* loop)
 {
   loop->runing = 0;
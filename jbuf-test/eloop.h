@@ -20,6 +20,13 @@ callback funtion for events
  */
 typedef void (*callback_t)(eloop_t *loop,event_t *evt,long fd,void *arg);
 
+/*
+clock of a loop, the timers expire on it
+@arg: the extra data given to e_loop_set_clock
+return the current time(ms)
+*/
+typedef unsigned int (*e_clock_t)(void *arg);
+
 /*
 type for e_event_new
 */
@@ -46,6 +53,44 @@ in a event callback or in another thread
 */
 int  e_loop_run(eloop_t* loop);
 
+/*
+run one round of a loop: wait for the fds at most ms(ms<0 until the
+first timer),then call the events ready and the timers expired,
+a loop on the virtual clock never waits;
+return the number of fds ready,-1 on error
+*/
+int  e_loop_run_once(eloop_t* loop,long ms);
+
+/*
+replace the clock of a loop,set it before adding timers;
+the default clock is monotonic, fn NULL restores it;
+the loop waits on select for the ms of the clock,so a clock
+running faster than the real time fires its timers late
+@fn: the clock
+@arg: extra data for user,it will pass to fn
+*/
+void e_loop_set_clock(eloop_t* loop,e_clock_t fn,void *arg);
+
+/*
+put a loop on a virtual clock which goes on only by e_loop_advance,
+or,in e_loop_run,by jumping to the first timer when no fd is ready;
+e_loop_run returns when there is neither timer nor fd left,
+so hours of timers run in no time and always in the same order
+@start: the time(ms) to start from
+*/
+void e_loop_set_virtual(eloop_t* loop,unsigned int start);
+
+/*
+move the virtual clock of a loop forward,
+the timers expired fire in the next round
+*/
+void e_loop_advance(eloop_t* loop,unsigned int ms);
+
+/*
+get the current time(ms) of a loop's clock
+*/
+unsigned int e_loop_now(eloop_t* loop);
+
 /*
 stop a loop's running,this is the only routine
 that can be called in another thread
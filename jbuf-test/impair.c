@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "impair.h"
+
+//send interval assumed until two packets have been sent(ms)
+#define DEFAULT_INTERVAL 20
+
+typedef struct
+{
+  double at; //delivery time(ms, receiver clock)
+  unsigned long order; //send order, keeps equal times in order
+  int seq;
+  uint32_t ts;
+  size_t size;
+  char *data;
+} flight_t;
+
+struct tag_impair
+{
+  impair_cfg_t cfg;
+  uint64_t rng; //xorshift64* state
+  int bad; //Gilbert-Elliott state
+  int started;
+  double first; //first send time(ms, sender clock)
+  double last; //last send time(ms, sender clock)
+  double interval; //smoothed send interval(ms)
+
+  flight_t *heap; //packets in flight, min heap by delivery time
+  unsigned count;
+  unsigned size;
+  unsigned long order;
+  char *delivered; //data of the last packet delivered
+  impair_stat_t stat;
+};
+
+static double uniform(impair_t *im)
+{
+  im->rng ^= im->rng >> 12;
+  im->rng ^= im->rng << 25;
+  im->rng ^= im->rng >> 27;
+  return ((im->rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//extra delay drawn from the jitter distribution(ms)
+static double jitter(impair_t *im)
+{
+  const impair_cfg_t *cfg = &im->cfg;
+  double u, v, d;
+
+  switch (cfg->jitter) {
+  case IMPAIR_JITTER_NORMAL:
+    //Box-Muller, cut at 0
+    u = uniform(im);
+    v = uniform(im);
+    d = cfg->jitter_mean + cfg->jitter_dev *
+        sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+    return d > 0 ? d : 0;
+  case IMPAIR_JITTER_PARETO:
+    //Pareto above its scale, shifted to start at 0
+    u = uniform(im);
+    return cfg->jitter_mean * (pow(1 - u, -1 / cfg->jitter_alpha) - 1);
+  default:
+    return 0;
+  }
+}
+
+static int earlier(const flight_t *a, const flight_t *b)
+{
+  return a->at < b->at || (a->at == b->at && a->order < b->order);
+}
+
+static void heap_push(impair_t *im, const flight_t *f)
+{
+  unsigned i = im->count++;
+  flight_t tmp;
+
+  im->heap[i] = *f;
+  while (i > 0 && earlier(&im->heap[i], &im->heap[(i - 1) / 2])) {
+    tmp = im->heap[i];
+    im->heap[i] = im->heap[(i - 1) / 2];
+    im->heap[(i - 1) / 2] = tmp;
+    i = (i - 1) / 2;
+  }
+}
+
+static void heap_pop(impair_t *im, flight_t *f)
+{
+  unsigned i = 0, c;
+  flight_t tmp;
+
+  *f = im->heap[0];
+  im->heap[0] = im->heap[--im->count];
+  while ((c = 2 * i + 1) < im->count) {
+    if (c + 1 < im->count && earlier(&im->heap[c + 1], &im->heap[c])) {
+      c++;
+    }
+    if (!earlier(&im->heap[c], &im->heap[i])) {
+      break;
+    }
+    tmp = im->heap[i];
+    im->heap[i] = im->heap[c];
+    im->heap[c] = tmp;
+    i = c;
+  }
+}
+
+static int enqueue(impair_t *im, const void *data, size_t size, int seq,
+                   uint32_t ts, double at)
+{
+  flight_t f;
+  void *p;
+
+  if (im->count == im->size) {
+    p = realloc(im->heap, (im->size ? im->size * 2 : 64) * sizeof(flight_t));
+    if (p == NULL) {
+      printf("malloc error\n");
+      return -1;
+    }
+    im->heap = p;
+    im->size = im->size ? im->size * 2 : 64;
+  }
+
+  f.data = malloc(size ? size : 1);
+  if (f.data == NULL) {
+    printf("malloc error\n");
+    return -1;
+  }
+  memcpy(f.data, data, size);
+  f.at = at;
+  f.order = im->order++;
+  f.seq = seq;
+  f.ts = ts;
+  f.size = size;
+  heap_push(im, &f);
+  return 0;
+}
+
+impair_t* impair_new(const impair_cfg_t *cfg)
+{
+  impair_t *im;
+
+  im = malloc(sizeof(impair_t));
+  if (im == NULL) {
+    printf("malloc error\n");
+    return NULL;
+  }
+
+  memset(im,0,sizeof(impair_t));
+  im->cfg = *cfg;
+  if (im->cfg.reorder_depth == 0) {
+    im->cfg.reorder_depth = 1;
+  }
+  if (im->cfg.jitter_alpha <= 0) {
+    im->cfg.jitter_alpha = 2;
+  }
+  //xorshift needs a non zero state
+  im->rng = ((uint64_t)cfg->seed << 32 | cfg->seed) ^ 0x9e3779b97f4a7c15ULL;
+  im->interval = DEFAULT_INTERVAL;
+  return im;
+}
+
+void impair_free(impair_t *im)
+{
+  unsigned i;
+
+  for (i = 0; i < im->count; i++) {
+    free(im->heap[i].data);
+  }
+  free(im->heap);
+  free(im->delivered);
+  free(im);
+}
+
+void impair_send(impair_t *im, const void *data, size_t size, int seq,
+                 uint32_t ts, double now)
+{
+  const impair_cfg_t *cfg = &im->cfg;
+  double at, loss;
+
+  if (!im->started) {
+    im->first = im->last = now;
+    im->started = 1;
+  } else if (now > im->last) {
+    im->interval += (now - im->last - im->interval) / 8;
+    im->last = now;
+  }
+  im->stat.sent++;
+
+  //Gilbert-Elliott: move, then draw the loss of the state
+  if (im->bad) {
+    im->bad = uniform(im) >= cfg->p_bad_good;
+  } else {
+    im->bad = uniform(im) < cfg->p_good_bad;
+  }
+  loss = im->bad ? cfg->loss_bad : cfg->loss_good;
+  if (loss > 0 && uniform(im) < loss) {
+    im->stat.lost++;
+    return;
+  }
+
+  //the sender clock runs (1 + skew) times faster than the receiver clock
+  at = im->first + (now - im->first) / (1 + cfg->skew_ppm * 1e-6);
+  at += cfg->delay + jitter(im);
+
+  if (cfg->reorder > 0 && uniform(im) < cfg->reorder) {
+    //let 1 to depth packets pass
+    at += (1 + (unsigned)(uniform(im) * cfg->reorder_depth) + 0.5) *
+          im->interval;
+    im->stat.reordered++;
+  }
+  if (enqueue(im, data, size, seq, ts, at) != 0) {
+    return;
+  }
+
+  if (cfg->dup > 0 && uniform(im) < cfg->dup) {
+    if (enqueue(im, data, size, seq, ts, at + jitter(im)) == 0) {
+      im->stat.duplicated++;
+    }
+  }
+}
+
+int impair_recv(impair_t *im, double now, impair_pkt_t *pkt)
+{
+  flight_t f;
+
+  if (im->count == 0 || im->heap[0].at > now) {
+    return 0;
+  }
+
+  heap_pop(im, &f);
+  free(im->delivered);
+  im->delivered = f.data;
+
+  pkt->data = f.data;
+  pkt->size = f.size;
+  pkt->seq = f.seq;
+  pkt->ts = f.ts;
+  pkt->arrival = f.at;
+  im->stat.delivered++;
+  return 1;
+}
+
+double impair_next(impair_t *im)
+{
+  return im->count ? im->heap[0].at : -1;
+}
+
+void impair_get_stat(impair_t *im, impair_stat_t *stat)
+{
+  *stat = im->stat;
+}
+
+static char* trim(char *s)
+{
+  char *e;
+
+  while (isspace((unsigned char)*s)) {
+    s++;
+  }
+  e = s + strlen(s);
+  while (e > s && isspace((unsigned char)e[-1])) {
+    *--e = 0;
+  }
+  return s;
+}
+
+static int set(impair_cfg_t *cfg, const char *key, const char *value,
+               double *loss, double *burst)
+{
+  double v = atof(value);
+
+  if (!strcmp(key, "loss")) {
+    *loss = v;
+  } else if (!strcmp(key, "burst")) {
+    *burst = v;
+  } else if (!strcmp(key, "loss_good")) {
+    cfg->loss_good = v;
+  } else if (!strcmp(key, "loss_bad")) {
+    cfg->loss_bad = v;
+  } else if (!strcmp(key, "p_good_bad")) {
+    cfg->p_good_bad = v;
+  } else if (!strcmp(key, "p_bad_good")) {
+    cfg->p_bad_good = v;
+  } else if (!strcmp(key, "delay")) {
+    cfg->delay = v;
+  } else if (!strcmp(key, "jitter")) {
+    if (!strcmp(value, "none")) {
+      cfg->jitter = IMPAIR_JITTER_NONE;
+    } else if (!strcmp(value, "normal")) {
+      cfg->jitter = IMPAIR_JITTER_NORMAL;
+    } else if (!strcmp(value, "pareto")) {
+      cfg->jitter = IMPAIR_JITTER_PARETO;
+    } else {
+      return -1;
+    }
+  } else if (!strcmp(key, "jitter_mean")) {
+    cfg->jitter_mean = v;
+  } else if (!strcmp(key, "jitter_dev")) {
+    cfg->jitter_dev = v;
+  } else if (!strcmp(key, "jitter_alpha")) {
+    cfg->jitter_alpha = v;
+  } else if (!strcmp(key, "reorder")) {
+    cfg->reorder = v;
+  } else if (!strcmp(key, "reorder_depth")) {
+    cfg->reorder_depth = (unsigned)v;
+  } else if (!strcmp(key, "dup")) {
+    cfg->dup = v;
+  } else if (!strcmp(key, "skew_ppm")) {
+    cfg->skew_ppm = v;
+  } else if (!strcmp(key, "seed")) {
+    cfg->seed = (unsigned)strtoul(value, NULL, 0);
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+//loss and burst set a Gilbert-Elliott model losing every packet in the
+//bad state, whose mean stay is burst packets
+static void finish(impair_cfg_t *cfg, double loss, double burst)
+{
+  if (loss <= 0 || loss >= 1) {
+    return;
+  }
+  if (burst < 1) {
+    burst = 1;
+  }
+  cfg->loss_good = 0;
+  cfg->loss_bad = 1;
+  cfg->p_bad_good = 1 / burst;
+  cfg->p_good_bad = loss * cfg->p_bad_good / (1 - loss);
+}
+
+int impair_load(const char *path, impair_cfg_t *cfg, int max)
+{
+  FILE *file;
+  char line[256], *s, *eq;
+  double loss = 0, burst = 1;
+  int n = 0, lineno = 0;
+
+  file = fopen(path, "r");
+  if (file == NULL) {
+    printf("can't open %s\n", path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    lineno++;
+    if ((s = strchr(line, '#')) != NULL) {
+      *s = 0;
+    }
+    s = trim(line);
+    if (*s == 0) {
+      continue;
+    }
+
+    if (*s == '[') {
+      if (n > 0) {
+        finish(&cfg[n - 1], loss, burst);
+      }
+      if (n == max || (eq = strchr(s, ']')) == NULL) {
+        printf("%s:%d: too many scenarios or bad section\n", path, lineno);
+        fclose(file);
+        return -1;
+      }
+      *eq = 0;
+      memset(&cfg[n], 0, sizeof(impair_cfg_t));
+      snprintf(cfg[n].name, sizeof(cfg[n].name), "%s", trim(s + 1));
+      cfg[n].seed = 1;
+      loss = 0;
+      burst = 1;
+      n++;
+      continue;
+    }
+
+    eq = strchr(s, '=');
+    if (n == 0 || eq == NULL) {
+      printf("%s:%d: syntax error\n", path, lineno);
+      fclose(file);
+      return -1;
+    }
+    *eq = 0;
+    if (set(&cfg[n - 1], trim(s), trim(eq + 1), &loss, &burst) != 0) {
+      printf("%s:%d: bad key or value\n", path, lineno);
+      fclose(file);
+      return -1;
+    }
+  }
+  if (n > 0) {
+    finish(&cfg[n - 1], loss, burst);
+  }
+
+  fclose(file);
+  return n;
+}
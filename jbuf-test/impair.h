@@ -0,0 +1,153 @@
+#ifndef __IMPAIR__
+#define __IMPAIR__
+
+/*
+handle of a network impairment stage, it sits between a producer and
+the jitter buffer: packets are sent into it at the sender time and come
+out at their delivery time, after burst loss (Gilbert-Elliott), delay
+and jitter (normal or Pareto), reordering, duplication and clock skew;
+it has no clock of its own, so it runs on a virtual clock (simulator) as
+well as on a real one (live), and its random draws only depend on the
+seed
+*/
+typedef struct tag_impair impair_t;
+
+/*
+jitter distributions
+*/
+enum{
+  IMPAIR_JITTER_NONE,
+  IMPAIR_JITTER_NORMAL,
+  IMPAIR_JITTER_PARETO
+};
+
+/*
+impairment scenario
+@name: the scenario name, the section of the config file
+@loss_good: loss probability in the good state
+@loss_bad: loss probability in the bad state
+@p_good_bad: probability to go from the good to the bad state per packet
+@p_bad_good: probability to go from the bad to the good state per packet
+@delay: base one way delay(ms)
+@jitter: IMPAIR_JITTER_NONE/NORMAL/PARETO
+@jitter_mean: normal: mean extra delay(ms); pareto: scale(ms)
+@jitter_dev: normal: standard deviation of the extra delay(ms)
+@jitter_alpha: pareto: shape, the lower the heavier the tail
+@reorder: probability a packet is held back behind the next ones
+@reorder_depth: max number of packets a held back packet is passed by
+@dup: probability a packet is delivered twice
+@skew_ppm: sender clock skew, positive when it runs faster than the
+           receiver clock
+@seed: seed of the random draws
+*/
+typedef struct
+{
+  char name[32];
+  double loss_good;
+  double loss_bad;
+  double p_good_bad;
+  double p_bad_good;
+  double delay;
+  int jitter;
+  double jitter_mean;
+  double jitter_dev;
+  double jitter_alpha;
+  double reorder;
+  unsigned reorder_depth;
+  double dup;
+  double skew_ppm;
+  unsigned seed;
+} impair_cfg_t;
+
+/*
+a packet delivered
+@data: the packet content, valid until the next impair_recv
+@size: the packet length
+@seq: the seq given to impair_send
+@ts: the timestamp given to impair_send
+@arrival: the delivery time(ms, receiver clock)
+*/
+typedef struct
+{
+  const void *data;
+  size_t size;
+  int seq;
+  uint32_t ts;
+  double arrival;
+} impair_pkt_t;
+
+/*
+metrics of an impairment stage
+*/
+typedef struct
+{
+  unsigned long sent;
+  unsigned long lost;
+  unsigned long reordered;
+  unsigned long duplicated;
+  unsigned long delivered;
+} impair_stat_t;
+
+/*
+load the scenarios of a config file, return the number of scenarios or -1
+the file is made of sections, one per scenario, of key = value lines:
+
+  [wifi]
+  loss = 0.02            #mean loss, sets a Gilbert-Elliott model with
+  burst = 3              #this mean burst length(packets), or:
+  loss_good = 0.001
+  loss_bad = 0.5
+  p_good_bad = 0.01
+  p_bad_good = 0.3
+  delay = 40
+  jitter = pareto        #none, normal or pareto
+  jitter_mean = 5
+  jitter_dev = 10
+  jitter_alpha = 2.5
+  reorder = 0.01
+  reorder_depth = 3
+  dup = 0.001
+  skew_ppm = 50
+  seed = 1
+
+@path: the config file
+@cfg: the scenarios loaded
+@max: the size of cfg
+*/
+int impair_load(const char *path,impair_cfg_t *cfg,int max);
+
+/*
+create an impairment stage for a scenario
+*/
+impair_t* impair_new(const impair_cfg_t *cfg);
+
+/*
+free an impairment stage, the packets not delivered are dropped
+*/
+void impair_free(impair_t *im);
+
+/*
+send a packet into the stage
+@now: the send time(ms, sender clock)
+*/
+void impair_send(impair_t *im,const void *data,size_t size,int seq,
+                 uint32_t ts,double now);
+
+/*
+get the next packet due at now(ms, receiver clock), return 1 if a packet
+is delivered, 0 if none is due
+*/
+int impair_recv(impair_t *im,double now,impair_pkt_t *pkt);
+
+/*
+get the delivery time of the next packet(ms, receiver clock), or -1 if
+no packet is in flight
+*/
+double impair_next(impair_t *im);
+
+/*
+get the metrics of a stage
+*/
+void impair_get_stat(impair_t *im,impair_stat_t *stat);
+
+#endif//__IMPAIR__
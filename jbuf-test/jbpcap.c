@@ -0,0 +1,687 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "jtbuf.h"
+
+//reads the RTP streams of a pcap or pcapng capture, and replays each one
+//(by SSRC) into its own jitter buffer at the captured arrival times, then
+//prints the playout statistics of every stream
+
+#define MAX_STREAMS 64
+
+//largest packet read
+#define MAX_PACKET 65536
+
+//arrival times kept to measure the latency of the frames played
+#define ARRIVAL_RING 4096
+
+//latency histogram range(ms)
+#define MAX_LATENCY 2000
+
+//pcap link types
+#define LINK_NULL 0
+#define LINK_ETHERNET 1
+#define LINK_RAW_OLD 12
+#define LINK_RAW 101
+#define LINK_SLL 113
+#define LINK_IPV4 228
+#define LINK_IPV6 229
+#define LINK_SLL2 276
+
+//pcapng block types
+#define BLOCK_SHB 0x0a0d0d0a
+#define BLOCK_IDB 1
+#define BLOCK_PB 2
+#define BLOCK_EPB 6
+
+#define MAX_INTERFACES 16
+
+typedef struct
+{
+  FILE *file;
+  int ng; //pcapng
+  int swap; //byte order differs from the host
+  int linktype; //pcap: link type of the file
+  uint32_t ts_div; //pcap: timestamp units per us(1 or 1000)
+  unsigned nif; //pcapng: number of interfaces
+  int if_link[MAX_INTERFACES]; //pcapng: link type of the interfaces
+  uint64_t if_units[MAX_INTERFACES]; //pcapng: timestamp units per second
+  uint8_t *buf;
+} capture_t;
+
+typedef struct
+{
+  uint32_t ssrc;
+  int pt;
+  jbuf_t *jb;
+  int seq; //extended seq of the last packet
+  int started;
+  uint64_t next_get; //time of the next GET(us)
+  uint64_t last_put; //time of the last packet(us)
+  uint32_t arrival[ARRIVAL_RING];
+  int arrival_seq[ARRIVAL_RING];
+  unsigned hist[MAX_LATENCY];
+  unsigned long packets;
+  unsigned long played;
+  unsigned long lost;
+  unsigned long late;
+  unsigned long empty;
+  unsigned long prefetching;
+} stream_t;
+
+static stream_t *streams[MAX_STREAMS];
+static int nstream = 0;
+static uint64_t t0; //time of the first packet(us)
+static int t0_set = 0;
+static struct timespec real0; //real time of the first packet
+
+//settings
+static double speed = 0; //0: as fast as possible
+static unsigned ptime = 20;
+static unsigned clock_rate = 8000;
+static unsigned frame_size = 1500;
+static unsigned max_count = 100;
+static int adapt = JB_ADAPT_BURST;
+static int discard = JB_DISCARD_PROGRESSIVE;
+static unsigned prefetch = 15, min_prefetch = 0, max_prefetch = 80;
+static int port = 0;
+static uint32_t only_ssrc = 0;
+static int ssrc_set = 0;
+
+static uint16_t get16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+//file fields, in the byte order of the capture
+static uint16_t fget16(const capture_t *c, const uint8_t *p)
+{
+  uint16_t v;
+  memcpy(&v, p, 2);
+  return c->swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t fget32(const capture_t *c, const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return c->swap ? __builtin_bswap32(v) : v;
+}
+
+static int capture_open(capture_t *c, const char *path)
+{
+  uint8_t hdr[24];
+  uint32_t magic;
+
+  memset(c, 0, sizeof(*c));
+  c->file = fopen(path, "rb");
+  if (c->file == NULL) {
+    printf("can't open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  c->buf = malloc(MAX_PACKET);
+  if (c->buf == NULL || fread(hdr, 1, 4, c->file) != 4) {
+    goto error;
+  }
+
+  memcpy(&magic, hdr, 4);
+  if (magic == BLOCK_SHB) {
+    //the section header is read as any block
+    c->ng = 1;
+    rewind(c->file);
+    return 0;
+  }
+
+  if (fread(hdr + 4, 1, 20, c->file) != 20) {
+    goto error;
+  }
+  if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+    c->swap = 0;
+  } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+    c->swap = 1;
+    magic = __builtin_bswap32(magic);
+  } else {
+    goto error;
+  }
+  c->ts_div = magic == 0xa1b23c4d ? 1000 : 1;
+  c->linktype = fget32(c, hdr + 20) & 0xffff;
+  return 0;
+
+ error:
+  printf("%s: not a pcap or pcapng file\n", path);
+  fclose(c->file);
+  free(c->buf);
+  return -1;
+}
+
+static void capture_close(capture_t *c)
+{
+  fclose(c->file);
+  free(c->buf);
+}
+
+//units per second of an if_tsresol option
+static uint64_t tsresol(uint8_t v)
+{
+  uint64_t units = 1;
+  unsigned i;
+
+  for (i = 0; i < (v & 0x7f); i++) {
+    units *= (v & 0x80) ? 2 : 10;
+  }
+  return units;
+}
+
+static void read_idb(capture_t *c, const uint8_t *body, uint32_t len)
+{
+  uint32_t off = 8;
+  uint16_t code, olen;
+
+  if (c->nif == MAX_INTERFACES || len < 8) {
+    return;
+  }
+  c->if_link[c->nif] = fget16(c, body);
+  c->if_units[c->nif] = 1000000;
+
+  while (off + 4 <= len) {
+    code = fget16(c, body + off);
+    olen = fget16(c, body + off + 2);
+    if (code == 0 || off + 4 + olen > len) {
+      break;
+    }
+    if (code == 9 && olen >= 1) {
+      c->if_units[c->nif] = tsresol(body[off + 4]);
+    }
+    off += 4 + ((olen + 3) & ~3);
+  }
+  c->nif++;
+}
+
+//read the next packet, return its length, 0 at the end, -1 on error
+static int capture_next(capture_t *c, const uint8_t **data, uint64_t *us, int *linktype)
+{
+  uint8_t hdr[16];
+  uint32_t type, len, caplen, ifid;
+  uint64_t ts;
+
+  if (!c->ng) {
+    if (fread(hdr, 1, 16, c->file) != 16) {
+      return 0;
+    }
+    caplen = fget32(c, hdr + 8);
+    if (caplen > MAX_PACKET || fread(c->buf, 1, caplen, c->file) != caplen) {
+      return -1;
+    }
+    *data = c->buf;
+    *us = (uint64_t)fget32(c, hdr) * 1000000 + fget32(c, hdr + 4) / c->ts_div;
+    *linktype = c->linktype;
+    return (int)caplen;
+  }
+
+  while (1) {
+    if (fread(hdr, 1, 8, c->file) != 8) {
+      return 0;
+    }
+    memcpy(&type, hdr, 4);
+    if (type == BLOCK_SHB) {
+      //byte order of the section, from the magic after the length
+      if (fread(hdr + 8, 1, 4, c->file) != 4) {
+        return -1;
+      }
+      memcpy(&type, hdr + 8, 4);
+      c->swap = type != 0x1a2b3c4d;
+      c->nif = 0;
+      len = fget32(c, hdr + 4);
+      if (len < 12 || len > MAX_PACKET || fread(c->buf, 1, len - 12, c->file) != len - 12) {
+        return -1;
+      }
+      continue;
+    }
+
+    type = fget32(c, hdr);
+    len = fget32(c, hdr + 4);
+    if (len < 12 || len > MAX_PACKET || fread(c->buf, 1, len - 8, c->file) != len - 8) {
+      return -1;
+    }
+    len -= 12; //body length
+
+    if (type == BLOCK_IDB) {
+      read_idb(c, c->buf, len);
+    } else if ((type == BLOCK_EPB && len >= 20) || (type == BLOCK_PB && len >= 20)) {
+      if (type == BLOCK_EPB) {
+        ifid = fget32(c, c->buf);
+      } else {
+        ifid = fget16(c, c->buf);
+      }
+      caplen = fget32(c, c->buf + 12);
+      if (ifid >= c->nif || caplen > len - 20) {
+        continue;
+      }
+      ts = (uint64_t)fget32(c, c->buf + 4) << 32 | fget32(c, c->buf + 8);
+      *us = c->if_units[ifid] == 1000000 ? ts :
+        (uint64_t)((double)ts * 1000000 / c->if_units[ifid]);
+      *data = c->buf + 20;
+      *linktype = c->if_link[ifid];
+      return (int)caplen;
+    }
+  }
+}
+
+//find the UDP payload of a packet, return its length or -1
+static int udp_payload(const uint8_t *p, int len, int linktype, const uint8_t **payload)
+{
+  int off = 0, proto = 0, ihl, next;
+  uint32_t family;
+
+  switch (linktype) {
+  case LINK_ETHERNET:
+    if (len < 14) {
+      return -1;
+    }
+    proto = get16(p + 12);
+    off = 14;
+    //VLAN tags
+    while ((proto == 0x8100 || proto == 0x88a8) && off + 4 <= len) {
+      proto = get16(p + off + 2);
+      off += 4;
+    }
+    break;
+  case LINK_SLL:
+    if (len < 16) {
+      return -1;
+    }
+    proto = get16(p + 14);
+    off = 16;
+    break;
+  case LINK_SLL2:
+    if (len < 20) {
+      return -1;
+    }
+    proto = get16(p);
+    off = 20;
+    break;
+  case LINK_NULL:
+    if (len < 4) {
+      return -1;
+    }
+    memcpy(&family, p, 4);
+    if (family > 0xffff) {
+      family = __builtin_bswap32(family);
+    }
+    proto = family == 2 ? 0x0800 : 0x86dd;
+    off = 4;
+    break;
+  case LINK_RAW:
+  case LINK_RAW_OLD:
+  case LINK_IPV4:
+  case LINK_IPV6:
+    if (len < 1) {
+      return -1;
+    }
+    proto = (p[0] >> 4) == 4 ? 0x0800 : 0x86dd;
+    break;
+  default:
+    return -1;
+  }
+
+  p += off;
+  len -= off;
+
+  if (proto == 0x0800) {
+    if (len < 20 || (p[0] >> 4) != 4) {
+      return -1;
+    }
+    ihl = (p[0] & 0x0f) * 4;
+    //no fragment
+    if (p[9] != 17 || (get16(p + 6) & 0x3fff) != 0 || len < ihl + 8) {
+      return -1;
+    }
+    p += ihl;
+    len -= ihl;
+  } else if (proto == 0x86dd) {
+    if (len < 40 || (p[0] >> 4) != 6) {
+      return -1;
+    }
+    next = p[6];
+    p += 40;
+    len -= 40;
+    //hop-by-hop, routing and destination options headers
+    while ((next == 0 || next == 43 || next == 60) && len >= 8) {
+      off = (p[1] + 1) * 8;
+      if (len < off) {
+        return -1;
+      }
+      next = p[0];
+      p += off;
+      len -= off;
+    }
+    if (next != 17 || len < 8) {
+      return -1;
+    }
+  } else {
+    return -1;
+  }
+
+  if (port && get16(p) != port && get16(p + 2) != port) {
+    return -1;
+  }
+  if (get16(p + 4) < 8 || get16(p + 4) > len) {
+    return -1;
+  }
+  *payload = p + 8;
+  return get16(p + 4) - 8;
+}
+
+static void sleep_until(uint64_t us)
+{
+  struct timespec ts;
+  long long ns;
+
+  if (speed <= 0) {
+    return;
+  }
+  ns = (long long)((us - t0) * 1000 / speed);
+  ts.tv_sec = real0.tv_sec + (real0.tv_nsec + ns) / 1000000000LL;
+  ts.tv_nsec = (real0.tv_nsec + ns) % 1000000000LL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static void get(stream_t *st, char *frame)
+{
+  size_t size = 0;
+  char type;
+  int seq = -1;
+  int32_t lat;
+  uint32_t now = (uint32_t)((st->next_get - t0) / 1000);
+
+  sleep_until(st->next_get);
+  jbuf_get_frame3(st->jb, frame, &size, &type, NULL, NULL, &seq);
+  switch (type) {
+  case JB_NORMAL_FRAME:
+  case JB_ZERO_SILENT_FRAME:
+    st->played++;
+    if (seq >= 0 && st->arrival_seq[seq % ARRIVAL_RING] == seq) {
+      lat = (int32_t)(now - st->arrival[seq % ARRIVAL_RING]);
+      lat = lat < 0 ? 0 : (lat >= MAX_LATENCY ? MAX_LATENCY - 1 : lat);
+      st->hist[lat]++;
+    }
+    break;
+  case JB_MISSING_FRAME:
+    st->lost++;
+    break;
+  case JB_ZERO_PREFETCH_FRAME:
+    st->prefetching++;
+    break;
+  default:
+    st->empty++;
+    break;
+  }
+  st->next_get += ptime * 1000;
+}
+
+static stream_t* stream_get(uint32_t ssrc, int pt, uint64_t us)
+{
+  stream_t *st;
+  int i;
+
+  for (i = 0; i < nstream; i++) {
+    if (streams[i]->ssrc == ssrc) {
+      return streams[i];
+    }
+  }
+  if (nstream == MAX_STREAMS) {
+    return NULL;
+  }
+
+  st = calloc(1, sizeof(stream_t));
+  if (st == NULL || jbuf_create(frame_size, ptime, max_count, &st->jb) != 0) {
+    printf("can't create the jitter buffer of %08x\n", ssrc);
+    free(st);
+    return NULL;
+  }
+  jbuf_set_clock_rate(st->jb, clock_rate);
+  jbuf_set_adapt(st->jb, adapt);
+  jbuf_set_discard(st->jb, discard);
+  jbuf_set_adaptive(st->jb, prefetch, min_prefetch, max_prefetch);
+  memset(st->arrival_seq, 0xff, sizeof(st->arrival_seq));
+  st->ssrc = ssrc;
+  st->pt = pt;
+  st->next_get = us;
+  streams[nstream++] = st;
+  return st;
+}
+
+static void put(const uint8_t *rtp, int len, uint64_t us, char *frame)
+{
+  stream_t *st;
+  int off, seq, pt, dropped, i;
+  uint32_t arrival;
+
+  //RTP version 2, not RTCP
+  if (len < 12 || (rtp[0] >> 6) != 2) {
+    return;
+  }
+  pt = rtp[1] & 0x7f;
+  if (pt >= 72 && pt <= 76) {
+    return;
+  }
+  if (ssrc_set && get32(rtp + 8) != only_ssrc) {
+    return;
+  }
+
+  off = 12 + (rtp[0] & 0x0f) * 4;
+  if ((rtp[0] & 0x10) && off + 4 <= len) {
+    off += 4 + get16(rtp + off + 2) * 4;
+  }
+  if ((rtp[0] & 0x20) && len > off) {
+    len -= rtp[len - 1];
+  }
+  if (off > len) {
+    return;
+  }
+
+  //play all the streams up to the arrival
+  for (i = 0; i < nstream; i++) {
+    while (streams[i]->next_get <= us) {
+      get(streams[i], frame);
+    }
+  }
+
+  st = stream_get(get32(rtp + 8), pt, us);
+  if (st == NULL) {
+    return;
+  }
+
+  //extend the 16 bit seq
+  seq = get16(rtp + 2);
+  if (st->started) {
+    seq = st->seq + (int16_t)(seq - (st->seq & 0xffff));
+  }
+  if (!st->started || seq > st->seq) {
+    st->seq = seq;
+  }
+  st->started = 1;
+
+  sleep_until(us);
+  arrival = (uint32_t)((us - t0) / 1000);
+  //a packet reordered across the first one has a negative seq,
+  //it is put but its latency isn't measured, as in jbsim
+  if (seq >= 0) {
+    st->arrival[seq % ARRIVAL_RING] = arrival;
+    st->arrival_seq[seq % ARRIVAL_RING] = seq;
+  }
+  st->packets++;
+  st->last_put = us;
+  jbuf_put_frame4(st->jb, rtp + off, len - off, rtp[1] >> 7, seq,
+                  get32(rtp + 4), arrival, &dropped);
+  if (dropped) {
+    st->late++;
+  }
+}
+
+static void report()
+{
+  jb_state_t state;
+  stream_t *st;
+  unsigned long n;
+  double avg;
+  unsigned p95, max;
+  int i, j;
+
+  printf("%-8s %3s %8s %8s %6s %6s %7s %6s %8s %6s %7s %7s %7s %6s\n",
+         "ssrc", "pt", "packets", "played", "lost", "late", "discard",
+         "empty", "prefetch", "jitter", "lat_avg", "lat_p95", "lat_max", "drift");
+  for (i = 0; i < nstream; i++) {
+    st = streams[i];
+    jbuf_get_state(st->jb, &state);
+
+    n = 0;
+    avg = 0;
+    p95 = max = 0;
+    for (j = 0; j < MAX_LATENCY; j++) {
+      n += st->hist[j];
+      avg += (double)j * st->hist[j];
+      if (st->hist[j]) {
+        max = j;
+      }
+    }
+    if (n) {
+      avg /= n;
+      for (j = 0, n = (n * 95 + 99) / 100; j < MAX_LATENCY; j++) {
+        if (st->hist[j] >= n) {
+          p95 = j;
+          break;
+        }
+        n -= st->hist[j];
+      }
+    }
+
+    printf("%08x %3d %8lu %8lu %6lu %6lu %7u %6lu %8lu %6u %7.1f %7u %7u %6d\n",
+           st->ssrc, st->pt, st->packets, st->played, st->lost, st->late,
+           state.discard, st->empty, st->prefetching, state.jitter, avg,
+           p95, max, state.drift_ppm);
+  }
+}
+
+static void usage()
+{
+  printf("usage: jbpcap [-x speed] [-u udp_port] [-s ssrc] [-t ptime] [-k clock_rate]\n"
+         "              [-f frame_size] [-m max_count] [-p prefetch,min,max]\n"
+         "              [-a burst|timing|quantile] [-d none|static|progressive] file\n"
+         "  -x  replay speed, 1 for real time, 0 (default) as fast as possible\n"
+         "  -s  replay this ssrc (hex) only\n");
+}
+
+int main(int argc, char *argv[])
+{
+  capture_t cap;
+  const uint8_t *data, *payload;
+  uint64_t us, end;
+  char *frame;
+  int opt, len, linktype, i;
+  unsigned long packets = 0;
+
+  while ((opt = getopt(argc, argv, "x:u:s:t:k:f:m:p:a:d:h")) != -1) {
+    switch (opt) {
+    case 'x':
+      speed = atof(optarg);
+      break;
+    case 'u':
+      port = atoi(optarg);
+      break;
+    case 's':
+      only_ssrc = strtoul(optarg, NULL, 16);
+      ssrc_set = 1;
+      break;
+    case 't':
+      ptime = atoi(optarg);
+      break;
+    case 'k':
+      clock_rate = atoi(optarg);
+      break;
+    case 'f':
+      frame_size = atoi(optarg);
+      break;
+    case 'm':
+      max_count = atoi(optarg);
+      break;
+    case 'p':
+      if (sscanf(optarg, "%u,%u,%u", &prefetch, &min_prefetch, &max_prefetch) != 3) {
+        usage();
+        return 1;
+      }
+      break;
+    case 'a':
+      adapt = !strcmp(optarg, "timing") ? JB_ADAPT_TIMING :
+              !strcmp(optarg, "quantile") ? JB_ADAPT_QUANTILE : JB_ADAPT_BURST;
+      break;
+    case 'd':
+      discard = !strcmp(optarg, "none") ? JB_DISCARD_NONE :
+                !strcmp(optarg, "static") ? JB_DISCARD_STATIC : JB_DISCARD_PROGRESSIVE;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (optind != argc - 1 || ptime == 0 || clock_rate == 0 || frame_size == 0) {
+    usage();
+    return 1;
+  }
+
+  frame = malloc(frame_size);
+  if (frame == NULL || capture_open(&cap, argv[optind]) != 0) {
+    return 1;
+  }
+
+  while ((len = capture_next(&cap, &data, &us, &linktype)) > 0) {
+    if (!t0_set) {
+      t0 = us;
+      t0_set = 1;
+      clock_gettime(CLOCK_MONOTONIC, &real0);
+    }
+    //out of order capture timestamps
+    if (us < t0) {
+      us = t0;
+    }
+    len = udp_payload(data, len, linktype, &payload);
+    if (len > 0) {
+      put(payload, len, us, frame);
+      packets++;
+    }
+  }
+  if (len < 0) {
+    printf("%s: truncated capture\n", argv[optind]);
+  }
+
+  //play what is left
+  for (i = 0; i < nstream; i++) {
+    jb_state_t state;
+
+    end = streams[i]->last_put + (uint64_t)max_count * ptime * 1000;
+    while (streams[i]->next_get <= end && jbuf_get_state(streams[i]->jb, &state) == 0 &&
+           state.size > 0) {
+      get(streams[i], frame);
+    }
+  }
+
+  printf("%lu UDP packets\n", packets);
+  report();
+
+  for (i = 0; i < nstream; i++) {
+    jbuf_destroy(streams[i]->jb);
+    free(streams[i]);
+  }
+  capture_close(&cap);
+  free(frame);
+  return 0;
+}
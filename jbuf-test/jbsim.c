@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include "jtbuf.h"
+#include "jttrace.h"
+#include "impair.h"
+
+//replays jitter buffer traces recorded by c.c (see jttrace.h) on a virtual
+//clock, with the jitter buffer settings given on the command line, and
+//reports the latency and the loss of each trace and setting; the PUTs may
+//go through the impairment scenarios of a config file (see impair.h) on
+//their way to the jitter buffer
+
+#define MAX_CONFIGS 64
+
+#define MAX_SCENARIOS 64
+
+//arrival times kept to measure the latency of the frames played
+#define ARRIVAL_RING 4096
+
+//latency histogram range(ms)
+#define MAX_LATENCY 2000
+
+typedef struct
+{
+  unsigned prefetch;
+  unsigned min_prefetch;
+  unsigned max_prefetch;
+} config_t;
+
+typedef struct
+{
+  const char *name;
+  jbuf_trace_hdr_t hdr;
+  jbuf_trace_rec_t *recs;
+  unsigned count;
+} trace_t;
+
+typedef struct
+{
+  unsigned long played;
+  unsigned long lost;
+  unsigned long late; //puts refused, too late or duplicated
+  unsigned long discard;
+  unsigned long empty;
+  unsigned long prefetching;
+  double lat_avg;
+  unsigned lat_p95;
+  unsigned lat_max;
+} result_t;
+
+static int adapt = JB_ADAPT_BURST;
+static int discard = JB_DISCARD_PROGRESSIVE;
+static double quantile = 0;
+static unsigned max_count = 100;
+static int recorded_gets = 0;
+static int csv = 0;
+
+static int load(const char *path, trace_t *t)
+{
+  jbuf_trace_t *tr;
+  unsigned size = 0;
+  void *p;
+  int rc;
+
+  if (jbuf_trace_open(path, &t->hdr, &tr) != 0) {
+    printf("%s: not a trace\n", path);
+    return -1;
+  }
+
+  t->name = path;
+  t->recs = NULL;
+  t->count = 0;
+  while (1) {
+    if (t->count == size) {
+      size = size ? size * 2 : 4096;
+      p = realloc(t->recs, size * sizeof(jbuf_trace_rec_t));
+      if (p == NULL) {
+        printf("malloc error\n");
+        rc = -1;
+        break;
+      }
+      t->recs = p;
+    }
+    rc = jbuf_trace_read(tr, &t->recs[t->count]);
+    if (rc <= 0) {
+      break;
+    }
+    t->count++;
+  }
+
+  jbuf_trace_close(tr);
+  if (rc < 0) {
+    printf("%s: read error\n", path);
+    free(t->recs);
+    return -1;
+  }
+  return 0;
+}
+
+//a clean stream of 16 bit mono PCM at 8 kHz, one frame per ptime
+static int generate(unsigned seconds, trace_t *t)
+{
+  unsigned i;
+
+  t->name = "generated";
+  t->hdr.ptime = 20;
+  t->hdr.frame_size = 320;
+  t->hdr.clock_rate = 8000;
+  t->count = seconds * 1000 / t->hdr.ptime;
+  t->recs = calloc(t->count ? t->count : 1, sizeof(jbuf_trace_rec_t));
+  if (t->recs == NULL) {
+    printf("malloc error\n");
+    return -1;
+  }
+
+  for (i = 0; i < t->count; i++) {
+    t->recs[i].time = i * t->hdr.ptime;
+    t->recs[i].seq = i;
+    t->recs[i].ts = i * t->hdr.frame_size / 2;
+    t->recs[i].size = t->hdr.frame_size;
+    t->recs[i].op = JB_TRACE_PUT;
+  }
+  return 0;
+}
+
+static void put(jbuf_t *jb, const trace_t *t, char *frame, unsigned size,
+                int seq, uint32_t ts, uint32_t now, uint32_t *arrival,
+                int *arrival_seq, result_t *r)
+{
+  int dropped;
+
+  if (seq >= 0) {
+    arrival[seq % ARRIVAL_RING] = now;
+    arrival_seq[seq % ARRIVAL_RING] = seq;
+  }
+  jbuf_put_frame4(jb, frame, size < t->hdr.frame_size ? size : t->hdr.frame_size,
+                  0, seq, ts, now, &dropped);
+  if (dropped) {
+    r->late++;
+  }
+}
+
+static void get(jbuf_t *jb, uint32_t now, char *frame, uint32_t *arrival,
+                int *arrival_seq, unsigned *hist, result_t *r)
+{
+  size_t size = 0;
+  char type;
+  int seq = -1;
+  int32_t lat;
+
+  jbuf_get_frame3(jb, frame, &size, &type, NULL, NULL, &seq);
+  switch (type) {
+  case JB_NORMAL_FRAME:
+  case JB_ZERO_SILENT_FRAME:
+    r->played++;
+    if (seq >= 0 && arrival_seq[seq % ARRIVAL_RING] == seq) {
+      lat = (int32_t)(now - arrival[seq % ARRIVAL_RING]);
+      if (lat < 0) {
+        lat = 0;
+      }
+      if (lat >= MAX_LATENCY) {
+        lat = MAX_LATENCY - 1;
+      }
+      hist[lat]++;
+    }
+    break;
+  case JB_MISSING_FRAME:
+    r->lost++;
+    break;
+  case JB_ZERO_PREFETCH_FRAME:
+    r->prefetching++;
+    break;
+  default:
+    r->empty++;
+    break;
+  }
+}
+
+static int run(const trace_t *t, const config_t *c, const impair_cfg_t *icfg,
+               result_t *r)
+{
+  static uint32_t arrival[ARRIVAL_RING];
+  static int arrival_seq[ARRIVAL_RING];
+  static unsigned hist[MAX_LATENCY];
+  jbuf_t *jb;
+  jb_state_t state;
+  const jbuf_trace_rec_t *rec;
+  impair_t *im = NULL;
+  impair_pkt_t pkt;
+  char *frame;
+  double now = 0, end = 0, t_rec, t_dlv, t_get;
+  unsigned long n = 0;
+  unsigned i = 0;
+  int started = 0;
+
+  memset(r, 0, sizeof(*r));
+  memset(hist, 0, sizeof(hist));
+  memset(arrival_seq, 0xff, sizeof(arrival_seq));
+
+  frame = malloc(t->hdr.frame_size);
+  if (frame == NULL || jbuf_create(t->hdr.frame_size, t->hdr.ptime,
+                                   max_count, &jb) != 0) {
+    free(frame);
+    return -1;
+  }
+  if (icfg != NULL && (im = impair_new(icfg)) == NULL) {
+    jbuf_destroy(jb);
+    free(frame);
+    return -1;
+  }
+  jbuf_set_clock_rate(jb, t->hdr.clock_rate);
+  jbuf_set_adapt(jb, adapt);
+  jbuf_set_discard(jb, discard);
+  if (quantile > 0) {
+    jbuf_set_delay_quantile(jb, quantile);
+  }
+  jbuf_set_adaptive(jb, c->prefetch, c->min_prefetch, c->max_prefetch);
+
+  memset(frame, 0, t->hdr.frame_size);
+
+  //merge the records, the impaired deliveries and the playout clock, the
+  //times are in ms from the first record
+  while (1) {
+    t_rec = i < t->count ? (int32_t)(t->recs[i].time - t->recs[0].time) : INFINITY;
+    t_dlv = im != NULL && impair_next(im) >= 0 ? impair_next(im) : INFINITY;
+    //virtual playout clock, one GET per ptime from the first PUT
+    t_get = !recorded_gets && started ? now : INFINITY;
+    if (t_rec == INFINITY && t_dlv == INFINITY) {
+      break;
+    }
+
+    if (t_get <= t_rec && t_get <= t_dlv) {
+      get(jb, (uint32_t)now, frame, arrival, arrival_seq, hist, r);
+      now += t->hdr.ptime;
+      continue;
+    }
+
+    if (t_dlv < t_rec) {
+      impair_recv(im, t_dlv, &pkt);
+      put(jb, t, frame, pkt.size, pkt.seq, pkt.ts, (uint32_t)llround(t_dlv),
+          arrival, arrival_seq, r);
+      end = t_dlv;
+      continue;
+    }
+
+    rec = &t->recs[i++];
+    if (rec->op == JB_TRACE_PUT) {
+      if (!started) {
+        now = t_rec;
+        started = 1;
+      }
+      if (im != NULL) {
+        impair_send(im, frame, rec->size, rec->seq, rec->ts, t_rec);
+      } else {
+        put(jb, t, frame, rec->size, rec->seq, rec->ts, (uint32_t)t_rec,
+            arrival, arrival_seq, r);
+        end = t_rec;
+      }
+    } else if (rec->op == JB_TRACE_GET && recorded_gets) {
+      get(jb, (uint32_t)t_rec, frame, arrival, arrival_seq, hist, r);
+    }
+  }
+
+  //play what is left
+  if (!recorded_gets) {
+    end += max_count * t->hdr.ptime;
+    while (now <= end && jbuf_get_state(jb, &state) == 0 && state.size > 0) {
+      get(jb, (uint32_t)now, frame, arrival, arrival_seq, hist, r);
+      now += t->hdr.ptime;
+    }
+  }
+
+  if (im != NULL) {
+    impair_free(im);
+  }
+  jbuf_get_state(jb, &state);
+  r->discard = state.discard;
+
+  for (i = 0; i < MAX_LATENCY; i++) {
+    n += hist[i];
+    r->lat_avg += (double)i * hist[i];
+    if (hist[i]) {
+      r->lat_max = i;
+    }
+  }
+  if (n) {
+    r->lat_avg /= n;
+    for (i = 0, n = (n * 95 + 99) / 100; i < MAX_LATENCY; i++) {
+      if (hist[i] >= n) {
+        r->lat_p95 = i;
+        break;
+      }
+      n -= hist[i];
+    }
+  }
+
+  jbuf_destroy(jb);
+  free(frame);
+  return 0;
+}
+
+static void usage()
+{
+  printf("usage: jbsim [-a burst|timing|quantile] [-d none|static|progressive]\n"
+         "             [-q quantile] [-m max_count] [-r] [-c] [-i config]\n"
+         "             [-g seconds] [-p prefetch,min,max]... trace...\n"
+         "  -r  replay the recorded GETs instead of one GET per ptime\n"
+         "  -c  csv output\n"
+         "  -i  replay every trace under every scenario of the config file\n"
+         "  -g  replay a generated clean trace of that duration too\n"
+         "  -p  jitter buffer prefetch settings, repeat for a sweep\n");
+}
+
+static void report(const trace_t *t, const char *scenario, const config_t *c,
+                   const result_t *r)
+{
+  char p[32];
+
+  if (csv) {
+    printf("%s,%s,%u,%u,%u,%lu,%lu,%lu,%lu,%lu,%lu,%.1f,%u,%u\n", t->name,
+           scenario, c->prefetch, c->min_prefetch, c->max_prefetch,
+           r->played, r->lost, r->late, r->discard, r->empty, r->prefetching,
+           r->lat_avg, r->lat_p95, r->lat_max);
+    return;
+  }
+
+  snprintf(p, sizeof(p), "%u,%u,%u", c->prefetch, c->min_prefetch,
+           c->max_prefetch);
+  printf("%-24s %-12s %12s %8lu %6lu %6lu %7lu %6lu %7lu %8.1f %7u %7u\n",
+         t->name, scenario, p, r->played, r->lost, r->late, r->discard,
+         r->empty, r->prefetching, r->lat_avg, r->lat_p95, r->lat_max);
+}
+
+//replay a trace under every scenario and every config
+static unsigned long replay(const trace_t *t, const impair_cfg_t *scenarios,
+                            int nscenario, const config_t *configs,
+                            unsigned nconfig)
+{
+  const impair_cfg_t *icfg;
+  unsigned long ops = 0;
+  result_t r;
+  unsigned j;
+  int k;
+
+  for (k = 0; k < (nscenario > 0 ? nscenario : 1); k++) {
+    icfg = nscenario > 0 ? &scenarios[k] : NULL;
+    for (j = 0; j < nconfig; j++) {
+      if (run(t, &configs[j], icfg, &r) != 0) {
+        printf("%s: jbuf_create error\n", t->name);
+        return ops;
+      }
+      ops += t->count;
+      report(t, icfg ? icfg->name : "-", &configs[j], &r);
+    }
+  }
+  return ops;
+}
+
+int main(int argc, char *argv[])
+{
+  static impair_cfg_t scenarios[MAX_SCENARIOS];
+  config_t configs[MAX_CONFIGS];
+  unsigned nconfig = 0, seconds = 0;
+  int nscenario = 0;
+  trace_t t;
+  struct timespec t0, t1;
+  unsigned long ops = 0;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "a:d:q:m:p:i:g:rch")) != -1) {
+    switch (opt) {
+    case 'a':
+      if (!strcmp(optarg, "burst")) {
+        adapt = JB_ADAPT_BURST;
+      } else if (!strcmp(optarg, "timing")) {
+        adapt = JB_ADAPT_TIMING;
+      } else if (!strcmp(optarg, "quantile")) {
+        adapt = JB_ADAPT_QUANTILE;
+      } else {
+        usage();
+        return 1;
+      }
+      break;
+    case 'd':
+      if (!strcmp(optarg, "none")) {
+        discard = JB_DISCARD_NONE;
+      } else if (!strcmp(optarg, "static")) {
+        discard = JB_DISCARD_STATIC;
+      } else if (!strcmp(optarg, "progressive")) {
+        discard = JB_DISCARD_PROGRESSIVE;
+      } else {
+        usage();
+        return 1;
+      }
+      break;
+    case 'q':
+      quantile = atof(optarg);
+      break;
+    case 'm':
+      max_count = atoi(optarg);
+      break;
+    case 'p':
+      if (nconfig == MAX_CONFIGS ||
+          sscanf(optarg, "%u,%u,%u", &configs[nconfig].prefetch,
+                 &configs[nconfig].min_prefetch,
+                 &configs[nconfig].max_prefetch) != 3) {
+        usage();
+        return 1;
+      }
+      nconfig++;
+      break;
+    case 'i':
+      nscenario = impair_load(optarg, scenarios, MAX_SCENARIOS);
+      if (nscenario <= 0) {
+        printf("%s: no scenario\n", optarg);
+        return 1;
+      }
+      break;
+    case 'g':
+      seconds = atoi(optarg);
+      break;
+    case 'r':
+      recorded_gets = 1;
+      break;
+    case 'c':
+      csv = 1;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (optind >= argc && seconds == 0) {
+    usage();
+    return 1;
+  }
+  if (nconfig == 0) {
+    configs[0].prefetch = 15;
+    configs[0].min_prefetch = 0;
+    configs[0].max_prefetch = max_count * 4 / 5;
+    nconfig = 1;
+  }
+
+  if (csv) {
+    printf("trace,scenario,prefetch,min,max,played,lost,late,discard,empty,"
+           "prefetching,lat_avg,lat_p95,lat_max\n");
+  } else {
+    printf("%-24s %-12s %12s %8s %6s %6s %7s %6s %7s %8s %7s %7s\n", "trace",
+           "scenario", "prefetch", "played", "lost", "late", "discard",
+           "empty", "prefetch", "lat_avg", "lat_p95", "lat_max");
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (seconds > 0 && generate(seconds, &t) == 0) {
+    ops += replay(&t, scenarios, nscenario, configs, nconfig);
+    free(t.recs);
+  }
+  for (i = optind; i < argc; i++) {
+    if (load(argv[i], &t) != 0) {
+      continue;
+    }
+    ops += replay(&t, scenarios, nscenario, configs, nconfig);
+    free(t.recs);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if (!csv) {
+    printf("%lu records replayed in %.3f s\n", ops,
+           (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+  }
+  return 0;
+}
@@ -5,6 +5,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "jtbuf.h"
 
 #define MIN(a,b) (((a) < (b)) ? (a):(b))
@@ -18,6 +24,11 @@
  */
 #define MAX_BURST_MSEC 1000
 
+/* Duration frames are still stored after the last frame above the voice
+ * activity threshold, so the fading end of a talkspurt isn't cut, in ms.
+ */
+#define JBUF_VAD_HANGOVER 200
+
 /* Number of OP switches to be performed in JB_STATUS_INITIALIZING, before
  * JB can switch its states to JB_STATUS_PROCESSING.
  */
@@ -40,21 +51,99 @@
 
 #define JBUF_PRO_DISC_T2                 10000
 
+/* Number of frames a minimum transit time is kept for in the timing based
+ * adaptive algorithm. The minimum is taken over the last two windows, so
+ * it follows slow changes of the path delay (and clock drift).
+ */
+#define JBUF_TIMING_MIN_WINDOW           256
+
+/* Number of mean deviations of the relative delay added to the mean
+ * relative delay to get the target latency in timing based adaptation.
+ */
+#define JBUF_TIMING_DEV_MULT             4
+
+/* Number of frames a delay quantile estimator runs before it is restarted.
+ * Two estimators run half a window apart, so a delay spike stops affecting
+ * the quantile after one to one and a half window.
+ */
+#define JBUF_QUANTILE_WINDOW             500
+
+/* Number of frames the clock drift regression mostly remembers (the
+ * weight of older frames decays by 1/e every window), and number of
+ * frames before the estimate is used.
+ */
+#define JBUF_DRIFT_WINDOW                3000
+#define JBUF_DRIFT_MIN_FRAMES            500
+
+/* Timestamp and arrival time steps (in ms) apart by more than this are a
+ * stream restart, the drift regression starts again.
+ */
+#define JBUF_DRIFT_MAX_STEP              2000
+
+/* Simple running statistic: count, mean, min, max and variance (Welford). */
+typedef struct jb_math_stat
+{
+    unsigned     n;     /**< number of samples    */
+    int          min;   /**< minimum value    */
+    int          max;   /**< maximum value    */
+    double       mean;  /**< mean value    */
+    double       m2;    /**< sum of squared deviations    */
+
+} jb_math_stat;
+
+/* P-square streaming quantile estimator (Jain & Chlamtac, 1985), keeps
+ * five markers instead of the samples.
+ */
+typedef struct jb_p2_quantile
+{
+    double       p;     /**< quantile being estimated    */
+    unsigned     count; /**< number of samples    */
+    double       q[5];  /**< marker heights    */
+    double       n[5];  /**< marker positions    */
+    double       np[5]; /**< desired marker positions    */
+    double       dn[5]; /**< desired position increments    */
+
+} jb_p2_quantile;
+
+#define JB_CACHE_LINE 64
+
+/* Metadata of a framelist slot. All of it is packed in 16 bytes, so four
+ * slots share a cache line and PUT/GET of a slot touches one line for the
+ * metadata, plus the frame content.
+ */
+typedef struct jb_slot
+{
+    int          type;      /**< frame type    */
+    uint32_t     len;       /**< frame length    */
+    uint32_t     bit_info;  /**< frame bit info    */
+    uint32_t     ts;        /**< frame timestamp    */
+
+} jb_slot;
+
 /* Struct of JB internal buffer, represented in a circular buffer containing
  * frame content, frame type, frame length, and frame bit info.
+ *
+ * The slot metadata is only valid when the slot bit is set in the
+ * occupied bitmap, slots are never cleared. Bits are only set between
+ * the head and head + size, so removing frames or resetting the buffer
+ * just clears the bitmap words of that range, and discarded slots are
+ * counted and skipped a word (64 slots) at a time.
  */
 typedef struct jb_framelist_t
 {
     /* Settings */
     unsigned     frame_size;  /**< maximum size of frame    */
     unsigned     max_count;   /**< maximum number of frames    */
+    unsigned     mask;        /**< slot count (power of two, at least
+                                   max_count) - 1, to wrap indexes   */
 
     /* Buffers */
+    jb_slot      *slot;       /**< slot metadata array, cache line
+                                   aligned    */
+    uint64_t     *occupied;   /**< bitmap of the slots holding a frame
+                                   (discarded ones included)    */
+    uint64_t     *discarded;  /**< bitmap of the discarded slots    */
     char         *content;    /**< frame content array    */
-    int          *frame_type; /**< frame type array    */
-    size_t       *content_len; /**< frame length array    */
-    uint32_t     *bit_info; /**< frame bit info array    */
-    uint32_t     *ts;  /**< timestamp array    */
 
     /* States */
     unsigned     head; /**< index of head, pointed frame
@@ -65,6 +154,9 @@ typedef struct jb_framelist_t
                                    frames.			    */
     int          origin; /**< original index of flist_head   */
 
+    void         *mem_owned; /**< memory block of the buffers, when
+                                  allocated by the framelist    */
+
 } jb_framelist_t;
 
 struct jbuf;
@@ -122,10 +214,111 @@ typedef struct jbuf
     unsigned    jb_discard_dist;/**< Distance from jb_discard_ref
                                    to perform discard (in frm)    */
 
+    /* Timing based adaptation (JB_ADAPT_TIMING/QUANTILE) */
+    jb_adapt_algo_t jb_adapt_algo;/**< Adaptive algorithm    */
+    unsigned    jb_clock_rate;/**< RTP timestamp clock rate, in Hz    */
+    int    jb_transit_cnt;/**< no. of frames with arrival time    */
+    int32_t    jb_last_transit;/**< transit time of the last frame,
+                                 in timestamp units    */
+    int32_t    jb_min_transit;/**< minimum transit time in the
+                                current window    */
+    int32_t    jb_prev_min_transit;/**< minimum transit time in the
+                                     previous window    */
+    double    jb_jitter;/**< RFC 3550 interarrival jitter,
+                          in timestamp units    */
+    double    jb_rel_delay;/**< average delay relative to the
+                             minimum transit, in ms    */
+    double    jb_rel_delay_dev;/**< mean deviation of relative
+                                 delay, in ms    */
+    double    jb_quantile;/**< delay quantile to cover    */
+    jb_p2_quantile    jb_delay_q[2];/**< relative delay quantile
+                                      estimators, in ms    */
+
+    /* Clock drift estimation, regression of the arrival time against
+     * the timestamp, both in ms from the first frame
+     */
+    int    jb_drift_cnt;/**< no. of frames in the regression    */
+    uint32_t    jb_drift_last_ts;/**< timestamp of the last frame    */
+    uint32_t    jb_drift_last_arrival;/**< arrival of the last frame */
+    double    jb_drift_x;/**< timestamp of the last frame, in ms    */
+    double    jb_drift_y;/**< arrival of the last frame, in ms    */
+    double    jb_drift_w;/**< sum of the weights    */
+    double    jb_drift_mx;/**< weighted mean of the timestamps    */
+    double    jb_drift_my;/**< weighted mean of the arrivals    */
+    double    jb_drift_sxx;/**< weighted sum of squared timestamp
+                              deviations    */
+    double    jb_drift_sxy;/**< weighted sum of the products of the
+                              deviations    */
+    double    jb_drift_ppm;/**< estimated drift, in ppm    */
+
+    /* Readiness notification */
+    int    jb_evt_fd;/**< eventfd signalled when frames become
+                       available, -1 if not created    */
+    int    jb_evt_armed;/**< flag if a GET returned a zero frame
+                          since the last notification    */
+
+    /* Gap detection */
+    jbuf_gap_cb    jb_gap_cb;/**< callback of new gaps, or NULL    */
+    void    *jb_gap_user_data;/**< user data of the gap callback    */
+    int    jb_gap_first;/**< first seq of the gap found by the
+                          last PUT    */
+    unsigned    jb_gap_cnt;/**< size of the gap found by the last
+                              PUT, 0 if none    */
+
+    /* Voice activity detection */
+    unsigned    jb_vad_level;/**< RMS level below which frames are
+                                silent, 0 if disabled    */
+    unsigned    jb_vad_hangover;/**< no. of frames still stored
+                                   whatever their level    */
+
+    /* Pool */
+    struct jbuf_pool    *jb_pool;/**< pool the buffer belongs to, or
+                                   NULL if created by jbuf_create()   */
+    struct jbuf    *jb_pool_next;/**< next free buffer in the pool    */
+    int    jb_pool_used;/**< flag if the buffer is out of the pool    */
+
+    /* Statistics */
+    jb_math_stat    jb_delay;/**< delay statistic, in ms    */
+    jb_math_stat    jb_burst;/**< burst level statistic, in frames   */
+    unsigned    jb_lost;/**< no. of missing frames returned    */
+    unsigned    jb_discard;/**< no. of discarded frames    */
+    unsigned    jb_empty;/**< no. of empty GETs    */
+    unsigned    jb_silent;/**< no. of silent frames put    */
+    unsigned    jb_recovered;/**< no. of missing frames recovered    */
+
 } jbuf_t;
 
+/* Pool of jitter buffers, preallocated in a single arena. */
+struct jbuf_pool
+{
+    pthread_mutex_t lock;
+
+    /* Settings (consts) */
+    unsigned    frame_size;/**< frame size of the buffers    */
+    unsigned    ptime;/**< frame duration of the buffers    */
+    unsigned    max_count;/**< capacity of the buffers    */
+    unsigned    count;/**< number of buffers    */
+
+    /* Arena */
+    void    *arena;/**< the arena    */
+    size_t    arena_size;/**< size of the arena    */
+    size_t    stride;/**< size of a buffer in the arena    */
+
+    /* States */
+    jbuf_t    *free_list;/**< free buffers    */
+    unsigned    free_cnt;/**< number of free buffers    */
+};
+
 static void jbuf_discard_static(jbuf_t *jb);
 static void jbuf_discard_progressive(jbuf_t *jb);
+static void jbuf_put_frame_locked(jbuf_t *jb,
+                                  const void *frame,
+                                  size_t frame_size,
+                                  uint32_t bit_info,
+                                  int frame_seq,
+                                  uint32_t ts,
+                                  unsigned frame_type,
+                                  int *discarded);
 
 
 #define JB_STATUS_INITIALIZING 0
@@ -144,28 +337,315 @@ static void jbuf_discard_progressive(jbuf_t *jb);
 #define JB_DISCARDED_FRAME 1024
 
 
+static void jb_math_stat_init(jb_math_stat *stat)
+{
+    bzero(stat, sizeof(jb_math_stat));
+}
+
+static void jb_math_stat_update(jb_math_stat *stat, int val)
+{
+    double delta;
+
+    if (stat->n == 0 || val < stat->min)
+        stat->min = val;
+    if (stat->n == 0 || val > stat->max)
+        stat->max = val;
+
+    stat->n++;
+    delta = val - stat->mean;
+    stat->mean += delta / stat->n;
+    stat->m2 += delta * (val - stat->mean);
+}
+
+static unsigned jb_math_stat_dev(const jb_math_stat *stat)
+{
+    if (stat->n < 2)
+        return 0;
+    return (unsigned)(sqrt(stat->m2 / stat->n) + 0.5);
+}
+
+
+static void jb_p2_init(jb_p2_quantile *est, double p)
+{
+    bzero(est, sizeof(jb_p2_quantile));
+    est->p = p;
+    est->dn[1] = p / 2;
+    est->dn[2] = p;
+    est->dn[3] = (1 + p) / 2;
+    est->dn[4] = 1;
+}
+
+static void jb_p2_update(jb_p2_quantile *est, double x)
+{
+    int i, k;
+
+    /* Collect the first five samples, sorted */
+    if (est->count < 5) {
+        for (i = est->count; i > 0 && est->q[i-1] > x; --i)
+            est->q[i] = est->q[i-1];
+        est->q[i] = x;
+
+        if (++est->count == 5) {
+            for (i = 0; i < 5; ++i) {
+                est->n[i] = i;
+                est->np[i] = 4 * est->dn[i];
+            }
+        }
+        return;
+    }
+    est->count++;
+
+    /* Find the cell of the sample, adjusting the extreme markers */
+    if (x < est->q[0]) {
+        est->q[0] = x;
+        k = 0;
+    } else if (x >= est->q[4]) {
+        est->q[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; k < 3 && x >= est->q[k+1]; ++k)
+            ;
+    }
+
+    for (i = k + 1; i < 5; ++i)
+        est->n[i]++;
+    for (i = 0; i < 5; ++i)
+        est->np[i] += est->dn[i];
+
+    /* Adjust the middle markers if they are off their desired position */
+    for (i = 1; i < 4; ++i) {
+        double d = est->np[i] - est->n[i];
+
+        if ((d >= 1 && est->n[i+1] - est->n[i] > 1) ||
+            (d <= -1 && est->n[i-1] - est->n[i] < -1))
+        {
+            int s = (d >= 0) ? 1 : -1;
+            double q;
+
+            /* Piecewise parabolic prediction */
+            q = est->q[i] + s / (est->n[i+1] - est->n[i-1]) *
+                ((est->n[i] - est->n[i-1] + s) *
+                 (est->q[i+1] - est->q[i]) / (est->n[i+1] - est->n[i]) +
+                 (est->n[i+1] - est->n[i] - s) *
+                 (est->q[i] - est->q[i-1]) / (est->n[i] - est->n[i-1]));
+
+            /* Fall back to linear prediction if it breaks the order */
+            if (q <= est->q[i-1] || q >= est->q[i+1])
+                q = est->q[i] + s * (est->q[i+s] - est->q[i]) /
+                    (est->n[i+s] - est->n[i]);
+
+            est->q[i] = q;
+            est->n[i] += s;
+        }
+    }
+}
+
+static double jb_p2_value(const jb_p2_quantile *est)
+{
+    if (est->count == 0)
+        return 0;
+
+    /* Not enough samples for the markers, pick from the sorted samples */
+    if (est->count < 5)
+        return est->q[(unsigned)(est->p * (est->count - 1) + 0.5)];
+
+    return est->q[2];
+}
+
+
 static int jb_framelist_reset(jb_framelist_t *framelist);
 static unsigned jb_framelist_remove_head(jb_framelist_t *framelist,
                                          unsigned count);
 
+/* Number of slots of a framelist of 'max_count' frames. */
+static unsigned jb_framelist_slot_count(unsigned max_count)
+{
+    unsigned count = 1;
+
+    while (count < max_count)
+        count <<= 1;
+
+    return count;
+}
+
+/* Number of 64 bit words of a slot bitmap. */
+static unsigned jb_framelist_map_words(unsigned count)
+{
+    return (count + 63) / 64;
+}
+
+/* Size of the slot metadata and bitmaps, the frame content follows. */
+static size_t jb_framelist_meta_size(unsigned count)
+{
+    size_t meta = count * sizeof(jb_slot) +
+                  2 * jb_framelist_map_words(count) * sizeof(uint64_t);
+
+    return (meta + JB_CACHE_LINE - 1) & ~(size_t)(JB_CACHE_LINE - 1);
+}
+
+/* Size of the memory block holding the framelist buffers. */
+static size_t jb_framelist_mem_size(unsigned frame_size,
+                                    unsigned max_count)
+{
+    unsigned count = jb_framelist_slot_count(max_count);
+
+    return jb_framelist_meta_size(count) + (size_t)count * frame_size;
+}
+
+
+/* Mask of 'n' (1 to 64) bits starting at bit 'bit' of a bitmap word. */
+static uint64_t jb_map_mask(unsigned bit, unsigned n)
+{
+    uint64_t mask = (n < 64) ? (((uint64_t)1 << n) - 1) : ~(uint64_t)0;
+
+    return mask << bit;
+}
+
+/* Count the bits set in 'n' bits of the bitmap from 'start', the range
+ * must not wrap.
+ */
+static unsigned jb_map_count(const uint64_t *map, unsigned start, unsigned n)
+{
+    unsigned cnt = 0;
+
+    while (n) {
+        unsigned bit = start & 63;
+        unsigned len = MIN(64 - bit, n);
+
+        cnt += __builtin_popcountll(map[start >> 6] & jb_map_mask(bit, len));
+        start += len;
+        n -= len;
+    }
+
+    return cnt;
+}
+
+/* Clear 'n' bits of the bitmap from 'start', the range must not wrap. */
+static void jb_map_clear(uint64_t *map, unsigned start, unsigned n)
+{
+    while (n) {
+        unsigned bit = start & 63;
+        unsigned len = MIN(64 - bit, n);
+
+        map[start >> 6] &= ~jb_map_mask(bit, len);
+        start += len;
+        n -= len;
+    }
+}
+
+/* Clear 'count' slots from the head and return how many of them were
+ * discarded.
+ */
+static unsigned jb_framelist_clear_head(jb_framelist_t *framelist,
+                                        unsigned count)
+{
+    unsigned slots = framelist->mask + 1;
+    unsigned step1 = MIN(count, slots - framelist->head);
+    unsigned step2 = count - step1;
+    unsigned discarded = 0;
+
+    jb_map_clear(framelist->occupied, framelist->head, step1);
+    jb_map_clear(framelist->occupied, 0, step2);
+
+    if (framelist->discarded_num) {
+        discarded = jb_map_count(framelist->discarded, framelist->head,
+                                 step1) +
+                    jb_map_count(framelist->discarded, 0, step2);
+        jb_map_clear(framelist->discarded, framelist->head, step1);
+        jb_map_clear(framelist->discarded, 0, step2);
+    }
+
+    return discarded;
+}
+
+/* Number of discarded slots in a row from the head. */
+static unsigned jb_framelist_discarded_run(const jb_framelist_t *framelist)
+{
+    unsigned pos = framelist->head;
+    unsigned run = 0;
+
+    while (run < framelist->size) {
+        unsigned bit = pos & 63;
+        uint64_t word = ~framelist->discarded[pos >> 6] >> bit;
+        unsigned len = MIN(64 - bit, framelist->mask + 1 - pos);
+
+        if (word & jb_map_mask(0, len))
+            return MIN(run + __builtin_ctzll(word), framelist->size);
+
+        run += len;
+        pos = (pos + len) & framelist->mask;
+    }
+
+    return framelist->size;
+}
+
+/* Slot position of the 'idx'-th not discarded frame from the head, the
+ * buffer must hold more than 'idx' of them.
+ */
+static unsigned jb_framelist_find(const jb_framelist_t *framelist,
+                                  unsigned idx)
+{
+    unsigned pos = framelist->head;
+
+    while (1) {
+        unsigned bit = pos & 63;
+        unsigned len = MIN(64 - bit, framelist->mask + 1 - pos);
+        uint64_t word = (~framelist->discarded[pos >> 6] >> bit) &
+                        jb_map_mask(0, len);
+        unsigned cnt = __builtin_popcountll(word);
+
+        if (idx < cnt) {
+            while (idx--)
+                word &= word - 1;
+            return pos + __builtin_ctzll(word);
+        }
+
+        idx -= cnt;
+        pos = (pos + len) & framelist->mask;
+    }
+}
+
+/* Check whether the slot holds a frame. */
+static int jb_framelist_occupied(const jb_framelist_t *framelist,
+                                 unsigned pos)
+{
+    return (framelist->occupied[pos >> 6] >> (pos & 63)) & 1;
+}
+
+/* Initialize the framelist, its buffers are carved out of 'mem' (which
+ * must be cache line aligned and hold jb_framelist_mem_size() bytes), or
+ * out of a newly allocated block when 'mem' is NULL.
+ */
 static int jb_framelist_init(jb_framelist_t *framelist,
                              unsigned frame_size,
-                             unsigned max_count)
+                             unsigned max_count,
+                             void *mem)
 {
+    unsigned count = jb_framelist_slot_count(max_count);
+    unsigned words = jb_framelist_map_words(count);
+
     bzero(framelist, sizeof(jb_framelist_t));
 
+    if (!mem) {
+        if (posix_memalign(&mem, JB_CACHE_LINE,
+                           jb_framelist_mem_size(frame_size, max_count)))
+        {
+            return -1;
+        }
+        framelist->mem_owned = mem;
+    }
+
     framelist->frame_size   = frame_size;
     framelist->max_count    = max_count;
-    framelist->content    = (char*)malloc(framelist->frame_size*
-                                          framelist->max_count);
-    framelist->frame_type   = (int*)malloc(sizeof(framelist->frame_type[0])*
-                                            framelist->max_count);
-    framelist->content_len  = (size_t*)malloc(sizeof(framelist->content_len[0])*
-                                            framelist->max_count);
-    framelist->bit_info    = (uint32_t*)malloc(sizeof(framelist->bit_info[0])*
-                                           framelist->max_count);
-    framelist->ts    = (uint32_t*)malloc(sizeof(framelist->ts[0])*
-                                     framelist->max_count);
+    framelist->mask         = count - 1;
+
+    /* Metadata first, the content starts on its own cache line */
+    framelist->slot         = (jb_slot*)mem;
+    framelist->occupied     = (uint64_t*)(framelist->slot + count);
+    framelist->discarded    = framelist->occupied + words;
+    framelist->content      = (char*)mem + jb_framelist_meta_size(count);
+
+    bzero(framelist->occupied, 2 * words * sizeof(uint64_t));
 
     return jb_framelist_reset(framelist);
 
@@ -173,20 +653,21 @@ static int jb_framelist_init(jb_framelist_t *framelist,
 
 static int jb_framelist_destroy(jb_framelist_t *framelist)
 {
+    free(framelist->mem_owned);
+    framelist->mem_owned = NULL;
     return 0;
 }
 
 static int jb_framelist_reset(jb_framelist_t *framelist)
 {
+    /* Only the bits of the current frames may be set */
+    jb_framelist_clear_head(framelist, framelist->size);
+
     framelist->head = 0;
     framelist->origin = INVALID_OFFSET;
     framelist->size = 0;
     framelist->discarded_num = 0;
 
-    memset(framelist->frame_type, JB_MISSING_FRAME, sizeof(framelist->frame_type[0]) * framelist->max_count);
-
-    bzero(framelist->content_len, sizeof(framelist->content_len[0]) * framelist->max_count);
-
     return 0;
 }
 
@@ -217,19 +698,41 @@ static int jb_framelist_get(jb_framelist_t *framelist,
 {
     if (framelist->size) {
         int prev_discarded = 0;
+        unsigned discarded;
+        int occupied;
+
+        jb_slot *slot;
 
         /* Skip discarded frames */
-        while (framelist->frame_type[framelist->head] ==
-               JB_DISCARDED_FRAME)
-        {
-            jb_framelist_remove_head(framelist, 1);
+        discarded = framelist->discarded_num ?
+                    jb_framelist_discarded_run(framelist) : 0;
+        if (discarded) {
+            jb_framelist_remove_head(framelist, discarded);
             prev_discarded = 1;
-            // printf("discarded\n");
         }
 
         /* Return the head frame if any */
         if (framelist->size) {
-            if (prev_discarded) {
+            slot = &framelist->slot[framelist->head];
+            occupied = jb_framelist_occupied(framelist, framelist->head);
+            if (!occupied) {
+                /* Missing frame, the slot holds stale metadata */
+                memcpy(frame,
+                       framelist->content + framelist->head * framelist->frame_size,
+                       framelist->frame_size);
+                *p_type = JB_MISSING_FRAME;
+                if (size)
+                    *size = 0;
+                if (bit_info)
+                    *bit_info = 0;
+            } else if (slot->type == JB_ZERO_SILENT_FRAME) {
+                /* Silent frame, only the metadata was stored */
+                *p_type = JB_ZERO_SILENT_FRAME;
+                if (size)
+                    *size = 0;
+                if (bit_info)
+                    *bit_info = slot->bit_info;
+            } else if (prev_discarded) {
                 /*  when previous frame(s) was discarded, return
                  * 'missing' frame to trigger PLC to get smoother signal.
                  */
@@ -242,27 +745,25 @@ static int jb_framelist_get(jb_framelist_t *framelist,
                 memcpy(frame,
                        framelist->content + framelist->head * framelist->frame_size,
                        framelist->frame_size);
-                *p_type = (jb_frame_type_t)framelist->frame_type[framelist->head];
+                *p_type = (jb_frame_type_t)slot->type;
                 if (size)
-                    *size   = framelist->content_len[framelist->head];
+                    *size   = slot->len;
                 if (bit_info)
-                    *bit_info = framelist->bit_info[framelist->head];
+                    *bit_info = slot->bit_info;
             }
             if (ts)
-                *ts = framelist->ts[framelist->head];
+                *ts = occupied ? slot->ts : 0;
             if (seq)
                 *seq = framelist->origin;
 
             //bzero(framelist->content +
             // framelist->head * framelist->frame_size,
             // framelist->frame_size);
-            framelist->frame_type[framelist->head] = JB_MISSING_FRAME;
-            framelist->content_len[framelist->head] = 0;
-            framelist->bit_info[framelist->head] = 0;
-            framelist->ts[framelist->head] = 0;
+            framelist->occupied[framelist->head >> 6] &=
+                ~((uint64_t)1 << (framelist->head & 63));
 
             framelist->origin++;
-            framelist->head = (framelist->head + 1) % framelist->max_count;
+            framelist->head = (framelist->head + 1) & framelist->mask;
             framelist->size--;
 
             return 1;
@@ -285,36 +786,29 @@ static int jb_framelist_peek(jb_framelist_t *framelist,
                              uint32_t *ts,
                              int *seq)
 {
-    unsigned pos, idx;
+    unsigned pos;
+    jb_slot empty = { JB_MISSING_FRAME, 0, 0, 0 };
+    const jb_slot *slot;
 
     if (offset >= jb_framelist_eff_size(framelist))
         return 0;
 
-    pos = framelist->head;
-    idx = offset;
-
     /* Find actual peek position, note there may be discarded frames */
-    while (1) {
-        if (framelist->frame_type[pos] != JB_DISCARDED_FRAME) {
-            if (idx == 0)
-                break;
-            else
-                --idx;
-        }
-        pos = (pos + 1) % framelist->max_count;
-    }
+    pos = jb_framelist_find(framelist, offset);
+    slot = jb_framelist_occupied(framelist, pos) ? &framelist->slot[pos] :
+                                                   &empty;
 
     /* Return the frame pointer */
     if (frame)
         *frame = framelist->content + pos*framelist->frame_size;
     if (type)
-        *type = (jb_frame_type_t)framelist->frame_type[pos];
+        *type = (jb_frame_type_t)slot->type;
     if (size)
-        *size = framelist->content_len[pos];
+        *size = slot->len;
     if (bit_info)
-        *bit_info = framelist->bit_info[pos];
+        *bit_info = slot->bit_info;
     if (ts)
-        *ts = framelist->ts[pos];
+        *ts = slot->ts;
     if (seq)
         *seq = framelist->origin + offset;
 
@@ -330,54 +824,14 @@ static unsigned jb_framelist_remove_head(jb_framelist_t *framelist,
         count = framelist->size;
 
     if (count) {
-        /* may be done in two steps if overlapping */
-        unsigned step1,step2;
-        unsigned tmp = framelist->head+count;
-        unsigned i;
-
-        if (tmp > framelist->max_count) {
-            step1 = framelist->max_count - framelist->head;
-            step2 = count-step1;
-        } else {
-            step1 = count;
-            step2 = 0;
-        }
+        unsigned discarded = jb_framelist_clear_head(framelist, count);
 
-        for (i = framelist->head; i < (framelist->head + step1); ++i) {
-            if (framelist->frame_type[i] == JB_DISCARDED_FRAME) {
-                assert(framelist->discarded_num > 0);
-                framelist->discarded_num--;
-            }
-        }
-
-        //bzero(framelist->content +
-        //    framelist->head * framelist->frame_size,
-        //          step1*framelist->frame_size);
-        memset(framelist->frame_type+framelist->head,
-               JB_MISSING_FRAME,
-               step1*sizeof(framelist->frame_type[0]));
-        bzero(framelist->content_len+framelist->head,
-              step1*sizeof(framelist->content_len[0]));
-
-        if (step2) {
-            for (i = 0; i < step2; ++i) {
-                if (framelist->frame_type[i] == JB_DISCARDED_FRAME) {
-                    assert(framelist->discarded_num > 0);
-                    framelist->discarded_num--;
-                }
-            }
-            //bzero( framelist->content,
-            //      step2*framelist->frame_size);
-            memset(framelist->frame_type,
-                      JB_MISSING_FRAME,
-                      step2*sizeof(framelist->frame_type[0]));
-            bzero (framelist->content_len,
-                      step2*sizeof(framelist->content_len[0]));
-        }
+        assert(framelist->discarded_num >= discarded);
+        framelist->discarded_num -= discarded;
 
         /* update states */
         framelist->origin += count;
-        framelist->head = (framelist->head + count) % framelist->max_count;
+        framelist->head = (framelist->head + count) & framelist->mask;
         framelist->size -= count;
     }
 
@@ -395,6 +849,7 @@ static int jb_framelist_put_at(jb_framelist_t *framelist,
 {
     int distance;
     unsigned pos;
+    jb_slot *slot;
     enum { MAX_MISORDER = 100 };
     enum { MAX_DROPOUT = 3000 };
 
@@ -435,17 +890,19 @@ static int jb_framelist_put_at(jb_framelist_t *framelist,
     }
 
     /* get the slot position */
-    pos = (framelist->head + distance) % framelist->max_count;
+    pos = (framelist->head + distance) & framelist->mask;
+    slot = &framelist->slot[pos];
 
     /* if the slot is occupied, it must be duplicated frame, ignore it. */
-    if (framelist->frame_type[pos] != JB_MISSING_FRAME)
+    if (jb_framelist_occupied(framelist, pos))
         return -1;
 
     /* put the frame into the slot */
-    framelist->frame_type[pos] = frame_type;
-    framelist->content_len[pos] = frame_size;
-    framelist->bit_info[pos] = bit_info;
-    framelist->ts[pos] = ts;
+    slot->type = frame_type;
+    slot->len = frame_size;
+    slot->bit_info = bit_info;
+    slot->ts = ts;
+    framelist->occupied[pos >> 6] |= (uint64_t)1 << (pos & 63);
 
     /* update framelist size */
     if (framelist->origin + (int)framelist->size <= index)
@@ -472,11 +929,15 @@ static int jb_framelist_discard(jb_framelist_t *framelist,
         return -1;
 
     /* Get the slot position */
-    pos = (framelist->head + (index - framelist->origin)) %
-          framelist->max_count;
+    pos = (framelist->head + (index - framelist->origin)) &
+          framelist->mask;
 
     /* Discard the frame */
-    framelist->frame_type[pos] = JB_DISCARDED_FRAME;
+    if (framelist->discarded[pos >> 6] & ((uint64_t)1 << (pos & 63)))
+        return 0;
+    framelist->slot[pos].type = JB_DISCARDED_FRAME;
+    framelist->occupied[pos >> 6] |= (uint64_t)1 << (pos & 63);
+    framelist->discarded[pos >> 6] |= (uint64_t)1 << (pos & 63);
     framelist->discarded_num++;
 
     // printf("discard frame\n");
@@ -494,6 +955,36 @@ enum jb_op
 
 
 
+/* Set the settings of a new (or recycled) jitter buffer to defaults. */
+static void jbuf_set_defaults(jbuf_t *jb,
+                              unsigned frame_size,
+                              unsigned ptime,
+                              unsigned max_count)
+{
+    jb->jb_frame_size = frame_size;
+    jb->jb_frame_ptime = ptime;
+    jb->jb_prefetch = MIN(JB_DEFAULT_INIT_DELAY, max_count*4/5);
+    jb->jb_min_prefetch  = 0;
+    jb->jb_max_prefetch  = max_count*4/5;
+    jb->jb_max_count = max_count;
+    jb->jb_min_shrink_gap = JBUF_DISC_MIN_GAP / ptime;
+    jb->jb_max_burst = MAX(MAX_BURST_MSEC / ptime, max_count*3/4);
+    jb->jb_adapt_algo = JB_ADAPT_BURST;
+    /* Assume 16 bit mono PCM until told otherwise */
+    jb->jb_clock_rate = frame_size / 2 * 1000 / ptime;
+    jb->jb_quantile = JB_DEFAULT_DELAY_QUANTILE;
+    jb->jb_vad_level = 0;
+    jb->jb_init_prefetch = 0;
+    /* A recycled buffer must not call the previous owner back */
+    jb->jb_gap_cb = NULL;
+    jb->jb_gap_user_data = NULL;
+
+    jbuf_set_discard(jb, JB_DISCARD_PROGRESSIVE);
+    
+    jbuf_reset(jb);
+}
+
+
 int jbuf_create(unsigned frame_size,
                 unsigned ptime,
                 unsigned max_count,
@@ -503,27 +994,25 @@ int jbuf_create(unsigned frame_size,
     int status;
 
     jb = (jbuf_t*)calloc(1, sizeof(jbuf_t));
+    if (!jb)
+        return -1;
 
-    status = jb_framelist_init(&jb->jb_framelist, frame_size, max_count);
-    if (status)
+    status = jb_framelist_init(&jb->jb_framelist, frame_size, max_count,
+                               NULL);
+    if (status) {
+        free(jb);
         return status;
+    }
 
     status = pthread_mutex_init(&jb->lock, NULL);
-    if (status < 0)
-        return status;
-    
-    jb->jb_frame_size = frame_size;
-    jb->jb_frame_ptime = ptime;
-    jb->jb_prefetch = MIN(JB_DEFAULT_INIT_DELAY, max_count*4/5);
-    jb->jb_min_prefetch  = 0;
-    jb->jb_max_prefetch  = max_count*4/5;
-    jb->jb_max_count = max_count;
-    jb->jb_min_shrink_gap = JBUF_DISC_MIN_GAP / ptime;
-    jb->jb_max_burst = MAX(MAX_BURST_MSEC / ptime, max_count*3/4);
+    if (status) {
+        jb_framelist_destroy(&jb->jb_framelist);
+        free(jb);
+        return -1;
+    }
 
-    jbuf_set_discard(jb, JB_DISCARD_PROGRESSIVE);
-    
-    jbuf_reset(jb);
+    jb->jb_evt_fd = -1;
+    jbuf_set_defaults(jb, frame_size, ptime, max_count);
 
     *p_jb = jb;
     
@@ -612,54 +1101,194 @@ int jbuf_set_discard(jbuf_t *jb,
 }
 
 
-int jbuf_reset(jbuf_t *jb)
+/*
+ * Set the adaptive algorithm used to estimate the jitter level.
+ */
+int jbuf_set_adapt(jbuf_t *jb,
+                   jb_adapt_algo_t algo)
 {
+    if (!jb) return -1;
+    if (algo < JB_ADAPT_BURST || algo > JB_ADAPT_QUANTILE)
+        return -1;
+
     pthread_mutex_lock(&jb->lock);
-    
-    jb->jb_level = 0;
-    jb->jb_last_op = JB_OP_INIT;
-    jb->jb_stable_hist = 0;
-    jb->jb_status = JB_STATUS_INITIALIZING;
-    jb->jb_init_cycle_cnt= 0;
-    jb->jb_max_hist_level= 0;
-    jb->jb_prefetching   = (jb->jb_prefetch != 0);
-    jb->jb_discard_dist  = 0;
 
-    jb_framelist_reset(&jb->jb_framelist);
+    jb->jb_adapt_algo = algo;
+    jb->jb_transit_cnt = 0;
 
     pthread_mutex_unlock(&jb->lock);
-    
+
     return 0;
 }
 
 
-int jbuf_destroy(jbuf_t *jb)
+/*
+ * Set the clock rate of the timestamps given to jbuf_put_frame3/4().
+ */
+int jbuf_set_clock_rate(jbuf_t *jb,
+                        unsigned clock_rate)
 {
-    int rc;
-    
-    pthread_mutex_lock(&jb->lock);    
-    rc = jb_framelist_destroy(&jb->jb_framelist);
+    if (!jb || !clock_rate)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    jb->jb_clock_rate = clock_rate;
+    jb->jb_transit_cnt = 0;
+    jb->jb_drift_cnt = 0;
+    jb->jb_drift_ppm = 0;
+
     pthread_mutex_unlock(&jb->lock);
 
-    return rc;
+    return 0;
 }
 
-int jbuf_is_full(jbuf_t *jb)
+
+/*
+ * Set the fraction of frames (0 < quantile < 1) the latency should cover
+ * in JB_ADAPT_QUANTILE, e.g: 0.98 lets 2% of frames arrive too late.
+ */
+int jbuf_set_delay_quantile(jbuf_t *jb,
+                            double quantile)
 {
-    int rc ;
-    
+    if (!jb || quantile <= 0 || quantile >= 1)
+        return -1;
+
     pthread_mutex_lock(&jb->lock);
-    
-    rc = (jb->jb_framelist.size == jb->jb_framelist.max_count);
+
+    jb->jb_quantile = quantile;
+    jb->jb_transit_cnt = 0;
 
     pthread_mutex_unlock(&jb->lock);
 
-    return rc;
+    return 0;
 }
 
-static void jbuf_calculate_jitter(jbuf_t *jb)
-{
-    int diff, cur_size;
+
+/*
+ * Set the callback of newly detected gaps (NULL to remove it). A frame
+ * put later into a gap slot, before the slot is played, fills it.
+ */
+int jbuf_set_gap_cb(jbuf_t *jb,
+                    jbuf_gap_cb cb,
+                    void *user_data)
+{
+    if (!jb)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    jb->jb_gap_cb = cb;
+    jb->jb_gap_user_data = user_data;
+
+    pthread_mutex_unlock(&jb->lock);
+
+    return 0;
+}
+
+
+/*
+ * Enable the voice activity detection on PUT, for 16 bit PCM frames.
+ * Frames whose RMS level is below 'level' (e.g: 100 for about -50 dBov),
+ * once the hangover after the last loud frame is over, are silent: only
+ * their metadata is stored and GET returns them as JB_ZERO_SILENT_FRAME
+ * without touching the frame buffer. A level of 0 disables it.
+ */
+int jbuf_set_vad(jbuf_t *jb,
+                 unsigned level)
+{
+    if (!jb || level > 32767)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    __atomic_store_n(&jb->jb_vad_level, level, __ATOMIC_RELAXED);
+    jb->jb_vad_hangover = 0;
+
+    pthread_mutex_unlock(&jb->lock);
+
+    return 0;
+}
+
+
+int jbuf_reset(jbuf_t *jb)
+{
+    pthread_mutex_lock(&jb->lock);
+    
+    jb->jb_level = 0;
+    jb->jb_last_op = JB_OP_INIT;
+    jb->jb_stable_hist = 0;
+    jb->jb_status = JB_STATUS_INITIALIZING;
+    jb->jb_init_cycle_cnt= 0;
+    jb->jb_max_hist_level= 0;
+    jb->jb_eff_level     = 0;
+    jb->jb_prefetching   = (jb->jb_prefetch != 0);
+    jb->jb_discard_ref   = 0;
+    jb->jb_discard_dist  = 0;
+    jb->jb_transit_cnt   = 0;
+    jb->jb_jitter        = 0;
+    jb->jb_drift_cnt     = 0;
+    jb->jb_drift_ppm     = 0;
+    jb->jb_lost          = 0;
+    jb->jb_discard       = 0;
+    jb->jb_empty         = 0;
+    jb->jb_silent        = 0;
+    jb->jb_recovered     = 0;
+    jb->jb_vad_hangover  = 0;
+    jb->jb_gap_first     = 0;
+    jb->jb_gap_cnt       = 0;
+    jb_math_stat_init(&jb->jb_delay);
+    jb_math_stat_init(&jb->jb_burst);
+
+    jb_framelist_reset(&jb->jb_framelist);
+
+    pthread_mutex_unlock(&jb->lock);
+    
+    return 0;
+}
+
+
+/*
+ * Destroy the jitter buffer. A buffer got from a pool is given back to
+ * its pool.
+ */
+int jbuf_destroy(jbuf_t *jb)
+{
+    int rc;
+
+    if (jb->jb_pool)
+        return jbuf_pool_put(jb->jb_pool, jb);
+    
+    pthread_mutex_lock(&jb->lock);    
+    rc = jb_framelist_destroy(&jb->jb_framelist);
+    if (jb->jb_evt_fd >= 0) {
+        close(jb->jb_evt_fd);
+        jb->jb_evt_fd = -1;
+    }
+    pthread_mutex_unlock(&jb->lock);
+
+    pthread_mutex_destroy(&jb->lock);
+    free(jb);
+
+    return rc;
+}
+
+int jbuf_is_full(jbuf_t *jb)
+{
+    int rc ;
+    
+    pthread_mutex_lock(&jb->lock);
+    
+    rc = (jb->jb_framelist.size == jb->jb_framelist.max_count);
+
+    pthread_mutex_unlock(&jb->lock);
+
+    return rc;
+}
+
+static void jbuf_calculate_jitter(jbuf_t *jb)
+{
+    int diff, cur_size;
 
     cur_size = jb_framelist_eff_size(&jb->jb_framelist);
     jb->jb_max_hist_level = MAX(jb->jb_max_hist_level, jb->jb_level);
@@ -683,6 +1312,7 @@ static void jbuf_calculate_jitter(jbuf_t *jb)
 
             /* Update effective burst level */
             jb->jb_eff_level -= diff;
+            jb_math_stat_update(&jb->jb_burst, jb->jb_eff_level);
 
             /* Update prefetch based on level */
             if (jb->jb_init_prefetch) {
@@ -705,6 +1335,7 @@ static void jbuf_calculate_jitter(jbuf_t *jb)
         /* Instaneous set effective burst level to recent maximum level */
         jb->jb_eff_level = MIN(jb->jb_max_hist_level,
                                   (int)(jb->jb_max_count*4/5));
+        jb_math_stat_update(&jb->jb_burst, jb->jb_eff_level);
 
         /* Update prefetch based on level */
         if (jb->jb_init_prefetch) {
@@ -726,6 +1357,120 @@ static void jbuf_calculate_jitter(jbuf_t *jb)
     }
 }
 
+/* Update the timing based jitter estimation with a frame that was sent
+ * at timestamp 'ts' and arrived at 'arrival' (in ms), then derive the
+ * effective level and prefetch from the delay distribution.
+ */
+static void jbuf_calculate_timing(jbuf_t *jb, uint32_t ts, uint32_t arrival)
+{
+    int32_t transit, d;
+    double rel_delay, diff, delay;
+    int level;
+
+    /* Transit time in timestamp units, only the differences between
+     * transit times are meaningful.
+     */
+    transit = (int32_t)((uint32_t)((uint64_t)arrival * jb->jb_clock_rate /
+                                   1000) - ts);
+
+    if (jb->jb_transit_cnt == 0) {
+        jb->jb_last_transit = transit;
+        jb->jb_min_transit = jb->jb_prev_min_transit = transit;
+        jb->jb_jitter = 0;
+        jb->jb_rel_delay = 0;
+        jb->jb_rel_delay_dev = 0;
+        jb_p2_init(&jb->jb_delay_q[0], jb->jb_quantile);
+        jb_p2_init(&jb->jb_delay_q[1], jb->jb_quantile);
+        jb->jb_transit_cnt = 1;
+        return;
+    }
+
+    /* RFC 3550 section 6.4.1 interarrival jitter */
+    d = transit - jb->jb_last_transit;
+    if (d < 0)
+        d = -d;
+    jb->jb_jitter += (d - jb->jb_jitter) / 16.0;
+    jb->jb_last_transit = transit;
+
+    /* Track the minimum transit time over the last two windows */
+    if (jb->jb_transit_cnt++ % JBUF_TIMING_MIN_WINDOW == 0) {
+        jb->jb_prev_min_transit = jb->jb_min_transit;
+        jb->jb_min_transit = transit;
+    } else if (transit - jb->jb_min_transit < 0) {
+        jb->jb_min_transit = transit;
+    }
+
+    /* Delay of this frame relative to the fastest recent frame */
+    d = transit - jb->jb_min_transit;
+    if (jb->jb_prev_min_transit - jb->jb_min_transit < 0)
+        d = transit - jb->jb_prev_min_transit;
+    if (d < 0)
+        d = 0;
+    rel_delay = d * 1000.0 / jb->jb_clock_rate;
+
+    /* Mean and mean deviation of the relative delay, using the same gains
+     * as TCP RTO estimation (RFC 6298).
+     */
+    diff = rel_delay - jb->jb_rel_delay;
+    jb->jb_rel_delay += diff / 8;
+    jb->jb_rel_delay_dev += (fabs(diff) - jb->jb_rel_delay_dev) / 4;
+
+    if (jb->jb_adapt_algo == JB_ADAPT_QUANTILE) {
+        jb_p2_quantile *q0 = &jb->jb_delay_q[0];
+        jb_p2_quantile *q1 = &jb->jb_delay_q[1];
+
+        /* Restart the estimators alternately every half window */
+        if (jb->jb_transit_cnt % JBUF_QUANTILE_WINDOW == 0)
+            jb_p2_init(q0, jb->jb_quantile);
+        else if (jb->jb_transit_cnt % JBUF_QUANTILE_WINDOW ==
+                 JBUF_QUANTILE_WINDOW / 2)
+            jb_p2_init(q1, jb->jb_quantile);
+
+        jb_p2_update(q0, rel_delay);
+        jb_p2_update(q1, rel_delay);
+
+        /* Follow the estimator that has seen more frames */
+        delay = jb_p2_value(q0->count >= q1->count ? q0 : q1);
+    } else {
+        delay = jb->jb_rel_delay +
+                JBUF_TIMING_DEV_MULT * jb->jb_rel_delay_dev;
+    }
+
+    if (jb->jb_transit_cnt < INIT_CYCLE)
+        return;
+
+    /* Latency needed to cover the delay distribution, in frames. The
+     * fastest frames wait for the whole latency, so they find that many
+     * frames in the buffer, plus themselves.
+     */
+    level = (int)ceil(delay / jb->jb_frame_ptime) + 1;
+    level = MIN(level, (int)(jb->jb_max_count*4/5));
+
+    if (level != jb->jb_eff_level) {
+        jb->jb_eff_level = level;
+        jb_math_stat_update(&jb->jb_burst, jb->jb_eff_level);
+    }
+
+    /* Update prefetch based on level */
+    if (jb->jb_init_prefetch) {
+        jb->jb_prefetch = jb->jb_eff_level;
+        if (jb->jb_prefetch < jb->jb_min_prefetch)
+            jb->jb_prefetch = jb->jb_min_prefetch;
+        if (jb->jb_prefetch > jb->jb_max_prefetch)
+            jb->jb_prefetch = jb->jb_max_prefetch;
+    }
+}
+
+/* Get the latency level (in frames) the discard algorithms should keep. */
+static int jbuf_discard_level(jbuf_t *jb)
+{
+    /* Timing based level already covers the bursts */
+    if (jb->jb_adapt_algo != JB_ADAPT_BURST)
+        return jb->jb_eff_level;
+
+    return MAX(jb->jb_eff_level, jb->jb_level);
+}
+
 static void jbuf_update(jbuf_t *jb, int oper)
 {
     if(jb->jb_last_op != oper) {
@@ -755,8 +1500,11 @@ static void jbuf_update(jbuf_t *jb, int oper)
          * the GET op may be idle, in this case, we better skip the jitter
          * calculation.
          */
-        if (oper == JB_OP_GET && jb->jb_level <= jb->jb_max_burst)
+        if (oper == JB_OP_GET && jb->jb_level <= jb->jb_max_burst &&
+            jb->jb_adapt_algo == JB_ADAPT_BURST)
+        {
             jbuf_calculate_jitter(jb);
+        }
 
         jb->jb_level = 0;
     }
@@ -790,7 +1538,7 @@ static void jbuf_discard_static(jbuf_t *jb)
      */
     int diff, burst_level;
 
-    burst_level = MAX(jb->jb_eff_level, jb->jb_level);
+    burst_level = jbuf_discard_level(jb);
     diff = jb_framelist_eff_size(&jb->jb_framelist) - burst_level*2;
 
     if (diff >= STA_DISC_SAFE_SHRINKING_DIFF) {
@@ -811,6 +1559,7 @@ static void jbuf_discard_static(jbuf_t *jb)
             /* Drop frame(s)! */
             diff = jb_framelist_remove_head(&jb->jb_framelist, diff);
             jb->jb_discard_ref = jb_framelist_origin(&jb->jb_framelist);
+            jb->jb_discard += diff;
         }
     }
 }
@@ -827,7 +1576,7 @@ static void jbuf_discard_progressive(jbuf_t *jb)
 
     /* Check if latency is longer than burst */
     cur_size = jb_framelist_eff_size(&jb->jb_framelist);
-    burst_level = MAX(jb->jb_eff_level, jb->jb_level);
+    burst_level = jbuf_discard_level(jb);
     if (cur_size <= burst_level) {
         /* Reset any scheduled discard */
         jb->jb_discard_dist = 0;
@@ -873,7 +1622,8 @@ static void jbuf_discard_progressive(jbuf_t *jb)
         if (discard_seq < jb_framelist_origin(&jb->jb_framelist))
             discard_seq = jb_framelist_origin(&jb->jb_framelist);
 
-        jb_framelist_discard(&jb->jb_framelist, discard_seq);
+        if (jb_framelist_discard(&jb->jb_framelist, discard_seq) == 0)
+            jb->jb_discard++;
 
         /* Update discard reference */
         jb->jb_discard_ref = discard_seq;
@@ -881,6 +1631,92 @@ static void jbuf_discard_progressive(jbuf_t *jb)
 }
 
 
+/* Sum of the squared samples of a 16 bit PCM frame, computed without
+ * the lock when voice activity detection is enabled, 0 otherwise. The
+ * number of samples summed is returned in p_len.
+ */
+static uint64_t jbuf_frame_energy(jbuf_t *jb,
+                                  const void *frame,
+                                  size_t frame_size,
+                                  unsigned *p_len)
+{
+    const int16_t *x = (const int16_t*)frame;
+    unsigned len = (unsigned)(frame_size / sizeof(int16_t));
+    uint64_t sum = 0;
+    unsigned i = 0;
+
+    *p_len = len;
+
+    /* jbuf_set_vad() may change the level meanwhile, under the lock */
+    if (!__atomic_load_n(&jb->jb_vad_level, __ATOMIC_RELAXED) || !frame)
+        return 0;
+
+    /* The sum of two products fits in an unsigned 32 bit lane, widen
+     * the lanes to 64 bit before accumulating.
+     */
+#if defined(__AVX2__)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        uint64_t tmp[4];
+
+        for (; i + 16 <= len; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(x + i));
+            __m256i p = _mm256_madd_epi16(v, v);
+
+            acc = _mm256_add_epi64(acc,
+                      _mm256_unpacklo_epi32(p, _mm256_setzero_si256()));
+            acc = _mm256_add_epi64(acc,
+                      _mm256_unpackhi_epi32(p, _mm256_setzero_si256()));
+        }
+        _mm256_storeu_si256((__m256i*)tmp, acc);
+        sum = tmp[0] + tmp[1] + tmp[2] + tmp[3];
+    }
+#elif defined(__SSE2__)
+    {
+        __m128i acc = _mm_setzero_si128();
+        uint64_t tmp[2];
+
+        for (; i + 8 <= len; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(x + i));
+            __m128i p = _mm_madd_epi16(v, v);
+
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(p, _mm_setzero_si128()));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(p, _mm_setzero_si128()));
+        }
+        _mm_storeu_si128((__m128i*)tmp, acc);
+        sum = tmp[0] + tmp[1];
+    }
+#endif
+
+    for (; i < len; ++i)
+        sum += (uint32_t)(x[i] * x[i]);
+
+    /* Keep silence distinguishable from a disabled detection */
+    return sum + 1;
+}
+
+/* Type to store a frame of the given energy over len samples with,
+ * updating the hangover. Must be called with the lock held.
+ */
+static unsigned jbuf_vad_type(jbuf_t *jb, uint64_t energy, unsigned len)
+{
+    if (!jb->jb_vad_level || !energy || !len)
+        return JB_NORMAL_FRAME;
+
+    if (energy - 1 >= (uint64_t)jb->jb_vad_level * jb->jb_vad_level * len) {
+        jb->jb_vad_hangover = JBUF_VAD_HANGOVER / jb->jb_frame_ptime;
+        return JB_NORMAL_FRAME;
+    }
+
+    if (jb->jb_vad_hangover) {
+        jb->jb_vad_hangover--;
+        return JB_NORMAL_FRAME;
+    }
+
+    return JB_ZERO_SILENT_FRAME;
+}
+
+
 void jbuf_put_frame(jbuf_t *jb,
                     const void *frame,
                     size_t frame_size,
@@ -907,20 +1743,216 @@ void jbuf_put_frame3(jbuf_t *jb,
                      int frame_seq,
                      uint32_t ts,
                      int *discarded)
+{
+    unsigned len;
+    uint64_t energy = jbuf_frame_energy(jb, frame, frame_size, &len);
+    jbuf_gap_cb gap_cb;
+    void *user_data;
+    int gap_first;
+    unsigned gap_cnt;
+
+    pthread_mutex_lock(&jb->lock);
+    jbuf_put_frame_locked(jb, frame, frame_size, bit_info, frame_seq, ts,
+                          jbuf_vad_type(jb, energy, len), discarded);
+    gap_cb = jb->jb_gap_cb;
+    user_data = jb->jb_gap_user_data;
+    gap_first = jb->jb_gap_first;
+    gap_cnt = jb->jb_gap_cnt;
+    pthread_mutex_unlock(&jb->lock);
+
+    /* Report the gap without the lock, the callback may call back */
+    if (gap_cb && gap_cnt)
+        (*gap_cb)(jb, gap_first, gap_cnt, user_data);
+}
+
+/*
+ * Put a frame rebuilt from redundant data (e.g: FEC), only if it is still
+ * missing and hasn't been played yet. A frame recovered into an open slot
+ * doesn't change the buffer size, so it isn't taken into account by the
+ * jitter estimation; a frame recovered beyond the last one is put as if
+ * it had arrived. Return 0 when the frame is recovered, -1 otherwise.
+ */
+int jbuf_put_recovered(jbuf_t *jb,
+                       const void *frame,
+                       size_t frame_size,
+                       uint32_t bit_info,
+                       int frame_seq,
+                       uint32_t ts)
+{
+    unsigned len;
+    uint64_t energy = jbuf_frame_energy(jb, frame, frame_size, &len);
+    jb_framelist_t *framelist = &jb->jb_framelist;
+    unsigned frame_type;
+    jbuf_gap_cb gap_cb = NULL;
+    void *user_data = NULL;
+    int gap_first = 0;
+    unsigned gap_cnt = 0;
+    int status = -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    frame_type = jbuf_vad_type(jb, energy, len);
+
+    if (framelist->size == 0 ||
+        frame_seq >= framelist->origin + (int)framelist->size)
+    {
+        int discarded;
+
+        jbuf_put_frame_locked(jb, frame, frame_size, bit_info, frame_seq,
+                              ts, frame_type, &discarded);
+        status = discarded ? -1 : 0;
+        gap_cb = jb->jb_gap_cb;
+        user_data = jb->jb_gap_user_data;
+        gap_first = jb->jb_gap_first;
+        gap_cnt = jb->jb_gap_cnt;
+    } else if (frame_seq >= framelist->origin &&
+               !jb_framelist_occupied(framelist,
+                                      (framelist->head +
+                                       (frame_seq - framelist->origin)) &
+                                      framelist->mask))
+    {
+        status = jb_framelist_put_at(framelist, frame_seq, frame,
+                                     (unsigned)MIN(frame_size,
+                                                   jb->jb_frame_size),
+                                     bit_info, ts, frame_type);
+        if (status == 0 && frame_type == JB_ZERO_SILENT_FRAME)
+            jb->jb_silent++;
+    }
+
+    if (status == 0)
+        jb->jb_recovered++;
+
+    pthread_mutex_unlock(&jb->lock);
+
+    if (gap_cb && gap_cnt)
+        (*gap_cb)(jb, gap_first, gap_cnt, user_data);
+
+    return status == 0 ? 0 : -1;
+}
+
+/* Update the clock drift estimation with a frame sent at timestamp 'ts'
+ * and arrived at 'arrival' (in ms). The arrival time follows the
+ * timestamp at the rate of the local clock over the sender clock, plus
+ * the network jitter; the slope of an exponentially weighted least
+ * squares fit of the arrival against the timestamp gives the drift.
+ */
+static void jbuf_estimate_drift(jbuf_t *jb, uint32_t ts, uint32_t arrival)
+{
+    double lambda = 1 - 1.0 / JBUF_DRIFT_WINDOW;
+    double dx, dy;
+
+    /* Timestamps and arrivals wrap, only their steps are used */
+    dx = (int32_t)(ts - jb->jb_drift_last_ts) * 1000.0 / jb->jb_clock_rate;
+    dy = (int32_t)(arrival - jb->jb_drift_last_arrival);
+    jb->jb_drift_last_ts = ts;
+    jb->jb_drift_last_arrival = arrival;
+
+    if (jb->jb_drift_cnt == 0 || fabs(dx - dy) > JBUF_DRIFT_MAX_STEP) {
+        jb->jb_drift_x = jb->jb_drift_y = 0;
+        jb->jb_drift_w = 1;
+        jb->jb_drift_mx = jb->jb_drift_my = 0;
+        jb->jb_drift_sxx = jb->jb_drift_sxy = 0;
+        jb->jb_drift_cnt = 1;
+        return;
+    }
+
+    jb->jb_drift_x += dx;
+    jb->jb_drift_y += dy;
+    jb->jb_drift_cnt++;
+
+    /* Weighted Welford update, numerically stable over long calls */
+    jb->jb_drift_w = lambda * jb->jb_drift_w + 1;
+    dx = jb->jb_drift_x - jb->jb_drift_mx;
+    dy = jb->jb_drift_y - jb->jb_drift_my;
+    jb->jb_drift_mx += dx / jb->jb_drift_w;
+    jb->jb_drift_my += dy / jb->jb_drift_w;
+    jb->jb_drift_sxx = lambda * jb->jb_drift_sxx +
+                       dx * (jb->jb_drift_x - jb->jb_drift_mx);
+    jb->jb_drift_sxy = lambda * jb->jb_drift_sxy +
+                       dx * (jb->jb_drift_y - jb->jb_drift_my);
+
+    if (jb->jb_drift_cnt >= JBUF_DRIFT_MIN_FRAMES && jb->jb_drift_sxx > 0 &&
+        jb->jb_drift_sxy > 0)
+    {
+        /* Local ms per sender ms */
+        double slope = jb->jb_drift_sxy / jb->jb_drift_sxx;
+
+        jb->jb_drift_ppm = (1 / slope - 1) * 1e6;
+    }
+}
+
+/*
+ * Put frame with its arrival time (in ms, from any monotonic clock), the
+ * arrival time is used by the timing based adaptive algorithm and by the
+ * clock drift estimation.
+ */
+void jbuf_put_frame4(jbuf_t *jb,
+                     const void *frame,
+                     size_t frame_size,
+                     uint32_t bit_info,
+                     int frame_seq,
+                     uint32_t ts,
+                     uint32_t arrival,
+                     int *discarded)
+{
+    unsigned len;
+    uint64_t energy = jbuf_frame_energy(jb, frame, frame_size, &len);
+    jbuf_gap_cb gap_cb;
+    void *user_data;
+    int gap_first;
+    unsigned gap_cnt;
+
+    pthread_mutex_lock(&jb->lock);
+
+    /* Late and duplicated frames tell about the delay distribution too,
+     * so feed the timing estimation before trying to store the frame.
+     */
+    if (jb->jb_adapt_algo != JB_ADAPT_BURST)
+        jbuf_calculate_timing(jb, ts, arrival);
+    jbuf_estimate_drift(jb, ts, arrival);
+
+    jbuf_put_frame_locked(jb, frame, frame_size, bit_info, frame_seq, ts,
+                          jbuf_vad_type(jb, energy, len), discarded);
+    gap_cb = jb->jb_gap_cb;
+    user_data = jb->jb_gap_user_data;
+    gap_first = jb->jb_gap_first;
+    gap_cnt = jb->jb_gap_cnt;
+    pthread_mutex_unlock(&jb->lock);
+
+    if (gap_cb && gap_cnt)
+        (*gap_cb)(jb, gap_first, gap_cnt, user_data);
+}
+
+static void jbuf_put_frame_locked(jbuf_t *jb,
+                                  const void *frame,
+                                  size_t frame_size,
+                                  uint32_t bit_info,
+                                  int frame_seq,
+                                  uint32_t ts,
+                                  unsigned frame_type,
+                                  int *discarded)
 {
     size_t min_frame_size;
     int new_size, cur_size;
     int status;
+    int prev_end = -1;
 
-    pthread_mutex_lock(&jb->lock);
-    
     cur_size = jb_framelist_eff_size(&jb->jb_framelist);
 
+    /* End of the buffered frames, slots between it and this frame will
+     * be left open. Nothing can be told on an empty buffer, as its origin
+     * is moved to the frame.
+     */
+    jb->jb_gap_cnt = 0;
+    if (jb_framelist_size(&jb->jb_framelist))
+        prev_end = jb_framelist_origin(&jb->jb_framelist) +
+                   (int)jb_framelist_size(&jb->jb_framelist);
+
     /* Attempt to store the frame */
     min_frame_size = MIN(frame_size, jb->jb_frame_size);
     status = jb_framelist_put_at(&jb->jb_framelist, frame_seq, frame,
                                  (unsigned)min_frame_size, bit_info, ts,
-                                 JB_NORMAL_FRAME);
+                                 frame_type);
 
     /* Jitter buffer is full, remove some older frames */
     while (status == -2) {
@@ -938,9 +1970,10 @@ void jbuf_put_frame3(jbuf_t *jb,
         assert(distance > 0);
 
         removed = jb_framelist_remove_head(&jb->jb_framelist, distance);
+        jb->jb_discard += removed;
         status = jb_framelist_put_at(&jb->jb_framelist, frame_seq, frame,
                                      (unsigned)min_frame_size, bit_info, ts,
-                                     JB_NORMAL_FRAME);
+                                     frame_type);
 
     }
 
@@ -952,15 +1985,34 @@ void jbuf_put_frame3(jbuf_t *jb,
         *discarded = (status != 0);
 
     if (status == 0) {
+        if (frame_type == JB_ZERO_SILENT_FRAME)
+            jb->jb_silent++;
+
+        /* Some slots may have been removed to make room */
+        if (prev_end >= 0 && frame_seq > prev_end) {
+            jb->jb_gap_first = prev_end;
+            if (jb->jb_gap_first < jb_framelist_origin(&jb->jb_framelist))
+                jb->jb_gap_first = jb_framelist_origin(&jb->jb_framelist);
+            if (frame_seq > jb->jb_gap_first)
+                jb->jb_gap_cnt = (unsigned)(frame_seq - jb->jb_gap_first);
+        }
+
         if (jb->jb_prefetching) {
             if (new_size >= jb->jb_prefetch)
                 jb->jb_prefetching = 0;
         }
+
+        /* GET would return a frame again, notify the waiting consumer */
+        if (jb->jb_evt_armed && !jb->jb_prefetching) {
+            uint64_t one = 1;
+
+            jb->jb_evt_armed = 0;
+            if (write(jb->jb_evt_fd, &one, sizeof(one)) < 0)
+                jb->jb_evt_armed = 1;
+        }
         jb->jb_level += (new_size > cur_size ? new_size-cur_size : 1);
         jbuf_update(jb, JB_OP_PUT);
     }
-
-    pthread_mutex_unlock(&jb->lock);    
 }
 
 /*
@@ -1011,6 +2063,7 @@ void jbuf_get_frame3(jbuf_t *jb,
         *p_frame_type = JB_ZERO_PREFETCH_FRAME;
         if (size)
             *size = 0;
+        jb->jb_evt_armed = (jb->jb_evt_fd >= 0);
     } else {
         jb_frame_type_t ftype = JB_NORMAL_FRAME;
         int res;
@@ -1025,8 +2078,11 @@ void jbuf_get_frame3(jbuf_t *jb,
             if (ftype == JB_NORMAL_FRAME) {
                 *p_frame_type = JB_NORMAL_FRAME;
                 //                printf("normal packet\n");                
+            } else if (ftype == JB_ZERO_SILENT_FRAME) {
+                *p_frame_type = JB_ZERO_SILENT_FRAME;
             } else {
                 *p_frame_type = JB_MISSING_FRAME;
+                jb->jb_lost++;
                 //                printf("missing packet\n");
             }
 
@@ -1038,6 +2094,8 @@ void jbuf_get_frame3(jbuf_t *jb,
 
                 /* We've just retrieved one frame, so add one to cur_size */
                 cur_size = jb_framelist_eff_size(&jb->jb_framelist) + 1;
+                jb_math_stat_update(&jb->jb_delay,
+                                    cur_size * jb->jb_frame_ptime);
             }
         } else {
             /* Jitter buffer is empty */
@@ -1048,6 +2106,8 @@ void jbuf_get_frame3(jbuf_t *jb,
             *p_frame_type = JB_ZERO_EMPTY_FRAME;
             if (size)
                 *size = 0;
+            jb->jb_empty++;
+            jb->jb_evt_armed = (jb->jb_evt_fd >= 0);
 
             // printf("jtbuf empty\n");
         }
@@ -1060,6 +2120,11 @@ void jbuf_get_frame3(jbuf_t *jb,
 }
 
 
+/*
+ * Peek the frame at 'offset' from the head without removing it, the
+ * frame pointer is valid until the frame is removed. The type is
+ * JB_ZERO_EMPTY_FRAME when there is no frame at 'offset'.
+ */
 void jbuf_peek_frame(jbuf_t *jb,
                      unsigned offset,
                      const void **frame,
@@ -1078,8 +2143,8 @@ void jbuf_peek_frame(jbuf_t *jb,
                             bit_info, ts, seq);
     if (!res)
         *p_frm_type = JB_ZERO_EMPTY_FRAME;
-    else if (ftype == JB_NORMAL_FRAME)
-        *p_frm_type = JB_NORMAL_FRAME;
+    else if (ftype == JB_NORMAL_FRAME || ftype == JB_ZERO_SILENT_FRAME)
+        *p_frm_type = (char)ftype;
     else
         *p_frm_type = JB_MISSING_FRAME;
 
@@ -1087,6 +2152,10 @@ void jbuf_peek_frame(jbuf_t *jb,
 }
 
 
+/*
+ * Remove 'frame_cnt' frames from the head, discarded frames not counted.
+ * Return the number of frames removed.
+ */
 unsigned jbuf_remove_frame(jbuf_t *jb,
                            unsigned frame_cnt)
 {
@@ -1114,3 +2183,320 @@ unsigned jbuf_remove_frame(jbuf_t *jb,
     
     return count;
 }
+
+
+/*
+ * Get jitter buffer current state/settings.
+ */
+int jbuf_get_state(jbuf_t *jb,
+                   jb_state_t *state)
+{
+    if (!jb || !state)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    state->frame_size = (unsigned)jb->jb_frame_size;
+    state->ptime = jb->jb_frame_ptime;
+    state->min_prefetch = jb->jb_min_prefetch;
+    state->max_prefetch = jb->jb_max_prefetch;
+
+    state->burst = jb->jb_eff_level;
+    state->prefetch = jb->jb_prefetch;
+    state->size = jb_framelist_eff_size(&jb->jb_framelist);
+
+    state->avg_delay = (unsigned)(jb->jb_delay.mean + 0.5);
+    state->min_delay = jb->jb_delay.min;
+    state->max_delay = jb->jb_delay.max;
+    state->dev_delay = jb_math_stat_dev(&jb->jb_delay);
+    state->avg_burst = (unsigned)(jb->jb_burst.mean + 0.5);
+    state->lost = jb->jb_lost;
+    state->discard = jb->jb_discard;
+    state->empty = jb->jb_empty;
+    state->jitter = (unsigned)(jb->jb_jitter * 1000 / jb->jb_clock_rate + 0.5);
+    state->silent = jb->jb_silent;
+    state->recovered = jb->jb_recovered;
+    state->drift_ppm = (int)(jb->jb_drift_ppm < 0 ? jb->jb_drift_ppm - 0.5 :
+                                                    jb->jb_drift_ppm + 0.5);
+
+    pthread_mutex_unlock(&jb->lock);
+
+    return 0;
+}
+
+
+/*
+ * Get a file descriptor which becomes readable when frames are available
+ * again after GET returned a zero (prefetch or empty) frame, so the
+ * consumer doesn't have to poll the jitter buffer while it is idle. The
+ * consumer reads the eventfd counter to clear it.
+ */
+int jbuf_get_event_fd(jbuf_t *jb)
+{
+    int fd;
+
+    if (!jb)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    if (jb->jb_evt_fd < 0) {
+        jb->jb_evt_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        /* Nothing has been returned yet, so notify the first frame */
+        jb->jb_evt_armed = (jb->jb_evt_fd >= 0);
+    }
+    fd = jb->jb_evt_fd;
+
+    pthread_mutex_unlock(&jb->lock);
+
+    return fd;
+}
+
+
+/*
+ * Get the seq of the frame the next GET would return, -1 when the jitter
+ * buffer is empty.
+ */
+int jbuf_get_origin(jbuf_t *jb,
+                    int *seq)
+{
+    int rc = -1;
+
+    if (!jb || !seq)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    if (jb_framelist_size(&jb->jb_framelist)) {
+        *seq = jb_framelist_origin(&jb->jb_framelist);
+        rc = 0;
+    }
+
+    pthread_mutex_unlock(&jb->lock);
+
+    return rc;
+}
+
+
+/*
+ * Check the slot of 'seq': 1 if the frame has been put (or discarded),
+ * 0 if it is still missing and can be put, -1 if the slot is not in the
+ * buffer (already played, or beyond the last frame).
+ */
+int jbuf_has_frame(jbuf_t *jb,
+                   int seq)
+{
+    jb_framelist_t *framelist;
+    int rc = -1;
+
+    if (!jb)
+        return -1;
+
+    pthread_mutex_lock(&jb->lock);
+
+    framelist = &jb->jb_framelist;
+    if (framelist->size && seq >= framelist->origin &&
+        seq < framelist->origin + (int)framelist->size)
+    {
+        unsigned pos = (framelist->head + (seq - framelist->origin)) &
+                       framelist->mask;
+
+        rc = jb_framelist_occupied(framelist, pos);
+    }
+
+    pthread_mutex_unlock(&jb->lock);
+
+    return rc;
+}
+
+
+/*
+ * Create a pool of 'count' jitter buffers sharing the same settings, all
+ * allocated in a single arena. With JB_POOL_HUGEPAGE, the arena is backed
+ * by huge pages when the system has some available.
+ */
+int jbuf_pool_create(unsigned count,
+                     unsigned frame_size,
+                     unsigned ptime,
+                     unsigned max_count,
+                     unsigned flags,
+                     jbuf_pool_t **p_pool)
+{
+    enum { HUGEPAGE_SIZE = 2 * 1024 * 1024 };
+    jbuf_pool_t *pool;
+    size_t jb_size;
+    unsigned i;
+
+    if (!count || !frame_size || !ptime || !max_count || !p_pool)
+        return -1;
+
+    pool = (jbuf_pool_t*)calloc(1, sizeof(jbuf_pool_t));
+    if (!pool)
+        return -1;
+
+    pool->frame_size = frame_size;
+    pool->ptime = ptime;
+    pool->max_count = max_count;
+    pool->count = count;
+
+    /* Each buffer is the jbuf_t followed by its framelist buffers */
+    jb_size = (sizeof(jbuf_t) + JB_CACHE_LINE - 1) &
+              ~(size_t)(JB_CACHE_LINE - 1);
+    pool->stride = (jb_size + jb_framelist_mem_size(frame_size, max_count) +
+                    JB_CACHE_LINE - 1) & ~(size_t)(JB_CACHE_LINE - 1);
+    pool->arena_size = pool->stride * count;
+
+    pool->arena = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (flags & JB_POOL_HUGEPAGE) {
+        size_t size = (pool->arena_size + HUGEPAGE_SIZE - 1) &
+                      ~(size_t)(HUGEPAGE_SIZE - 1);
+
+        pool->arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pool->arena != MAP_FAILED)
+            pool->arena_size = size;
+    }
+#endif
+    if (pool->arena == MAP_FAILED) {
+        pool->arena = mmap(NULL, pool->arena_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (pool->arena == MAP_FAILED) {
+        free(pool);
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+
+    /* Build the buffers in place, in reverse so the free list starts with
+     * the lowest address.
+     */
+    for (i = count; i > 0; --i) {
+        char *p = (char*)pool->arena + pool->stride * (i - 1);
+        jbuf_t *jb = (jbuf_t*)p;
+
+        jb_framelist_init(&jb->jb_framelist, frame_size, max_count,
+                          p + jb_size);
+        pthread_mutex_init(&jb->lock, NULL);
+        jb->jb_evt_fd = -1;
+        jb->jb_pool = pool;
+
+        jb->jb_pool_next = pool->free_list;
+        pool->free_list = jb;
+    }
+    pool->free_cnt = count;
+
+    *p_pool = pool;
+
+    return 0;
+}
+
+
+/*
+ * Get a free jitter buffer from the pool, with default settings and
+ * reset state. Returns -1 if all the buffers are in use.
+ */
+int jbuf_pool_get(jbuf_pool_t *pool,
+                  jbuf_t **p_jb)
+{
+    jbuf_t *jb;
+
+    pthread_mutex_lock(&pool->lock);
+    jb = pool->free_list;
+    if (jb) {
+        pool->free_list = jb->jb_pool_next;
+        pool->free_cnt--;
+        jb->jb_pool_next = NULL;
+        jb->jb_pool_used = 1;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!jb)
+        return -1;
+
+    jbuf_set_defaults(jb, pool->frame_size, pool->ptime, pool->max_count);
+
+    *p_jb = jb;
+
+    return 0;
+}
+
+
+/*
+ * Give a jitter buffer back to its pool, jbuf_destroy() does the same.
+ * Returns -1 if the buffer is already free.
+ */
+int jbuf_pool_put(jbuf_pool_t *pool,
+                  jbuf_t *jb)
+{
+    if (!pool || !jb || jb->jb_pool != pool)
+        return -1;
+
+    /* Claim the buffer first, a second put would link it twice */
+    pthread_mutex_lock(&pool->lock);
+    if (!jb->jb_pool_used) {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    jb->jb_pool_used = 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_lock(&jb->lock);
+    if (jb->jb_evt_fd >= 0) {
+        close(jb->jb_evt_fd);
+        jb->jb_evt_fd = -1;
+    }
+    jb->jb_evt_armed = 0;
+    pthread_mutex_unlock(&jb->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    jb->jb_pool_next = pool->free_list;
+    pool->free_list = jb;
+    pool->free_cnt++;
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+
+/*
+ * Get the number of free jitter buffers in the pool.
+ */
+unsigned jbuf_pool_free_count(jbuf_pool_t *pool)
+{
+    unsigned cnt;
+
+    pthread_mutex_lock(&pool->lock);
+    cnt = pool->free_cnt;
+    pthread_mutex_unlock(&pool->lock);
+
+    return cnt;
+}
+
+
+/*
+ * Destroy the pool, all the buffers must have been given back.
+ */
+int jbuf_pool_destroy(jbuf_pool_t *pool)
+{
+    unsigned i;
+
+    if (!pool)
+        return -1;
+
+    if (pool->free_cnt != pool->count)
+        return -1;
+
+    for (i = 0; i < pool->count; ++i) {
+        jbuf_t *jb = (jbuf_t*)((char*)pool->arena + pool->stride * i);
+        pthread_mutex_destroy(&jb->lock);
+    }
+
+    munmap(pool->arena, pool->arena_size);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+
+    return 0;
+}
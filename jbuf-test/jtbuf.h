@@ -10,8 +10,11 @@ typedef enum jb_frame_type
     JB_NORMAL_FRAME   = 1, /**< Normal frame is being returned */
     JB_ZERO_PREFETCH_FRAME = 2, /**< Zero frame is being returned  
                                    because JB is bufferring.    */
-    JB_ZERO_EMPTY_FRAME   = 3/**< Zero frame is being returned
+    JB_ZERO_EMPTY_FRAME   = 3,/**< Zero frame is being returned
                                     because JB is empty.    */
+    JB_ZERO_SILENT_FRAME  = 4 /**< Zero frame is being returned
+                                   because the frame put was silent,
+                                   see jbuf_set_vad().    */
 } jb_frame_type_t;
 
 
@@ -49,6 +52,39 @@ typedef enum jb_discard_algo
 } jb_discard_algo_t;
 
 
+/**
+ * Enumeration of jitter buffer adaptive algorithm, i.e: the way the jitter
+ * buffer estimates the jitter level it uses to set its prefetch and to
+ * decide whether its latency is higher than it should be.
+ */
+typedef enum jb_adapt_algo
+{
+    /**
+     * Estimate the jitter from the burst level of PUT/GET operations. This
+     * doesn't need any timing information from the application.
+     */
+    JB_ADAPT_BURST = 0,
+
+    /**
+     * Estimate the jitter from the frame timing, i.e: RFC 3550 interarrival
+     * jitter and the delay distribution calculated from RTP timestamp and
+     * arrival time of each frame. Frames should be put using
+     * jbuf_put_frame4(), frames without arrival time are not taken into
+     * account.
+     */
+    JB_ADAPT_TIMING,
+
+    /**
+     * Like JB_ADAPT_TIMING, but the latency follows a quantile of the
+     * per-frame delay (see jbuf_set_delay_quantile()) estimated with a
+     * constant memory streaming estimator, so the trade-off between
+     * latency and late frames can be set explicitly.
+     */
+    JB_ADAPT_QUANTILE
+
+} jb_adapt_algo_t;
+
+
 /**
  * This structure describes jitter buffer state.
  */
@@ -56,6 +92,7 @@ typedef struct jb_state
 {
     /* Setting */
     unsigned frame_size;    /**< Individual frame size, in bytes.   */
+    unsigned ptime;    /**< Frame duration, in ms.    */
     unsigned min_prefetch;    /**< Minimum allowed prefetch, in frms. */
     unsigned max_prefetch;    /**< Maximum allowed prefetch, in frms. */
 
@@ -73,12 +110,35 @@ typedef struct jb_state
     unsigned lost;    /**< Number of lost frames.    */
     unsigned discard;    /**< Number of discarded frames.    */
     unsigned empty;    /**< Number of empty on GET events.    */
+    unsigned jitter;    /**< Interarrival jitter (RFC 3550), in ms,
+                             only calculated in JB_ADAPT_TIMING
+                             and JB_ADAPT_QUANTILE.    */
+    unsigned silent;    /**< Number of silent frames put.    */
+    unsigned recovered;    /**< Number of missing frames recovered,
+                                see jbuf_put_recovered().    */
+    int drift_ppm;    /**< Clock drift of the sender relative to the
+                           local clock, in ppm, positive when the
+                           sender is faster. Estimated from the frames
+                           put with jbuf_put_frame4(), 0 until known. */
     
 } jb_state_t;
 
 
 typedef struct jbuf jbuf_t;
 
+typedef struct jbuf_pool jbuf_pool_t;
+
+/**
+ * Callback of newly detected gaps: a PUT left 'count' missing frames from
+ * 'first_seq' on, whose slots stay open for late (e.g: retransmitted)
+ * frames until they are played. It is called without the jitter buffer
+ * lock held, on the thread of the PUT.
+ */
+typedef void (*jbuf_gap_cb)(jbuf_t *jb,
+                            int first_seq,
+                            unsigned count,
+                            void *user_data);
+
 
 
 /**
@@ -87,6 +147,12 @@ typedef struct jbuf jbuf_t;
  */
 #define JB_DEFAULT_INIT_DELAY    15
 
+/**
+ * The constant JB_DEFAULT_DELAY_QUANTILE specifies the default fraction of
+ * frames the latency should cover in JB_ADAPT_QUANTILE.
+ */
+#define JB_DEFAULT_DELAY_QUANTILE    0.98
+
 extern int jbuf_set_fixed(jbuf_t *, unsigned);
 extern int jbuf_set_adaptive(jbuf_t *,
                              unsigned,
@@ -94,6 +160,12 @@ extern int jbuf_set_adaptive(jbuf_t *,
                              unsigned);
 extern int jbuf_set_discard(jbuf_t *,
                             jb_discard_algo_t);
+extern int jbuf_set_adapt(jbuf_t *,
+                          jb_adapt_algo_t);
+extern int jbuf_set_clock_rate(jbuf_t *, unsigned);
+extern int jbuf_set_delay_quantile(jbuf_t *, double);
+extern int jbuf_set_vad(jbuf_t *, unsigned);
+extern int jbuf_set_gap_cb(jbuf_t *, jbuf_gap_cb, void *);
 
 extern int jbuf_create(unsigned,
                        unsigned,
@@ -120,12 +192,63 @@ extern void jbuf_put_frame3(jbuf_t *,
                             int,
                             uint32_t,
                             int *);
+extern void jbuf_put_frame4(jbuf_t *,
+                            const void *,
+                            size_t,
+                            uint32_t,
+                            int,
+                            uint32_t,
+                            uint32_t,
+                            int *);
+extern int jbuf_put_recovered(jbuf_t *,
+                              const void *,
+                              size_t,
+                              uint32_t,
+                              int,
+                              uint32_t);
 extern void jbuf_get_frame(jbuf_t *, void *, char *);
 
 extern void jbuf_get_frame2(jbuf_t *, void *, size_t*, char *, uint32_t*);
 
 extern void jbuf_get_frame3(jbuf_t *, void *, size_t*, char *, uint32_t*, uint32_t*, int*);
 
+extern void jbuf_peek_frame(jbuf_t *,
+                            unsigned,
+                            const void **,
+                            size_t *,
+                            char *,
+                            uint32_t *,
+                            uint32_t *,
+                            int *);
+
+extern unsigned jbuf_remove_frame(jbuf_t *, unsigned);
+
+extern int jbuf_get_state(jbuf_t *, jb_state_t *);
+
+extern int jbuf_get_event_fd(jbuf_t *);
+
+extern int jbuf_get_origin(jbuf_t *, int *);
+
+extern int jbuf_has_frame(jbuf_t *, int);
+
+
+/**
+ * Flag for jbuf_pool_create(), back the pool arena by huge pages when
+ * available.
+ */
+#define JB_POOL_HUGEPAGE    1
+
+extern int jbuf_pool_create(unsigned,
+                            unsigned,
+                            unsigned,
+                            unsigned,
+                            unsigned,
+                            jbuf_pool_t **);
+extern int jbuf_pool_get(jbuf_pool_t *, jbuf_t **);
+extern int jbuf_pool_put(jbuf_pool_t *, jbuf_t *);
+extern unsigned jbuf_pool_free_count(jbuf_pool_t *);
+extern int jbuf_pool_destroy(jbuf_pool_t *);
+
 
 
 #endif
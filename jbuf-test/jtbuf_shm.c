@@ -0,0 +1,493 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "jtbuf.h"
+#include "jtbuf_shm.h"
+
+#define JBUF_SHM_MAGIC   0x6a627368 /* "jbsh" */
+#define JBUF_SHM_VERSION 1
+
+/* Sequence number of a slot being written or never written. */
+#define SHM_SLOT_BUSY    INT_MIN
+
+/* Origin value before the first frame was put. */
+#define SHM_NO_ORIGIN    INT_MIN
+
+#define SHM_CACHE_LINE   64
+
+/* Header of the shared region. Producer and consumer states are kept in
+ * their own cache lines, so the two processes don't write to the same
+ * line on every frame.
+ */
+typedef struct jbuf_shm_hdr
+{
+    /* Settings (consts, written by the creator) */
+    uint32_t     magic;        /**< JBUF_SHM_MAGIC once initialized   */
+    uint32_t     version;      /**< layout version    */
+    uint32_t     frame_size;   /**< maximum size of frame    */
+    uint32_t     max_count;    /**< capacity, in frames    */
+    uint32_t     prefetch;     /**< frames to buffer before GET
+                                    returns frames    */
+    uint32_t     slot_size;    /**< size of a slot, header included   */
+
+    /* Producer state */
+    int32_t      put_seq __attribute__((aligned(SHM_CACHE_LINE)));
+                               /**< highest seq stored + 1    */
+    int32_t      req_seq;      /**< highest seq put, even if it
+                                    was dropped    */
+    uint32_t     dropped;      /**< no. of frames dropped because
+                                    the buffer was full    */
+
+    /* Consumer state */
+    int32_t      origin __attribute__((aligned(SHM_CACHE_LINE)));
+                               /**< seq of the next frame to get    */
+    uint32_t     waiting;      /**< doorbell, non-zero when the
+                                    consumer waits for frames    */
+
+} __attribute__((aligned(SHM_CACHE_LINE))) jbuf_shm_hdr;
+
+/* Header of a frame slot, the frame content follows it. */
+typedef struct jbuf_shm_slot
+{
+    int32_t      seq;          /**< seq of the frame in the slot, or
+                                    SHM_SLOT_BUSY    */
+    uint32_t     len;          /**< frame length    */
+    uint32_t     bit_info;     /**< frame bit info    */
+    uint32_t     ts;           /**< frame timestamp    */
+
+} jbuf_shm_slot;
+
+struct jbuf_shm
+{
+    int          fd;           /**< shared memory fd    */
+    size_t       map_size;     /**< size of the mapping    */
+    jbuf_shm_hdr *hdr;         /**< the shared region    */
+    char         *slots;       /**< first slot    */
+
+    /* Consumer private state */
+    int          prefetching;  /**< flag if GET is prefetching    */
+};
+
+
+static size_t shm_map_size(unsigned frame_size, unsigned max_count,
+                           unsigned *slot_size)
+{
+    unsigned size;
+
+    size = (sizeof(jbuf_shm_slot) + frame_size + SHM_CACHE_LINE - 1) &
+           ~(SHM_CACHE_LINE - 1);
+    if (slot_size)
+        *slot_size = size;
+
+    return sizeof(jbuf_shm_hdr) + (size_t)size * max_count;
+}
+
+/* The capacity is a power of two, so consecutive seqs use consecutive
+ * slots across the negative seqs and the 32 bit wrap too.
+ */
+static jbuf_shm_slot *shm_slot(jbuf_shm_t *shm, int seq)
+{
+    unsigned idx = (unsigned)seq & (shm->hdr->max_count - 1);
+
+    return (jbuf_shm_slot*)(shm->slots + (size_t)idx * shm->hdr->slot_size);
+}
+
+static int shm_futex(uint32_t *addr, int op, uint32_t val,
+                     const struct timespec *timeout)
+{
+    /* Not FUTEX_PRIVATE_FLAG, the word is shared between processes */
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static int shm_map(int fd, size_t size, jbuf_shm_t **p_shm)
+{
+    jbuf_shm_t *shm;
+    void *addr;
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return -1;
+
+    shm = (jbuf_shm_t*)calloc(1, sizeof(jbuf_shm_t));
+    if (!shm) {
+        munmap(addr, size);
+        return -1;
+    }
+
+    shm->fd = fd;
+    shm->map_size = size;
+    shm->hdr = (jbuf_shm_hdr*)addr;
+    shm->slots = (char*)addr + sizeof(jbuf_shm_hdr);
+
+    *p_shm = shm;
+
+    return 0;
+}
+
+
+/*
+ * Create a shared jitter buffer. When 'path' is NULL the region is an
+ * anonymous memfd, which can be shared by fork() or by passing the fd
+ * returned by jbuf_shm_get_fd(), otherwise it is the file at 'path'
+ * (e.g: in /dev/shm). An existing file is unlinked rather than truncated,
+ * a consumer still mapping it keeps the old region instead of faulting.
+ * The capacity 'max_count' is rounded up to a power of two.
+ */
+int jbuf_shm_create(const char *path,
+                    unsigned frame_size,
+                    unsigned max_count,
+                    unsigned prefetch,
+                    jbuf_shm_t **p_shm)
+{
+    jbuf_shm_t *shm;
+    jbuf_shm_hdr *hdr;
+    unsigned slot_size, i;
+    size_t size;
+    int fd;
+
+    if (!frame_size || !max_count || max_count > (1U << 30) ||
+        prefetch > max_count || !p_shm)
+    {
+        return -1;
+    }
+
+    /* Round the capacity up to a power of two, see shm_slot() */
+    while (max_count & (max_count - 1))
+        max_count = (max_count | (max_count - 1)) + 1;
+
+    size = shm_map_size(frame_size, max_count, &slot_size);
+
+    if (path) {
+        if (unlink(path) < 0 && errno != ENOENT)
+            return -1;
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    } else
+        fd = memfd_create("jbuf_shm", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (ftruncate(fd, size) < 0 || shm_map(fd, size, &shm) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    hdr = shm->hdr;
+    hdr->version = JBUF_SHM_VERSION;
+    hdr->frame_size = frame_size;
+    hdr->max_count = max_count;
+    hdr->prefetch = prefetch;
+    hdr->slot_size = slot_size;
+    hdr->put_seq = hdr->req_seq = SHM_NO_ORIGIN;
+    hdr->origin = SHM_NO_ORIGIN;
+
+    for (i = 0; i < max_count; ++i)
+        shm_slot(shm, i)->seq = SHM_SLOT_BUSY;
+
+    shm->prefetching = (prefetch != 0);
+
+    /* Publish the region */
+    __atomic_store_n(&hdr->magic, JBUF_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    *p_shm = shm;
+
+    return 0;
+}
+
+
+/*
+ * Attach to a shared jitter buffer created by another process.
+ */
+int jbuf_shm_attach_fd(int fd,
+                       jbuf_shm_t **p_shm)
+{
+    jbuf_shm_hdr hdr;
+    jbuf_shm_t *shm;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        return -1;
+    if (hdr.magic != JBUF_SHM_MAGIC || hdr.version != JBUF_SHM_VERSION ||
+        !hdr.max_count || (hdr.max_count & (hdr.max_count - 1)))
+    {
+        return -1;
+    }
+
+    if (shm_map(fd, shm_map_size(hdr.frame_size, hdr.max_count, NULL),
+                &shm) < 0)
+    {
+        return -1;
+    }
+
+    shm->prefetching = (shm->hdr->prefetch != 0);
+    *p_shm = shm;
+
+    return 0;
+}
+
+
+int jbuf_shm_attach(const char *path,
+                    jbuf_shm_t **p_shm)
+{
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+        return -1;
+
+    if (jbuf_shm_attach_fd(fd, p_shm) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int jbuf_shm_get_fd(jbuf_shm_t *shm)
+{
+    return shm->fd;
+}
+
+
+int jbuf_shm_destroy(jbuf_shm_t *shm)
+{
+    if (!shm)
+        return -1;
+
+    munmap(shm->hdr, shm->map_size);
+    close(shm->fd);
+    free(shm);
+
+    return 0;
+}
+
+
+/*
+ * Put frame, producer side only. Returns 0 when the frame is stored,
+ * -1 when it is too late or duplicated, and -2 when the buffer is full
+ * (the consumer will skip older frames to make room at its next GET).
+ */
+int jbuf_shm_put_frame(jbuf_shm_t *shm,
+                       const void *frame,
+                       size_t frame_size,
+                       uint32_t bit_info,
+                       int frame_seq,
+                       uint32_t ts)
+{
+    jbuf_shm_hdr *hdr = shm->hdr;
+    jbuf_shm_slot *slot;
+    int32_t origin, req;
+
+    if (frame_size > hdr->frame_size)
+        return -1;
+
+    origin = __atomic_load_n(&hdr->origin, __ATOMIC_ACQUIRE);
+    if (origin == SHM_NO_ORIGIN) {
+        /* First frame ever, it is the origin */
+        __atomic_compare_exchange_n(&hdr->origin, &origin, frame_seq, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        origin = __atomic_load_n(&hdr->origin, __ATOMIC_ACQUIRE);
+    }
+
+    req = hdr->req_seq;
+    if (req == SHM_NO_ORIGIN || frame_seq - req > 0)
+        __atomic_store_n(&hdr->req_seq, frame_seq, __ATOMIC_RELEASE);
+
+    /* too late */
+    if (frame_seq - origin < 0)
+        return -1;
+
+    /* The slot may still hold a frame the consumer hasn't got */
+    if (frame_seq - origin >= (int32_t)hdr->max_count) {
+        __atomic_fetch_add(&hdr->dropped, 1, __ATOMIC_RELAXED);
+        return -2;
+    }
+
+    slot = shm_slot(shm, frame_seq);
+
+    /* duplicated frame */
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == frame_seq)
+        return -1;
+
+    /* Mark the slot busy while it is written, so a consumer reading it
+     * concurrently (with a stale origin) sees the frame is torn.
+     */
+    __atomic_store_n(&slot->seq, SHM_SLOT_BUSY, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(slot + 1, frame, frame_size);
+    slot->len = (uint32_t)frame_size;
+    slot->bit_info = bit_info;
+    slot->ts = ts;
+
+    __atomic_store_n(&slot->seq, frame_seq, __ATOMIC_RELEASE);
+
+    if (hdr->put_seq == SHM_NO_ORIGIN || frame_seq + 1 - hdr->put_seq > 0)
+        __atomic_store_n(&hdr->put_seq, frame_seq + 1, __ATOMIC_RELEASE);
+
+    /* Ring the doorbell only if the consumer sleeps on it. The fence
+     * pairs with the one in jbuf_shm_wait(), either the consumer sees the
+     * new put_seq or we see its doorbell.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->waiting, __ATOMIC_ACQUIRE) &&
+        __atomic_exchange_n(&hdr->waiting, 0, __ATOMIC_ACQ_REL))
+    {
+        shm_futex(&hdr->waiting, FUTEX_WAKE, INT_MAX, NULL);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Get frame, consumer side only. The frame types are the same as the
+ * ones of jbuf_get_frame3().
+ */
+void jbuf_shm_get_frame(jbuf_shm_t *shm,
+                        void *frame,
+                        size_t *size,
+                        char *p_frame_type,
+                        uint32_t *bit_info,
+                        uint32_t *ts,
+                        int *seq)
+{
+    jbuf_shm_hdr *hdr = shm->hdr;
+    jbuf_shm_slot *slot;
+    int32_t origin, put_seq, req, avail;
+    size_t len;
+
+    if (size)
+        *size = 0;
+
+    origin = __atomic_load_n(&hdr->origin, __ATOMIC_ACQUIRE);
+    put_seq = __atomic_load_n(&hdr->put_seq, __ATOMIC_ACQUIRE);
+    if (origin == SHM_NO_ORIGIN || put_seq == SHM_NO_ORIGIN) {
+        *p_frame_type = shm->prefetching ? JB_ZERO_PREFETCH_FRAME :
+                                           JB_ZERO_EMPTY_FRAME;
+        return;
+    }
+
+    /* The producer had to drop frames, skip the oldest ones to make room
+     * for the newest.
+     */
+    req = __atomic_load_n(&hdr->req_seq, __ATOMIC_ACQUIRE);
+    if (req - origin >= (int32_t)hdr->max_count)
+        origin = req - (int32_t)hdr->max_count + 1;
+
+    avail = put_seq - origin;
+    if (avail <= 0) {
+        /* Jitter buffer is empty */
+        shm->prefetching = (hdr->prefetch != 0);
+        *p_frame_type = JB_ZERO_EMPTY_FRAME;
+        __atomic_store_n(&hdr->origin, origin, __ATOMIC_RELEASE);
+        return;
+    }
+
+    if (shm->prefetching) {
+        if (avail < (int32_t)hdr->prefetch) {
+            *p_frame_type = JB_ZERO_PREFETCH_FRAME;
+            __atomic_store_n(&hdr->origin, origin, __ATOMIC_RELEASE);
+            return;
+        }
+        shm->prefetching = 0;
+    }
+
+    slot = shm_slot(shm, origin);
+    *p_frame_type = JB_MISSING_FRAME;
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == origin) {
+        len = slot->len;
+        memcpy(frame, slot + 1, len);
+        if (bit_info)
+            *bit_info = slot->bit_info;
+        if (ts)
+            *ts = slot->ts;
+
+        /* Check the producer didn't rewrite the slot meanwhile */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == origin) {
+            *p_frame_type = JB_NORMAL_FRAME;
+            if (size)
+                *size = len;
+        }
+    }
+
+    if (seq)
+        *seq = origin;
+
+    /* Hand the slot back to the producer */
+    __atomic_store_n(&hdr->origin, origin + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Wait until GET would return a frame other than a zero frame, for up to
+ * 'timeout' ms (negative to wait forever). Consumer side only. Returns 0
+ * when frames are available, or -1 on timeout.
+ */
+int jbuf_shm_wait(jbuf_shm_t *shm,
+                  int timeout)
+{
+    jbuf_shm_hdr *hdr = shm->hdr;
+    struct timespec ts, *pts = NULL;
+    long long deadline = 0, left;
+
+    /* FUTEX_WAIT takes a relative timeout, the retries after a spurious
+     * wakeup wait for what is left until the deadline only.
+     */
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        deadline = ts.tv_sec * 1000000000LL + ts.tv_nsec +
+                   timeout * 1000000LL;
+    }
+
+    for (;;) {
+        int32_t origin, put_seq, need;
+
+        __atomic_store_n(&hdr->waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        origin = __atomic_load_n(&hdr->origin, __ATOMIC_ACQUIRE);
+        put_seq = __atomic_load_n(&hdr->put_seq, __ATOMIC_ACQUIRE);
+        need = shm->prefetching ? (int32_t)hdr->prefetch : 1;
+        if (need == 0)
+            need = 1;
+
+        if (origin != SHM_NO_ORIGIN && put_seq != SHM_NO_ORIGIN &&
+            put_seq - origin >= need)
+        {
+            __atomic_store_n(&hdr->waiting, 0, __ATOMIC_RELEASE);
+            return 0;
+        }
+
+        if (timeout >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            left = deadline - (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+            if (left <= 0) {
+                __atomic_store_n(&hdr->waiting, 0, __ATOMIC_RELEASE);
+                return -1;
+            }
+            ts.tv_sec = left / 1000000000LL;
+            ts.tv_nsec = left % 1000000000LL;
+            pts = &ts;
+        }
+
+        if (shm_futex(&hdr->waiting, FUTEX_WAIT, 1, pts) < 0 &&
+            errno == ETIMEDOUT)
+        {
+            __atomic_store_n(&hdr->waiting, 0, __ATOMIC_RELEASE);
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef JTBUF_SHM_H
+#define JTBUF_SHM_H
+
+/**
+ * Jitter buffer shared between a producer process (network) and a
+ * consumer process (audio). The frames and the control state live in a
+ * shared memory mapping, PUT and GET are lock-free and don't make any
+ * system call. There must be only one producer and one consumer.
+ *
+ * The consumer may block until frames are available with
+ * jbuf_shm_wait(), the producer only makes a (futex) system call to wake
+ * it up when it is actually waiting.
+ *
+ * Unlike jbuf_t it is a plain ring: the prefetch given at creation is
+ * fixed (no adaptation to the burst level or the timing), there is no
+ * discard algorithm other than skipping the oldest frames when the ring
+ * is full, and there is no state or statistics API. The seqs may be
+ * negative, but must not reach INT_MIN, which marks an empty ring.
+ */
+
+typedef struct jbuf_shm jbuf_shm_t;
+
+extern int jbuf_shm_create(const char *,
+                           unsigned,
+                           unsigned,
+                           unsigned,
+                           jbuf_shm_t **);
+extern int jbuf_shm_attach(const char *, jbuf_shm_t **);
+extern int jbuf_shm_attach_fd(int, jbuf_shm_t **);
+extern int jbuf_shm_get_fd(jbuf_shm_t *);
+extern int jbuf_shm_destroy(jbuf_shm_t *);
+
+extern int jbuf_shm_put_frame(jbuf_shm_t *,
+                              const void *,
+                              size_t,
+                              uint32_t,
+                              int,
+                              uint32_t);
+extern void jbuf_shm_get_frame(jbuf_shm_t *,
+                               void *,
+                               size_t *,
+                               char *,
+                               uint32_t *,
+                               uint32_t *,
+                               int *);
+extern int jbuf_shm_wait(jbuf_shm_t *, int);
+
+#endif
@@ -0,0 +1,197 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "jtbuf.h"
+#include "jtdrift.h"
+
+/* Weight of the last buffer size in the smoothed size (1/n), the size
+ * moves by one frame around every GET with the jitter.
+ */
+#define DRIFT_LEVEL_WEIGHT               256
+
+/* Ratio correction per frame of smoothed size above the target, in ppm.
+ * One frame too many is played out in about 1 / (gain * 1e-6) frames.
+ */
+#define DRIFT_LEVEL_GAIN                 500
+
+struct jbuf_drift
+{
+    jbuf_t      *jb;            /**< the jitter buffer    */
+
+    /* Settings (consts) */
+    unsigned    samples;        /**< samples in a frame    */
+
+    /* States */
+    int16_t     *in;            /**< last sample of the previous frame
+                                     then the current frame    */
+    char        in_type;        /**< type of the current frame    */
+    uint64_t    pos;            /**< position in 'in', 32.32 fixed
+                                     point    */
+    double      level;          /**< smoothed buffer size, in frames    */
+    int         started;        /**< a frame has been played    */
+    jbuf_drift_state_t state;   /**< statistics    */
+};
+
+
+/* Get the next frame, the last sample of the current one is kept for the
+ * interpolation.
+ */
+static void drift_next(jbuf_drift_t *drift)
+{
+    size_t size = 0;
+    char type;
+
+    drift->in[0] = drift->in[drift->samples];
+    jbuf_get_frame2(drift->jb, drift->in + 1, &size, &type, NULL);
+    if (type != JB_NORMAL_FRAME)
+        memset(drift->in + 1, 0, drift->samples * sizeof(int16_t));
+    else if (size < drift->samples * sizeof(int16_t))
+        memset((char*)(drift->in + 1) + size, 0,
+               drift->samples * sizeof(int16_t) - size);
+
+    drift->in_type = type;
+    drift->state.consumed++;
+}
+
+
+/* Update the ratio from the drift estimation and the buffer size. */
+static void drift_update(jbuf_drift_t *drift)
+{
+    jbuf_drift_state_t *st = &drift->state;
+    jb_state_t state;
+    double ratio;
+
+    jbuf_get_state(drift->jb, &state);
+
+    if (!drift->started) {
+        drift->level = state.size;
+        drift->started = 1;
+    }
+    drift->level += (state.size - drift->level) / DRIFT_LEVEL_WEIGHT;
+
+    st->drift_ppm = state.drift_ppm;
+    /* The size is taken right after a GET, keep one frame of margin */
+    st->target = state.burst + 1;
+    st->level = (unsigned)(drift->level * 1000 + 0.5);
+
+    ratio = state.drift_ppm +
+            (drift->level - st->target) * DRIFT_LEVEL_GAIN;
+    if (ratio > JB_DRIFT_MAX_PPM)
+        ratio = JB_DRIFT_MAX_PPM;
+    else if (ratio < -JB_DRIFT_MAX_PPM)
+        ratio = -JB_DRIFT_MAX_PPM;
+    st->ratio_ppm = (int)ratio;
+}
+
+
+/*
+ * Create a drift compensating playout of the jitter buffer, which holds
+ * 16 bit mono PCM frames of 'samples_per_frame' samples.
+ */
+int jbuf_drift_create(jbuf_t *jb,
+                      unsigned samples_per_frame,
+                      jbuf_drift_t **p_drift)
+{
+    jbuf_drift_t *drift;
+    jb_state_t state;
+
+    if (!jb || !samples_per_frame || !p_drift ||
+        jbuf_get_state(jb, &state) != 0 ||
+        state.frame_size != samples_per_frame * sizeof(int16_t))
+    {
+        return -1;
+    }
+
+    drift = (jbuf_drift_t*)calloc(1, sizeof(jbuf_drift_t));
+    if (!drift)
+        return -1;
+
+    drift->in = (int16_t*)calloc(samples_per_frame + 1, sizeof(int16_t));
+    if (!drift->in) {
+        free(drift);
+        return -1;
+    }
+
+    drift->jb = jb;
+    drift->samples = samples_per_frame;
+
+    /* Start past the end, the first GET gets a frame */
+    drift->pos = (uint64_t)samples_per_frame << 32;
+    drift->in_type = JB_ZERO_EMPTY_FRAME;
+
+    jbuf_set_discard(jb, JB_DISCARD_NONE);
+
+    *p_drift = drift;
+
+    return 0;
+}
+
+
+int jbuf_drift_destroy(jbuf_drift_t *drift)
+{
+    if (!drift)
+        return -1;
+
+    free(drift->in);
+    free(drift);
+
+    return 0;
+}
+
+
+/*
+ * Play one frame of samples_per_frame samples. The frame type is normal
+ * if any sample comes from a normal frame, else it is the type of the
+ * last frame got.
+ */
+void jbuf_drift_get_frame(jbuf_drift_t *drift,
+                          int16_t *frame,
+                          char *p_frame_type)
+{
+    uint64_t n = (uint64_t)drift->samples << 32;
+    uint64_t step;
+    int normal = 0;
+    unsigned i;
+
+    drift_update(drift);
+
+    /* Input samples per output sample */
+    step = (uint64_t)((1 + drift->state.ratio_ppm * 1e-6) * 4294967296.0);
+
+    for (i = 0; i < drift->samples; ++i) {
+        unsigned idx;
+        int32_t frac;
+
+        while (drift->pos >= n) {
+            drift_next(drift);
+            drift->pos -= n;
+        }
+        normal |= (drift->in_type == JB_NORMAL_FRAME);
+
+        /* Linear interpolation between in[idx] and in[idx + 1], in[0]
+         * being the last sample of the previous frame
+         */
+        idx = (unsigned)(drift->pos >> 32);
+        frac = (int32_t)((drift->pos >> 16) & 0xffff);
+        frame[i] = (int16_t)((drift->in[idx] * (65536 - frac) +
+                              drift->in[idx + 1] * frac) >> 16);
+
+        drift->pos += step;
+    }
+
+    drift->state.played++;
+    *p_frame_type = normal ? JB_NORMAL_FRAME : drift->in_type;
+}
+
+
+int jbuf_drift_get_state(jbuf_drift_t *drift,
+                         jbuf_drift_state_t *state)
+{
+    if (!drift || !state)
+        return -1;
+
+    *state = drift->state;
+
+    return 0;
+}
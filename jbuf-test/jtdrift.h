@@ -0,0 +1,62 @@
+#ifndef JTDRIFT_H
+#define JTDRIFT_H
+
+/**
+ * Clock drift compensating playout on top of the jitter buffer.
+ *
+ * The sender and the playout device run on different clocks, so frames
+ * come in slightly faster or slower than they are played and the buffer
+ * slowly fills up or runs dry. Instead of letting the discard algorithm
+ * drop a frame from time to time, the playout stage resamples the frames
+ * (16 bit mono PCM) by a fractional ratio: it plays 'samples_per_frame'
+ * samples per GET while it consumes that many times (1 + ratio) from the
+ * jitter buffer.
+ *
+ * The ratio is the drift estimated by the jitter buffer (see drift_ppm in
+ * jb_state_t, frames must be put with jbuf_put_frame4()), corrected by
+ * the deviation of the smoothed buffer size from the jitter level plus
+ * one frame, so the buffer size stays flat even without an estimate. It
+ * is bounded to JB_DRIFT_MAX_PPM, which is far below what can be heard.
+ * The timing based adaptive algorithms give the most reliable jitter
+ * level to aim at.
+ *
+ * The playout stage takes over the latency control, so it disables the
+ * discard algorithm of the jitter buffer. It must be the only consumer
+ * of the jitter buffer.
+ */
+
+/**
+ * Bound of the resampling ratio, in ppm.
+ */
+#define JB_DRIFT_MAX_PPM        5000
+
+/**
+ * Playout state.
+ */
+typedef struct jbuf_drift_state
+{
+    int      drift_ppm;     /**< Drift estimated by the jitter buffer,
+                                 in ppm.    */
+    int      ratio_ppm;     /**< Resampling ratio applied, in ppm.    */
+    unsigned level;         /**< Smoothed buffer size, in 1/1000
+                                 frames.    */
+    unsigned target;        /**< Buffer size aimed at, in frames.    */
+    unsigned long played;   /**< Number of frames played.    */
+    unsigned long consumed; /**< Number of frames got from the jitter
+                                 buffer.    */
+
+} jbuf_drift_state_t;
+
+typedef struct jbuf_drift jbuf_drift_t;
+
+extern int jbuf_drift_create(jbuf_t *,
+                             unsigned,
+                             jbuf_drift_t **);
+
+extern int jbuf_drift_destroy(jbuf_drift_t *);
+
+extern void jbuf_drift_get_frame(jbuf_drift_t *, int16_t *, char *);
+
+extern int jbuf_drift_get_state(jbuf_drift_t *, jbuf_drift_state_t *);
+
+#endif
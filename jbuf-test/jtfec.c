@@ -0,0 +1,532 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "jtbuf.h"
+#include "jtfec.h"
+
+/* Media packets kept for the parity recovery, power of 2. */
+#define FEC_HISTORY                      64
+
+/* Parity packets kept while more than one of their packets is missing. */
+#define FEC_MAX_PARITY                   16
+
+/* Media packet of the history. */
+typedef struct fec_media
+{
+    int         seq;            /**< seq, valid if 'data' is set    */
+    uint32_t    ts;             /**< RTP timestamp    */
+    uint32_t    bit_info;       /**< bit info    */
+    unsigned    size;           /**< payload size    */
+    char        *data;          /**< payload, NULL if the slot is free   */
+
+} fec_media;
+
+/* Parity packet, parsed. */
+typedef struct fec_parity
+{
+    int         base;           /**< seq of the first packet protected  */
+    uint64_t    mask;           /**< packets protected, bit i is the
+                                     packet base + i    */
+    uint32_t    ts_rec;         /**< TS recovery    */
+    unsigned    len_rec;        /**< length recovery    */
+    unsigned    m_rec;          /**< marker recovery    */
+    unsigned    prot_len;       /**< bytes of the payloads protected   */
+    char        *data;          /**< parity of the payloads    */
+    int         used;           /**< the slot holds a parity packet    */
+
+} fec_parity;
+
+struct jbuf_fec
+{
+    jbuf_t      *jb;            /**< the jitter buffer    */
+
+    /* Settings (consts) */
+    unsigned    frame_size;     /**< max frame size, from the jitter
+                                     buffer    */
+    unsigned    ts_per_frame;   /**< timestamp units per frame    */
+
+    /* States */
+    int         last_seq;       /**< highest seq seen    */
+    int         started;        /**< a packet has been seen    */
+    fec_media   media[FEC_HISTORY];/**< history, by seq    */
+    fec_parity  parity[FEC_MAX_PARITY];/**< parity packets pending    */
+    unsigned    parity_next;    /**< slot replaced when all are used    */
+    char        *frame;         /**< buffer of the frame recovered    */
+    void        *mem;           /**< memory block of the buffers    */
+};
+
+
+/* dst ^= src */
+static void fec_xor(char *dst, const char *src, size_t len)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, b));
+    }
+#endif
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; ++i)
+        dst[i] ^= src[i];
+}
+
+
+static unsigned fec_get16(const uint8_t *p)
+{
+    return ((unsigned)p[0] << 8) | p[1];
+}
+
+static uint32_t fec_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void fec_set16(uint8_t *p, unsigned v)
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static void fec_set32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+
+/* Extend a 16 bit seq to the one nearest to the last seq seen. */
+static int fec_extend_seq(jbuf_fec_t *fec, unsigned seq16)
+{
+    if (!fec->started)
+        return (int)seq16;
+
+    return fec->last_seq + (int16_t)(seq16 - (fec->last_seq & 0xffff));
+}
+
+
+static fec_media *fec_find(jbuf_fec_t *fec, int seq)
+{
+    fec_media *m = &fec->media[seq & (FEC_HISTORY - 1)];
+
+    return (m->data && m->seq == seq) ? m : NULL;
+}
+
+
+/* Keep a media packet in the history. */
+static void fec_store(jbuf_fec_t *fec, const void *frame, size_t size,
+                      uint32_t bit_info, int seq, uint32_t ts)
+{
+    fec_media *m = &fec->media[seq & (FEC_HISTORY - 1)];
+
+    /* Don't replace a newer packet by an old one */
+    if (m->data && m->seq > seq)
+        return;
+
+    m->data = (char*)fec->mem + (size_t)(seq & (FEC_HISTORY - 1)) *
+                                fec->frame_size;
+    m->seq = seq;
+    m->ts = ts;
+    m->bit_info = bit_info;
+    m->size = (unsigned)(size < fec->frame_size ? size : fec->frame_size);
+    memcpy(m->data, frame, m->size);
+
+    if (!fec->started || seq > fec->last_seq) {
+        fec->last_seq = seq;
+        fec->started = 1;
+    }
+}
+
+
+/*
+ * Try to rebuild the single missing packet of a parity packet. Return 1
+ * when a frame is recovered, 0 when the parity packet must be kept, -1
+ * when it is useless (nothing missing, too many or too old).
+ */
+static int fec_recover(jbuf_fec_t *fec, fec_parity *p)
+{
+    uint32_t ts = p->ts_rec;
+    unsigned len = p->len_rec;
+    unsigned m = p->m_rec;
+    int missing = 0, seq = 0;
+    int origin;
+    unsigned i;
+
+    for (i = 0; i < JB_FEC_MAX_PROTECTED; ++i) {
+        if (!(p->mask & (1ULL << i)) || fec_find(fec, p->base + (int)i))
+            continue;
+        if (p->base + (int)i <= fec->last_seq - FEC_HISTORY)
+            return -1;
+        if (++missing > 1)
+            return 0;
+        seq = p->base + (int)i;
+    }
+    if (!missing)
+        return -1;
+
+    /* Already played */
+    if (jbuf_get_origin(fec->jb, &origin) == 0 && seq < origin)
+        return -1;
+
+    memcpy(fec->frame, p->data, p->prot_len);
+    for (i = 0; i < JB_FEC_MAX_PROTECTED; ++i) {
+        fec_media *media;
+
+        if (!(p->mask & (1ULL << i)) || p->base + (int)i == seq)
+            continue;
+
+        media = fec_find(fec, p->base + (int)i);
+        ts ^= media->ts;
+        len ^= media->size;
+        m ^= media->bit_info & 1;
+        fec_xor(fec->frame, media->data,
+                media->size < p->prot_len ? media->size : p->prot_len);
+    }
+
+    /* The bytes beyond the protection length can't be rebuilt */
+    if (len > p->prot_len)
+        return -1;
+
+    fec_store(fec, fec->frame, len, m, seq, ts);
+    jbuf_put_recovered(fec->jb, fec->frame, len, m, seq, ts);
+
+    return 1;
+}
+
+
+/* Rebuild what the pending parity packets allow, each recovered packet
+ * may complete another parity packet.
+ */
+static void fec_recover_all(jbuf_fec_t *fec)
+{
+    int progress = 1;
+    unsigned i;
+
+    while (progress) {
+        progress = 0;
+        for (i = 0; i < FEC_MAX_PARITY; ++i) {
+            fec_parity *p = &fec->parity[i];
+            int rc;
+
+            if (!p->used)
+                continue;
+
+            rc = fec_recover(fec, p);
+            if (rc != 0)
+                p->used = 0;
+            if (rc > 0)
+                progress = 1;
+        }
+    }
+}
+
+
+/*
+ * Create the FEC stage of the jitter buffer. The timestamp units per
+ * frame tell the seqs of the RED blocks from their timestamp offset.
+ */
+int jbuf_fec_create(jbuf_t *jb,
+                    unsigned ts_per_frame,
+                    jbuf_fec_t **p_fec)
+{
+    jbuf_fec_t *fec;
+    jb_state_t state;
+    unsigned i;
+
+    if (!jb || !ts_per_frame || !p_fec || jbuf_get_state(jb, &state) != 0)
+        return -1;
+
+    fec = (jbuf_fec_t*)calloc(1, sizeof(jbuf_fec_t));
+    if (!fec)
+        return -1;
+
+    fec->jb = jb;
+    fec->frame_size = state.frame_size;
+    fec->ts_per_frame = ts_per_frame;
+
+    /* history, parity packets and the frame recovered */
+    fec->mem = malloc((size_t)state.frame_size *
+                      (FEC_HISTORY + FEC_MAX_PARITY + 1));
+    if (!fec->mem) {
+        free(fec);
+        return -1;
+    }
+
+    for (i = 0; i < FEC_MAX_PARITY; ++i)
+        fec->parity[i].data = (char*)fec->mem +
+                              (size_t)(FEC_HISTORY + i) * state.frame_size;
+    fec->frame = (char*)fec->mem +
+                 (size_t)(FEC_HISTORY + FEC_MAX_PARITY) * state.frame_size;
+
+    *p_fec = fec;
+
+    return 0;
+}
+
+
+int jbuf_fec_destroy(jbuf_fec_t *fec)
+{
+    if (!fec)
+        return -1;
+
+    free(fec->mem);
+    free(fec);
+
+    return 0;
+}
+
+
+/*
+ * Put a media packet, like jbuf_put_frame3(). It is kept for the parity
+ * recovery.
+ */
+void jbuf_fec_put_media(jbuf_fec_t *fec,
+                        const void *frame,
+                        size_t frame_size,
+                        uint32_t bit_info,
+                        int frame_seq,
+                        uint32_t ts,
+                        int *discarded)
+{
+    jbuf_put_frame3(fec->jb, frame, frame_size, bit_info, frame_seq, ts,
+                    discarded);
+    fec_store(fec, frame, frame_size, bit_info, frame_seq, ts);
+    fec_recover_all(fec);
+}
+
+
+/*
+ * Put a RED (RFC 2198) payload: the primary block is put as the frame
+ * 'frame_seq', the redundant blocks recover the older frames missing.
+ * Return the number of redundant blocks, -1 if the payload is malformed.
+ */
+int jbuf_fec_put_red(jbuf_fec_t *fec,
+                     const void *payload,
+                     size_t size,
+                     uint32_t bit_info,
+                     int frame_seq,
+                     uint32_t ts,
+                     int *discarded)
+{
+    const uint8_t *p = (const uint8_t*)payload;
+    const uint8_t *hdr = p;
+    const uint8_t *data;
+    size_t offset = 0;
+    unsigned count = 0;
+    unsigned i;
+
+    /* Block headers, the last one is a single byte */
+    while (1) {
+        if (offset >= size)
+            return -1;
+        if (!(p[offset] & 0x80)) {
+            offset++;
+            break;
+        }
+        if (offset + 4 > size)
+            return -1;
+        offset += 4;
+        count++;
+    }
+
+    /* Primary block first, the redundant ones fill the gaps it makes */
+    data = p + offset;
+    for (i = 0; i < count; ++i) {
+        unsigned len = fec_get16(hdr + 4 * i + 2) & 0x3ff;
+
+        if (data + len > p + size)
+            return -1;
+        data += len;
+    }
+    jbuf_fec_put_media(fec, data, p + size - data, bit_info, frame_seq, ts,
+                       discarded);
+
+    data = p + offset;
+    for (i = 0; i < count; ++i) {
+        uint32_t ts_off = (uint32_t)((fec_get16(hdr + 4 * i + 1) >> 2) &
+                                     0x3fff);
+        unsigned len = fec_get16(hdr + 4 * i + 2) & 0x3ff;
+        int seq;
+
+        /* The block must be a whole number of frames back */
+        if (len && ts_off && ts_off % fec->ts_per_frame == 0) {
+            seq = frame_seq - (int)(ts_off / fec->ts_per_frame);
+            if (!fec_find(fec, seq)) {
+                fec_store(fec, data, len, 0, seq, ts - ts_off);
+                jbuf_put_recovered(fec->jb, data, len, 0, seq, ts - ts_off);
+            }
+        }
+        data += len;
+    }
+
+    if (count)
+        fec_recover_all(fec);
+
+    return (int)count;
+}
+
+
+/*
+ * Put a parity packet (RFC 5109 payload, after the RTP header). Return
+ * the number of frames recovered at once, -1 if the packet is malformed.
+ */
+int jbuf_fec_put_parity(jbuf_fec_t *fec,
+                        const void *payload,
+                        size_t size)
+{
+    const uint8_t *p = (const uint8_t*)payload;
+    unsigned hdr_size;
+    fec_parity parity, *slot = NULL;
+    char *data;
+    uint64_t mask;
+    int rc;
+    unsigned i;
+
+    if (size < JB_FEC_HDR_SIZE)
+        return -1;
+
+    hdr_size = (p[0] & 0x40) ? JB_FEC_HDR_SIZE_LONG : JB_FEC_HDR_SIZE;
+    if (size < hdr_size)
+        return -1;
+
+    /* Parsed aside, a slot is only taken by a packet kept pending */
+    parity.base = fec_extend_seq(fec, fec_get16(p + 2));
+    parity.ts_rec = fec_get32(p + 4);
+    parity.len_rec = fec_get16(p + 8);
+    parity.m_rec = p[1] >> 7;
+    parity.prot_len = fec_get16(p + 10);
+    mask = (uint64_t)fec_get16(p + 12) << 32;
+    if (hdr_size == JB_FEC_HDR_SIZE_LONG)
+        mask |= fec_get32(p + 14);
+
+    /* The mask is MSB first: bit 47 is the base packet */
+    parity.mask = 0;
+    for (i = 0; i < JB_FEC_MAX_PROTECTED; ++i)
+        if (mask & (1ULL << (JB_FEC_MAX_PROTECTED - 1 - i)))
+            parity.mask |= 1ULL << i;
+
+    if (size - hdr_size < parity.prot_len)
+        return -1;
+    if (parity.prot_len > fec->frame_size)
+        parity.prot_len = fec->frame_size;
+    parity.data = (char*)(p + hdr_size);
+    parity.used = 0;
+
+    rc = fec_recover(fec, &parity);
+    if (rc < 0)
+        return 0;
+    if (rc == 0) {
+        for (i = 0; i < FEC_MAX_PARITY; ++i) {
+            if (!fec->parity[i].used) {
+                slot = &fec->parity[i];
+                break;
+            }
+        }
+        if (!slot) {
+            slot = &fec->parity[fec->parity_next];
+            fec->parity_next = (fec->parity_next + 1) % FEC_MAX_PARITY;
+        }
+
+        data = slot->data;
+        memcpy(data, parity.data, parity.prot_len);
+        *slot = parity;
+        slot->data = data;
+        slot->used = 1;
+        return 0;
+    }
+
+    fec_recover_all(fec);
+
+    return 1;
+}
+
+
+/*
+ * Make the parity packet (RFC 5109 payload) of 'count' media packets of
+ * consecutive seqs from 'base_seq', for a sender or a test tool. '*size'
+ * is the size of 'packet' in, the size of the parity packet out. Return
+ * 0, or -1 if 'packet' is too small.
+ */
+int jbuf_fec_make_parity(const void * const *frames,
+                         const size_t *sizes,
+                         const uint32_t *bit_infos,
+                         const uint32_t *ts,
+                         int base_seq,
+                         unsigned count,
+                         void *packet,
+                         size_t *size)
+{
+    uint8_t *p = (uint8_t*)packet;
+    unsigned hdr_size;
+    size_t prot_len = 0;
+    uint32_t ts_rec = 0;
+    unsigned len_rec = 0, m_rec = 0;
+    uint64_t mask;
+    unsigned i;
+
+    if (!frames || !sizes || !ts || !count ||
+        count > JB_FEC_MAX_PROTECTED || !packet || !size)
+    {
+        return -1;
+    }
+
+    hdr_size = count > 16 ? JB_FEC_HDR_SIZE_LONG : JB_FEC_HDR_SIZE;
+    for (i = 0; i < count; ++i) {
+        if (sizes[i] > 0xffff)
+            return -1;
+        if (sizes[i] > prot_len)
+            prot_len = sizes[i];
+    }
+    if (*size < hdr_size + prot_len)
+        return -1;
+
+    memset(p + hdr_size, 0, prot_len);
+    for (i = 0; i < count; ++i) {
+        fec_xor((char*)p + hdr_size, (const char*)frames[i], sizes[i]);
+        ts_rec ^= ts[i];
+        len_rec ^= (unsigned)sizes[i];
+        if (bit_infos)
+            m_rec ^= bit_infos[i] & 1;
+    }
+
+    mask = ((1ULL << count) - 1) << (JB_FEC_MAX_PROTECTED - count);
+
+    p[0] = hdr_size == JB_FEC_HDR_SIZE_LONG ? 0x40 : 0;
+    p[1] = (uint8_t)(m_rec << 7);
+    fec_set16(p + 2, (unsigned)base_seq & 0xffff);
+    fec_set32(p + 4, ts_rec);
+    fec_set16(p + 8, len_rec);
+    fec_set16(p + 10, (unsigned)prot_len);
+    fec_set16(p + 12, (unsigned)(mask >> 32));
+    if (hdr_size == JB_FEC_HDR_SIZE_LONG)
+        fec_set32(p + 14, (uint32_t)mask);
+
+    *size = hdr_size + prot_len;
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef JTFEC_H
+#define JTFEC_H
+
+/**
+ * Forward error correction stage ahead of the jitter buffer.
+ *
+ * The stage sits between the packet ingest and the jitter buffer: media
+ * packets are put through it instead of jbuf_put_frame3(), and it
+ * recovers the missing frames from two kinds of redundancy:
+ *
+ *  - RFC 2198 redundant audio (RED): the payload carries the primary
+ *    frame and older frames, whose seqs are told by their timestamp
+ *    offset;
+ *  - XOR parity (RFC 5109 ULPFEC, protection level 0 only): a parity
+ *    packet is the XOR of up to 48 media packets, any single one of them
+ *    can be rebuilt from the parity and the others.
+ *
+ * Recovered frames go straight into their slot of the jitter buffer as
+ * long as it hasn't been played (see jbuf_put_recovered()), and they are
+ * counted in the 'recovered' field of jb_state_t. Bit 0 of the bit info
+ * is carried as the RTP marker bit of the parity packets, the other bits
+ * of a recovered frame are 0.
+ */
+
+/**
+ * Max number of media packets protected by a parity packet.
+ */
+#define JB_FEC_MAX_PROTECTED    48
+
+/**
+ * Size of the FEC header and level 0 header of a parity packet, short
+ * mask (up to 16 packets protected) or long mask.
+ */
+#define JB_FEC_HDR_SIZE         14
+#define JB_FEC_HDR_SIZE_LONG    18
+
+typedef struct jbuf_fec jbuf_fec_t;
+
+extern int jbuf_fec_create(jbuf_t *,
+                           unsigned,
+                           jbuf_fec_t **);
+
+extern int jbuf_fec_destroy(jbuf_fec_t *);
+
+extern void jbuf_fec_put_media(jbuf_fec_t *,
+                               const void *,
+                               size_t,
+                               uint32_t,
+                               int,
+                               uint32_t,
+                               int *);
+
+extern int jbuf_fec_put_red(jbuf_fec_t *,
+                            const void *,
+                            size_t,
+                            uint32_t,
+                            int,
+                            uint32_t,
+                            int *);
+
+extern int jbuf_fec_put_parity(jbuf_fec_t *, const void *, size_t);
+
+extern int jbuf_fec_make_parity(const void * const *,
+                                const size_t *,
+                                const uint32_t *,
+                                const uint32_t *,
+                                int,
+                                unsigned,
+                                void *,
+                                size_t *);
+
+#endif
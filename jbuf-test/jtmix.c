@@ -0,0 +1,286 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "jtbuf.h"
+#include "jtmix.h"
+
+/* Alignment of the sample buffers, enough for AVX2 loads. */
+#define MIX_ALIGN                        32
+
+typedef struct mix_member
+{
+    jbuf_t      *jb;            /**< jitter buffer, NULL if the slot is
+                                     free    */
+    int16_t     *frame;         /**< frame got on the last tick    */
+    int16_t     *mix;           /**< mix of the others    */
+    int         active;         /**< the last frame is a normal frame   */
+
+} mix_member;
+
+struct jbuf_mixer
+{
+    /* Settings (consts) */
+    unsigned    samples_per_frame;/**< samples in a frame    */
+    unsigned    samples;        /**< samples_per_frame rounded up to the
+                                     SIMD width    */
+    unsigned    max_members;    /**< number of member slots    */
+
+    /* Buffers */
+    mix_member  *member;        /**< member slots    */
+    int32_t     *acc;           /**< sum of the active frames    */
+    int16_t     *mix_all;       /**< mix of all the active frames, got
+                                     by the inactive members    */
+    void        *mem;           /**< memory block of the sample buffers */
+};
+
+
+/* Add the samples to the 32 bit accumulator. */
+static void mix_add(int32_t *acc, const int16_t *x, unsigned len)
+{
+    unsigned i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 16 <= len; i += 16) {
+        __m256i v = _mm256_load_si256((const __m256i*)(x + i));
+        __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+
+        _mm256_store_si256((__m256i*)(acc + i),
+            _mm256_add_epi32(_mm256_load_si256((__m256i*)(acc + i)), lo));
+        _mm256_store_si256((__m256i*)(acc + i + 8),
+            _mm256_add_epi32(_mm256_load_si256((__m256i*)(acc + i + 8)), hi));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_load_si128((const __m128i*)(x + i));
+        /* Sign extend: the sample in the high half, shifted down */
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+        _mm_store_si128((__m128i*)(acc + i),
+            _mm_add_epi32(_mm_load_si128((__m128i*)(acc + i)), lo));
+        _mm_store_si128((__m128i*)(acc + i + 4),
+            _mm_add_epi32(_mm_load_si128((__m128i*)(acc + i + 4)), hi));
+    }
+#endif
+
+    for (; i < len; ++i)
+        acc[i] += x[i];
+}
+
+
+/* Saturate the accumulator minus the samples (if any) to 16 bit. */
+static void mix_pack(int16_t *out, const int32_t *acc, const int16_t *x,
+                     unsigned len)
+{
+    unsigned i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 16 <= len; i += 16) {
+        __m256i a0 = _mm256_load_si256((const __m256i*)(acc + i));
+        __m256i a1 = _mm256_load_si256((const __m256i*)(acc + i + 8));
+
+        if (x) {
+            __m256i v = _mm256_load_si256((const __m256i*)(x + i));
+
+            a0 = _mm256_sub_epi32(a0,
+                     _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)));
+            a1 = _mm256_sub_epi32(a1,
+                     _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)));
+        }
+        /* packs works per 128 bit lane, put the quadwords back in order */
+        _mm256_store_si256((__m256i*)(out + i),
+            _mm256_permute4x64_epi64(_mm256_packs_epi32(a0, a1), 0xd8));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= len; i += 8) {
+        __m128i a0 = _mm_load_si128((const __m128i*)(acc + i));
+        __m128i a1 = _mm_load_si128((const __m128i*)(acc + i + 4));
+
+        if (x) {
+            __m128i v = _mm_load_si128((const __m128i*)(x + i));
+
+            a0 = _mm_sub_epi32(a0, _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+            a1 = _mm_sub_epi32(a1, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        }
+        _mm_store_si128((__m128i*)(out + i), _mm_packs_epi32(a0, a1));
+    }
+#endif
+
+    for (; i < len; ++i) {
+        int32_t s = acc[i] - (x ? x[i] : 0);
+
+        out[i] = (int16_t)(s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+    }
+}
+
+
+/*
+ * Create a mixer of up to 'max_members' participants, whose jitter
+ * buffers hold 16 bit mono PCM frames of 'samples_per_frame' samples.
+ */
+int jbuf_mixer_create(unsigned samples_per_frame,
+                      unsigned max_members,
+                      jbuf_mixer_t **p_mixer)
+{
+    jbuf_mixer_t *mixer;
+    unsigned samples;
+    char *p;
+    unsigned i;
+
+    if (!samples_per_frame || !max_members || !p_mixer)
+        return -1;
+
+    mixer = (jbuf_mixer_t*)calloc(1, sizeof(jbuf_mixer_t));
+    if (!mixer)
+        return -1;
+
+    samples = (samples_per_frame + MIX_ALIGN / 2 - 1) & ~(MIX_ALIGN / 2 - 1);
+    mixer->samples_per_frame = samples_per_frame;
+    mixer->samples = samples;
+    mixer->max_members = max_members;
+
+    mixer->member = (mix_member*)calloc(max_members, sizeof(mix_member));
+    /* accumulator, mix of all and two buffers per member */
+    if (!mixer->member ||
+        posix_memalign(&mixer->mem, MIX_ALIGN,
+                       samples * (sizeof(int32_t) + sizeof(int16_t) +
+                                  2 * max_members * sizeof(int16_t))))
+    {
+        free(mixer->member);
+        free(mixer);
+        return -1;
+    }
+
+    p = (char*)mixer->mem;
+    mixer->acc = (int32_t*)p;
+    p += samples * sizeof(int32_t);
+    mixer->mix_all = (int16_t*)p;
+    p += samples * sizeof(int16_t);
+    for (i = 0; i < max_members; ++i) {
+        mixer->member[i].frame = (int16_t*)p;
+        p += samples * sizeof(int16_t);
+        mixer->member[i].mix = (int16_t*)p;
+        p += samples * sizeof(int16_t);
+    }
+
+    /* The padding samples are never mixed, keep them silent */
+    memset(mixer->mem, 0, p - (char*)mixer->mem);
+
+    *p_mixer = mixer;
+
+    return 0;
+}
+
+
+int jbuf_mixer_destroy(jbuf_mixer_t *mixer)
+{
+    if (!mixer)
+        return -1;
+
+    free(mixer->mem);
+    free(mixer->member);
+    free(mixer);
+
+    return 0;
+}
+
+
+/*
+ * Add a participant, return its slot in the mixer or -1 when the mixer
+ * is full. The jitter buffer frame size must be samples_per_frame 16 bit
+ * samples.
+ */
+int jbuf_mixer_add(jbuf_mixer_t *mixer, jbuf_t *jb)
+{
+    jb_state_t state;
+    unsigned i;
+
+    if (!mixer || !jb || jbuf_get_state(jb, &state) != 0 ||
+        state.frame_size != mixer->samples_per_frame * sizeof(int16_t))
+    {
+        return -1;
+    }
+
+    for (i = 0; i < mixer->max_members; ++i) {
+        if (!mixer->member[i].jb) {
+            mixer->member[i].jb = jb;
+            mixer->member[i].active = 0;
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+
+int jbuf_mixer_remove(jbuf_mixer_t *mixer, int slot)
+{
+    if (!mixer || slot < 0 || (unsigned)slot >= mixer->max_members)
+        return -1;
+
+    mixer->member[slot].jb = NULL;
+    mixer->member[slot].active = 0;
+
+    return 0;
+}
+
+
+/*
+ * Get one frame from every participant and make the mixes, to be called
+ * once per ptime. Return the number of active participants.
+ */
+unsigned jbuf_mixer_mix(jbuf_mixer_t *mixer)
+{
+    unsigned n = mixer->samples_per_frame;
+    unsigned i, active = 0;
+
+    memset(mixer->acc, 0, mixer->samples * sizeof(int32_t));
+
+    for (i = 0; i < mixer->max_members; ++i) {
+        mix_member *m = &mixer->member[i];
+        char type;
+
+        if (!m->jb)
+            continue;
+
+        /* Frames other than normal ones are silence, don't mix them */
+        jbuf_get_frame2(m->jb, m->frame, NULL, &type, NULL);
+        m->active = (type == JB_NORMAL_FRAME);
+        if (m->active) {
+            mix_add(mixer->acc, m->frame, n);
+            active++;
+        }
+    }
+
+    mix_pack(mixer->mix_all, mixer->acc, NULL, n);
+
+    for (i = 0; i < mixer->max_members; ++i) {
+        mix_member *m = &mixer->member[i];
+
+        if (m->active)
+            mix_pack(m->mix, mixer->acc, m->frame, n);
+    }
+
+    return active;
+}
+
+
+/*
+ * Get the mix of all the other participants made on the last tick.
+ */
+const int16_t *jbuf_mixer_get_mix(jbuf_mixer_t *mixer, int slot)
+{
+    if (!mixer || slot < 0 || (unsigned)slot >= mixer->max_members ||
+        !mixer->member[slot].jb)
+    {
+        return NULL;
+    }
+
+    return mixer->member[slot].active ? mixer->member[slot].mix :
+                                        mixer->mix_all;
+}
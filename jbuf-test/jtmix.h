@@ -0,0 +1,36 @@
+#ifndef JTMIX_H
+#define JTMIX_H
+
+/**
+ * Conference mixer on top of the jitter buffers of the participants.
+ *
+ * On every tick the mixer gets one frame of 16 bit mono PCM from the
+ * jitter buffer of each participant and makes, for each of them, the mix
+ * of all the others (N - 1 mix). Frames which are not normal frames are
+ * silence and are not mixed; with the voice activity detection of the
+ * jitter buffers enabled (jbuf_set_vad()), the frames of the silent
+ * participants are neither copied nor mixed.
+ *
+ * The active frames are summed once in 32 bit, each N - 1 mix is the sum
+ * minus the own frame of the participant, saturated back to 16 bit, and
+ * all the participants without an active frame share the same mix. The
+ * cost is then linear in the number of active participants.
+ */
+
+typedef struct jbuf_mixer jbuf_mixer_t;
+
+extern int jbuf_mixer_create(unsigned,
+                             unsigned,
+                             jbuf_mixer_t **);
+
+extern int jbuf_mixer_destroy(jbuf_mixer_t *);
+
+extern int jbuf_mixer_add(jbuf_mixer_t *, jbuf_t *);
+
+extern int jbuf_mixer_remove(jbuf_mixer_t *, int);
+
+extern unsigned jbuf_mixer_mix(jbuf_mixer_t *);
+
+extern const int16_t *jbuf_mixer_get_mix(jbuf_mixer_t *, int);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "eloop.h"
+#include "jtbuf.h"
+#include "jtplay.h"
+
+struct tag_playout
+{
+  eloop_t *loop; //loop the playout runs on
+  jbuf_t *jb; //the jitter buffer played
+  event_t *ready; //readiness event of jb
+  event_t *timer; //ptime timer
+  unsigned ptime; //frame duration(ms)
+  unsigned frame_size; //frame size(bytes)
+  long next; //expected time of next frame(ms)
+  int parked; //timer is parked
+  char *frame; //frame buffer
+  playout_cb_t proc; //callback function
+  void *arg; //point to user data
+};
+
+static void play(jbuf_playout_t *po)
+{
+  size_t size = 0;
+  char type;
+  long now, delay;
+
+  jbuf_get_frame2(po->jb, po->frame, &size, &type, NULL);
+  if (type != JB_NORMAL_FRAME) {
+    memset(po->frame, 0, po->frame_size);
+  }
+  po->proc(po, po->frame, size, type, po->arg);
+
+  //nothing to play until jb notifies us, park the timer
+  if (type == JB_ZERO_PREFETCH_FRAME || type == JB_ZERO_EMPTY_FRAME) {
+    if (!po->parked) {
+      e_event_del(po->loop, po->timer);
+      po->parked = 1;
+    }
+    return;
+  }
+
+  //schedule next frame on the ptime grid rather than after the callback,
+  //so callback latency doesn't accumulate
+  now = e_loop_now(po->loop);
+  po->next += po->ptime;
+  delay = po->next - now;
+  if (delay < 0 || delay > (long)po->ptime) {
+    //far behind (or clock jump), restart the clock
+    po->next = now + po->ptime;
+    delay = po->ptime;
+  }
+
+  e_event_mod(po->loop, po->timer, delay);
+  if (po->parked) {
+    e_event_add(po->loop, po->timer);
+    po->parked = 0;
+  }
+}
+
+static void ready_proc(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  jbuf_playout_t *po = (jbuf_playout_t*) arg;
+  uint64_t cnt;
+
+  //clear the eventfd counter
+  if (read(fd, &cnt, sizeof(cnt)) < 0) {
+    return;
+  }
+
+  //prefetch completed or frame available, play right now
+  if (po->parked) {
+    po->next = e_loop_now(loop);
+    play(po);
+  }
+}
+
+static void timer_proc(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  play((jbuf_playout_t*) arg);
+}
+
+jbuf_playout_t* jbuf_playout_new(eloop_t *loop, jbuf_t *jb, playout_cb_t fn, void *arg)
+{
+  jbuf_playout_t *po;
+  jb_state_t state;
+  int fd;
+
+  if (jbuf_get_state(jb, &state) < 0 || (fd = jbuf_get_event_fd(jb)) < 0) {
+    printf("params error\n");
+    return NULL;
+  }
+
+  po = malloc(sizeof(jbuf_playout_t));
+  if (po == NULL) {
+    printf("malloc error\n");
+    return NULL;
+  }
+
+  memset(po,0,sizeof(jbuf_playout_t));
+  po->loop = loop;
+  po->jb = jb;
+  po->ptime = state.ptime;
+  po->frame_size = state.frame_size;
+  po->proc = fn;
+  po->arg = arg;
+  po->parked = 1;
+  po->frame = malloc(state.frame_size);
+  po->ready = e_event_new(E_READ, fd, ready_proc, po);
+  po->timer = e_event_new(E_TIMER, po->ptime, timer_proc, po);
+  if (po->frame == NULL || po->ready == NULL || po->timer == NULL) {
+    printf("malloc error\n");
+    if (po->ready) e_event_free(po->ready);
+    if (po->timer) e_event_free(po->timer);
+    free(po->frame);
+    free(po);
+    return NULL;
+  }
+
+  //timer is parked until jb has frames to play
+  e_event_add(loop, po->ready);
+  return po;
+}
+
+void jbuf_playout_free(jbuf_playout_t *po)
+{
+  e_event_del(po->loop, po->ready);
+  e_event_free(po->ready);
+
+  if (!po->parked) {
+    e_event_del(po->loop, po->timer);
+  }
+  e_event_free(po->timer);
+
+  free(po->frame);
+  free(po);
+}
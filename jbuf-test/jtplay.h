@@ -0,0 +1,33 @@
+#ifndef __JTPLAY__
+#define __JTPLAY__
+
+/*
+handle of a jitter buffer playout, it plays the frames of a jitter buffer
+on an eloop, one frame per ptime, and parks its timer while the jitter
+buffer is prefetching or empty, so idle streams don't wake the loop up
+*/
+typedef struct tag_playout jbuf_playout_t;
+
+/*
+callback function for played frames
+@po: the playout
+@frame: the frame content, zeroed when the frame is not a normal frame
+@size: the frame length
+@frame_type: the frame type, see jb_frame_type_t; a zero frame is played
+             only once, then the playout is parked until frames are available
+@arg: the extra data for the playout
+*/
+typedef void (*playout_cb_t)(jbuf_playout_t *po,const void *frame,size_t size,
+                             char frame_type,void *arg);
+
+/*
+create a playout of jb on loop,the loop must be run by the calling thread
+*/
+jbuf_playout_t* jbuf_playout_new(eloop_t *loop,jbuf_t *jb,playout_cb_t fn,void *arg);
+
+/*
+free a playout,this does not destroy the jitter buffer
+*/
+void jbuf_playout_free(jbuf_playout_t *po);
+
+#endif//__JTPLAY__
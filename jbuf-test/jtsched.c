@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "jtbuf.h"
+#include "jtsched.h"
+
+//ticks a core waits between two rebalancings, so the utilization of
+//both cores has settled
+#define REBALANCE_TICKS 50
+
+//weight of the last tick in the smoothed utilization(1/n)
+#define UTIL_WEIGHT 16
+
+typedef struct tag_core core_t;
+
+struct tag_sched_stream
+{
+  jbuf_sched_t *sched; //scheduler playing it
+  jbuf_t *jb; //the jitter buffer played
+  unsigned frame_size; //frame size(bytes)
+  sched_cb_t proc; //callback function
+  void *arg; //point to user data
+  int removed; //set by jbuf_sched_remove
+  jbuf_stream_t *next; //link in an inbox
+};
+
+struct tag_core
+{
+  jbuf_sched_t *sched;
+  int index; //core index
+  pthread_t thread;
+  int started; //thread is started
+
+  //owned by the core thread
+  jbuf_stream_t **streams; //streams played
+  unsigned count; //number of streams
+  unsigned size; //size of streams array
+  char *frame; //frame buffer
+  unsigned frame_size; //size of frame buffer
+  unsigned long rebalanced; //tick of the last rebalancing
+
+  //streams handed over to the core, pushed by any thread
+  jbuf_stream_t *inbox;
+
+  //metrics, written by the core thread only
+  unsigned nstreams;
+  unsigned long ticks;
+  unsigned long overruns;
+  unsigned long late_sum; //sum of lateness(ns)
+  unsigned long late_max; //max lateness(ns)
+  unsigned long util; //smoothed utilization(ppm)
+  unsigned long migrated;
+};
+
+struct tag_sched
+{
+  core_t *cores;
+  int ncore;
+  unsigned ptime; //frame duration(ms)
+  unsigned long max_util; //rebalancing threshold(ppm), 0 if disabled
+  long long epoch; //time of tick 0(ns), shared by all cores
+  int stop; //tell the threads to exit
+};
+
+static long long now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t hash(uint32_t key)
+{
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  return key;
+}
+
+static void inbox_push(core_t *core, jbuf_stream_t *st)
+{
+  jbuf_stream_t *head = __atomic_load_n(&core->inbox, __ATOMIC_RELAXED);
+
+  do {
+    st->next = head;
+  } while (!__atomic_compare_exchange_n(&core->inbox, &head, st, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//the stream is no longer played, tell the application and free it
+static void drop(jbuf_stream_t *st)
+{
+  st->proc(st, NULL, 0, JB_ZERO_EMPTY_FRAME, st->arg);
+  free(st);
+}
+
+//take the streams handed over to the core
+static void inbox_drain(core_t *core)
+{
+  jbuf_stream_t *st, *next;
+  void *p;
+
+  st = __atomic_exchange_n(&core->inbox, NULL, __ATOMIC_ACQUIRE);
+  for (; st != NULL; st = next) {
+    next = st->next;
+
+    if (__atomic_load_n(&st->removed, __ATOMIC_ACQUIRE)) {
+      drop(st);
+      continue;
+    }
+
+    if (core->count == core->size) {
+      p = realloc(core->streams, (core->size ? core->size * 2 : 64) * sizeof(st));
+      if (p == NULL) {
+        //keep it for the next tick
+        inbox_push(core, st);
+        continue;
+      }
+      core->streams = p;
+      core->size = core->size ? core->size * 2 : 64;
+    }
+
+    if (st->frame_size > core->frame_size) {
+      p = realloc(core->frame, st->frame_size);
+      if (p == NULL) {
+        inbox_push(core, st);
+        continue;
+      }
+      core->frame = p;
+      core->frame_size = st->frame_size;
+    }
+
+    core->streams[core->count++] = st;
+  }
+}
+
+//play one frame of every stream
+static void tick(core_t *core)
+{
+  jbuf_stream_t *st;
+  size_t size;
+  char type;
+  unsigned i;
+
+  for (i = 0; i < core->count; ) {
+    st = core->streams[i];
+
+    if (__atomic_load_n(&st->removed, __ATOMIC_ACQUIRE)) {
+      core->streams[i] = core->streams[--core->count];
+      drop(st);
+      continue;
+    }
+
+    size = 0;
+    jbuf_get_frame2(st->jb, core->frame, &size, &type, NULL);
+    if (type != JB_NORMAL_FRAME) {
+      memset(core->frame, 0, st->frame_size);
+    }
+    st->proc(st, core->frame, size, type, st->arg);
+    i++;
+  }
+}
+
+//move part of the streams of a saturated core to the least loaded one
+static void rebalance(core_t *core)
+{
+  jbuf_sched_t *sched = core->sched;
+  unsigned long util, min_util = (unsigned long)-1;
+  core_t *target = NULL;
+  unsigned move;
+  int i;
+
+  //one stream is kept, the util may still be high from streams gone
+  if (!sched->max_util || core->util <= sched->max_util ||
+      core->ticks - core->rebalanced < REBALANCE_TICKS || core->count < 2) {
+    return;
+  }
+
+  for (i = 0; i < sched->ncore; i++) {
+    if (&sched->cores[i] == core) {
+      continue;
+    }
+    util = __atomic_load_n(&sched->cores[i].util, __ATOMIC_RELAXED);
+    if (util < min_util) {
+      min_util = util;
+      target = &sched->cores[i];
+    }
+  }
+  if (target == NULL || min_util >= sched->max_util) {
+    return;
+  }
+
+  //even out both cores, assuming streams cost the same
+  move = (unsigned)((unsigned long long)core->count * (core->util - min_util) /
+                    (2 * core->util));
+  if (move == 0) {
+    move = 1;
+  }
+  if (move >= core->count) {
+    move = core->count - 1;
+  }
+
+  for (; move > 0; move--) {
+    inbox_push(target, core->streams[--core->count]);
+    __atomic_store_n(&core->migrated, core->migrated + 1, __ATOMIC_RELAXED);
+  }
+  core->rebalanced = core->ticks;
+}
+
+static void* core_run(void *arg)
+{
+  core_t *core = (core_t*) arg;
+  jbuf_sched_t *sched = core->sched;
+  long long period = sched->ptime * 1000000LL;
+  long long next = sched->epoch + period;
+  long long start, end;
+  unsigned long late, busy, util;
+  struct timespec ts;
+  cpu_set_t cpus;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  CPU_ZERO(&cpus);
+  CPU_SET(core->index % (ncpu > 0 ? ncpu : 1), &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    printf("pthread_setaffinity_np error\n");
+  }
+
+  while (!__atomic_load_n(&sched->stop, __ATOMIC_ACQUIRE)) {
+    ts.tv_sec = next / 1000000000LL;
+    ts.tv_nsec = next % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+    start = now_ns();
+    inbox_drain(core);
+    tick(core);
+    end = now_ns();
+
+    late = start > next ? start - next : 0;
+    busy = end - start;
+    util = busy >= (unsigned long)period ? 1000000 : busy * 1000000 / period;
+    util = (core->util * (UTIL_WEIGHT - 1) + util) / UTIL_WEIGHT;
+
+    __atomic_store_n(&core->nstreams, core->count, __ATOMIC_RELAXED);
+    __atomic_store_n(&core->ticks, core->ticks + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&core->late_sum, core->late_sum + late, __ATOMIC_RELAXED);
+    if (late > core->late_max) {
+      __atomic_store_n(&core->late_max, late, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&core->util, util, __ATOMIC_RELAXED);
+
+    rebalance(core);
+
+    //stay on the ptime grid, skip the boundaries already missed
+    next += period;
+    if (next <= end) {
+      __atomic_store_n(&core->overruns,
+                       core->overruns + (end - next) / period + 1,
+                       __ATOMIC_RELAXED);
+      next += ((end - next) / period + 1) * period;
+    }
+  }
+
+  return NULL;
+}
+
+jbuf_sched_t* jbuf_sched_new(int cores, unsigned ptime, double max_util)
+{
+  jbuf_sched_t *sched;
+  int i;
+
+  if (cores <= 0 || ptime == 0 || max_util < 0) {
+    printf("params error\n");
+    return NULL;
+  }
+
+  sched = malloc(sizeof(jbuf_sched_t));
+  if (sched == NULL) {
+    printf("malloc error\n");
+    return NULL;
+  }
+
+  memset(sched,0,sizeof(jbuf_sched_t));
+  sched->ncore = cores;
+  sched->ptime = ptime;
+  sched->max_util = (unsigned long)(max_util * 1000000);
+  sched->epoch = now_ns();
+  sched->cores = calloc(cores, sizeof(core_t));
+  if (sched->cores == NULL) {
+    printf("malloc error\n");
+    free(sched);
+    return NULL;
+  }
+
+  for (i = 0; i < cores; i++) {
+    sched->cores[i].sched = sched;
+    sched->cores[i].index = i;
+    if (pthread_create(&sched->cores[i].thread, NULL, core_run, &sched->cores[i]) != 0) {
+      printf("pthread_create error\n");
+      jbuf_sched_free(sched);
+      return NULL;
+    }
+    sched->cores[i].started = 1;
+  }
+
+  return sched;
+}
+
+void jbuf_sched_free(jbuf_sched_t *sched)
+{
+  jbuf_stream_t *st, *next;
+  core_t *core;
+  unsigned j;
+  int i;
+
+  __atomic_store_n(&sched->stop, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < sched->ncore; i++) {
+    if (sched->cores[i].started) {
+      pthread_join(sched->cores[i].thread, NULL);
+    }
+  }
+
+  for (i = 0; i < sched->ncore; i++) {
+    core = &sched->cores[i];
+    for (j = 0; j < core->count; j++) {
+      drop(core->streams[j]);
+    }
+    for (st = core->inbox; st != NULL; st = next) {
+      next = st->next;
+      drop(st);
+    }
+    free(core->streams);
+    free(core->frame);
+  }
+
+  free(sched->cores);
+  free(sched);
+}
+
+jbuf_stream_t* jbuf_sched_add(jbuf_sched_t *sched, uint32_t key, jbuf_t *jb,
+                              sched_cb_t fn, void *arg)
+{
+  jbuf_stream_t *st;
+  jb_state_t state;
+
+  if (jbuf_get_state(jb, &state) < 0 || state.ptime != sched->ptime) {
+    printf("params error\n");
+    return NULL;
+  }
+
+  st = malloc(sizeof(jbuf_stream_t));
+  if (st == NULL) {
+    printf("malloc error\n");
+    return NULL;
+  }
+
+  memset(st,0,sizeof(jbuf_stream_t));
+  st->sched = sched;
+  st->jb = jb;
+  st->frame_size = state.frame_size;
+  st->proc = fn;
+  st->arg = arg;
+
+  inbox_push(&sched->cores[hash(key) % sched->ncore], st);
+  return st;
+}
+
+int jbuf_sched_remove(jbuf_sched_t *sched, jbuf_stream_t *st)
+{
+  if (st == NULL || st->sched != sched) {
+    printf("params error\n");
+    return -1;
+  }
+
+  __atomic_store_n(&st->removed, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int jbuf_sched_stat(jbuf_sched_t *sched, int core, jbuf_sched_stat_t *stat)
+{
+  core_t *c;
+
+  if (core < 0 || core >= sched->ncore || stat == NULL) {
+    return -1;
+  }
+
+  c = &sched->cores[core];
+  stat->streams = __atomic_load_n(&c->nstreams, __ATOMIC_RELAXED);
+  stat->ticks = __atomic_load_n(&c->ticks, __ATOMIC_RELAXED);
+  stat->overruns = __atomic_load_n(&c->overruns, __ATOMIC_RELAXED);
+  stat->lateness_avg = stat->ticks ?
+    __atomic_load_n(&c->late_sum, __ATOMIC_RELAXED) / 1000.0 / stat->ticks : 0;
+  stat->lateness_max = __atomic_load_n(&c->late_max, __ATOMIC_RELAXED) / 1000.0;
+  stat->utilization = __atomic_load_n(&c->util, __ATOMIC_RELAXED) / 1000000.0;
+  stat->migrated = __atomic_load_n(&c->migrated, __ATOMIC_RELAXED);
+  return 0;
+}
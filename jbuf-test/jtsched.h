@@ -0,0 +1,88 @@
+#ifndef __JTSCHED__
+#define __JTSCHED__
+
+/*
+handle of a playout scheduler, it runs one thread per core, each thread
+owns a set of streams (jitter buffers) and plays one frame of all of them
+in a single pass on every ptime boundary; the stream lists are only
+touched by their owner thread, streams are handed over between threads
+through lock-free inboxes
+*/
+typedef struct tag_sched jbuf_sched_t;
+
+/*
+handle of a stream played by a scheduler
+*/
+typedef struct tag_sched_stream jbuf_stream_t;
+
+/*
+callback function for played frames, called on the thread of the core
+owning the stream
+@st: the stream
+@frame: the frame content, zeroed when the frame is not a normal frame;
+        NULL when the stream is dropped after jbuf_sched_remove, this is
+        the last call for the stream
+@size: the frame length
+@frame_type: the frame type, see jb_frame_type_t
+@arg: the extra data for the stream
+*/
+typedef void (*sched_cb_t)(jbuf_stream_t *st,const void *frame,size_t size,
+                           char frame_type,void *arg);
+
+/*
+metrics of a core
+@streams: number of streams owned
+@ticks: number of ticks run
+@overruns: number of ptime boundaries missed because a tick was too long
+@lateness_avg: average delay of tick starts after the ptime boundary(us)
+@lateness_max: max delay of tick starts after the ptime boundary(us)
+@utilization: busy part of ptime(0-1), smoothed over the last ticks
+@migrated: number of streams moved away to other cores
+*/
+typedef struct
+{
+  unsigned streams;
+  unsigned long ticks;
+  unsigned long overruns;
+  double lateness_avg;
+  double lateness_max;
+  double utilization;
+  unsigned long migrated;
+} jbuf_sched_stat_t;
+
+/*
+create a scheduler
+@cores: number of cores(threads), thread i is pinned on cpu i
+@ptime: frame duration(ms) of all the streams
+@max_util: utilization above which a core moves streams to the least
+           loaded core, 0 to disable the rebalancing
+*/
+jbuf_sched_t* jbuf_sched_new(int cores,unsigned ptime,double max_util);
+
+/*
+stop the threads and free the scheduler, the remaining streams are
+dropped as if removed; this does not destroy the jitter buffers
+*/
+void jbuf_sched_free(jbuf_sched_t *sched);
+
+/*
+add a jitter buffer to the scheduler, the stream is first assigned to a
+core by hash of key
+*/
+jbuf_stream_t* jbuf_sched_add(jbuf_sched_t *sched,uint32_t key,jbuf_t *jb,
+                              sched_cb_t fn,void *arg);
+
+/*
+remove a stream, it returns at once; the owner thread drops the stream on
+its next tick and calls the callback a last time with a NULL frame, from
+then on jb may be destroyed
+return 0 on success,-1 if the stream was not added to sched
+*/
+int jbuf_sched_remove(jbuf_sched_t *sched,jbuf_stream_t *st);
+
+/*
+get the metrics of a core
+*/
+int jbuf_sched_stat(jbuf_sched_t *sched,int core,jbuf_sched_stat_t *stat);
+
+#endif//__JTSCHED__
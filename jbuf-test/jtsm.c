@@ -0,0 +1,319 @@
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "jtbuf.h"
+#include "jtsm.h"
+
+#define MIN(a,b) (((a) < (b)) ? (a):(b))
+
+/* Highest pitch searched for, in Hz. */
+#define TSM_MAX_PITCH                    400
+
+/* Lowest pitch searched for, in Hz. */
+#define TSM_MIN_PITCH                    100
+
+/* Overlap-add (cross-fade) duration, in Hz, i.e: 5 ms. */
+#define TSM_OVERLAP_RATE                 200
+
+/* Number of frames the jitter buffer may be above its prefetch before
+ * the stage starts compressing.
+ */
+#define TSM_COMPRESS_MARGIN              1
+
+/* Number of frames the FIFO can hold. */
+#define TSM_FIFO_FRAMES                  3
+
+enum tsm_mode
+    {
+        TSM_NORMAL   = 0,
+        TSM_COMPRESS = 1,
+        TSM_EXPAND   = 2
+    };
+
+struct jbuf_tsm
+{
+    jbuf_t      *jb;            /**< the jitter buffer    */
+
+    /* Settings (consts) */
+    unsigned    samples_per_frame;/**< samples in a frame    */
+    unsigned    min_shift;      /**< shortest pitch period, in samples  */
+    unsigned    max_shift;      /**< longest pitch period, in samples   */
+    unsigned    overlap;        /**< cross-fade length, in samples    */
+
+    /* FIFO of samples got from the jitter buffer */
+    int16_t     *fifo;          /**< samples    */
+    unsigned    fifo_len;       /**< number of samples in the FIFO    */
+    unsigned    frame_off;      /**< offset of the FIFO head in the
+                                     first frame    */
+    char        frame_type[TSM_FIFO_FRAMES + 1];/**< type of the frames
+                                                     in the FIFO    */
+    unsigned    frame_cnt;      /**< number of frames in frame_type    */
+};
+
+
+/* Dot product of two 16 bit sample vectors. Samples are halved before
+ * the multiplication, so a pair of products can't overflow 32 bit lanes.
+ */
+static double tsm_dot(const int16_t *x, const int16_t *y, unsigned len)
+{
+    unsigned i = 0;
+    double sum = 0;
+
+#if defined(__AVX2__)
+    __m256d acc = _mm256_setzero_pd();
+    double tmp[4];
+
+    for (; i + 16 <= len; i += 16) {
+        __m256i a = _mm256_srai_epi16(
+                        _mm256_loadu_si256((const __m256i*)(x + i)), 1);
+        __m256i b = _mm256_srai_epi16(
+                        _mm256_loadu_si256((const __m256i*)(y + i)), 1);
+        __m256i p = _mm256_madd_epi16(a, b);
+
+        acc = _mm256_add_pd(acc,
+                  _mm256_cvtepi32_pd(_mm256_castsi256_si128(p)));
+        acc = _mm256_add_pd(acc,
+                  _mm256_cvtepi32_pd(_mm256_extracti128_si256(p, 1)));
+    }
+    _mm256_storeu_pd(tmp, acc);
+    sum = (tmp[0] + tmp[1] + tmp[2] + tmp[3]) * 4;
+#elif defined(__SSE2__)
+    __m128d acc = _mm_setzero_pd();
+    double tmp[2];
+
+    for (; i + 8 <= len; i += 8) {
+        __m128i a = _mm_srai_epi16(
+                        _mm_loadu_si128((const __m128i*)(x + i)), 1);
+        __m128i b = _mm_srai_epi16(
+                        _mm_loadu_si128((const __m128i*)(y + i)), 1);
+        __m128i p = _mm_madd_epi16(a, b);
+
+        acc = _mm_add_pd(acc, _mm_cvtepi32_pd(p));
+        acc = _mm_add_pd(acc, _mm_cvtepi32_pd(_mm_srli_si128(p, 8)));
+    }
+    _mm_storeu_pd(tmp, acc);
+    sum = (tmp[0] + tmp[1]) * 4;
+#endif
+
+    for (; i < len; ++i)
+        sum += (double)x[i] * y[i];
+
+    return sum;
+}
+
+
+/* Find the shift (in samples, within [min_shift, max_shift]) at which the
+ * samples are the most similar to the template at 'pos', going forward
+ * (dir = 1) or backward (dir = -1).
+ */
+static int tsm_find_shift(jbuf_tsm_t *tsm, unsigned pos, int dir)
+{
+    const int16_t *tmpl = tsm->fifo + pos;
+    double best = -1e300;
+    int best_shift = (int)tsm->min_shift;
+    unsigned s;
+
+    for (s = tsm->min_shift; s <= tsm->max_shift; ++s) {
+        const int16_t *cand = tmpl + dir * (int)s;
+        double xy, yy, score;
+
+        xy = tsm_dot(tmpl, cand, tsm->overlap);
+        yy = tsm_dot(cand, cand, tsm->overlap);
+
+        /* Normalized cross-correlation, keeping the sign */
+        score = xy / sqrt(yy + 1.0);
+        if (score > best) {
+            best = score;
+            best_shift = (int)s;
+        }
+    }
+
+    return dir * best_shift;
+}
+
+
+/* Drop 'count' samples from the FIFO head. */
+static void tsm_consume(jbuf_tsm_t *tsm, unsigned count)
+{
+    unsigned n = tsm->samples_per_frame;
+
+    memmove(tsm->fifo, tsm->fifo + count,
+            (tsm->fifo_len - count) * sizeof(tsm->fifo[0]));
+    tsm->fifo_len -= count;
+
+    tsm->frame_off += count;
+    while (tsm->frame_off >= n && tsm->frame_cnt) {
+        memmove(tsm->frame_type, tsm->frame_type + 1, tsm->frame_cnt - 1);
+        tsm->frame_cnt--;
+        tsm->frame_off -= n;
+    }
+}
+
+
+/* Get frames from the jitter buffer until the FIFO holds 'count' samples. */
+static void tsm_fill(jbuf_tsm_t *tsm, unsigned count)
+{
+    unsigned n = tsm->samples_per_frame;
+
+    while (tsm->fifo_len < count) {
+        int16_t *frame = tsm->fifo + tsm->fifo_len;
+        size_t size = 0;
+        char type;
+
+        jbuf_get_frame2(tsm->jb, frame, &size, &type, NULL);
+        if (type != JB_NORMAL_FRAME) {
+            /* The application may still apply PLC on the returned type */
+            bzero(frame, n * sizeof(frame[0]));
+        } else if (size < n * sizeof(frame[0])) {
+            bzero((char*)frame + size, n * sizeof(frame[0]) - size);
+        }
+
+        tsm->frame_type[tsm->frame_cnt++] = type;
+        tsm->fifo_len += n;
+    }
+}
+
+
+/* Check if the samples in the FIFO up to 'count' all come from normal
+ * frames, only those may be stretched.
+ */
+static int tsm_is_normal(jbuf_tsm_t *tsm, unsigned count)
+{
+    unsigned i, frames;
+
+    frames = (tsm->frame_off + count + tsm->samples_per_frame - 1) /
+             tsm->samples_per_frame;
+    for (i = 0; i < frames && i < tsm->frame_cnt; ++i) {
+        if (tsm->frame_type[i] != JB_NORMAL_FRAME)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Create a time scale modification stage for the jitter buffer which
+ * holds 16 bit mono PCM frames of 'samples_per_frame' samples sampled at
+ * 'clock_rate' Hz.
+ */
+int jbuf_tsm_create(jbuf_t *jb,
+                    unsigned clock_rate,
+                    unsigned samples_per_frame,
+                    jbuf_tsm_t **p_tsm)
+{
+    jbuf_tsm_t *tsm;
+
+    if (!jb || !clock_rate || !samples_per_frame || !p_tsm)
+        return -1;
+
+    tsm = (jbuf_tsm_t*)calloc(1, sizeof(jbuf_tsm_t));
+    if (!tsm)
+        return -1;
+
+    tsm->jb = jb;
+    tsm->samples_per_frame = samples_per_frame;
+    tsm->overlap = clock_rate / TSM_OVERLAP_RATE;
+    tsm->min_shift = clock_rate / TSM_MAX_PITCH;
+    tsm->max_shift = MIN(clock_rate / TSM_MIN_PITCH,
+                         samples_per_frame - tsm->overlap);
+
+    /* Frames too short to hold a pitch period and a cross-fade, the
+     * stage will just pass frames through.
+     */
+    if (tsm->overlap >= samples_per_frame ||
+        tsm->max_shift <= tsm->min_shift)
+    {
+        tsm->max_shift = tsm->min_shift = 0;
+    }
+
+    tsm->fifo = (int16_t*)malloc(samples_per_frame * TSM_FIFO_FRAMES *
+                                 sizeof(tsm->fifo[0]));
+    if (!tsm->fifo) {
+        free(tsm);
+        return -1;
+    }
+
+    jbuf_set_discard(jb, JB_DISCARD_NONE);
+
+    *p_tsm = tsm;
+
+    return 0;
+}
+
+
+int jbuf_tsm_destroy(jbuf_tsm_t *tsm)
+{
+    if (!tsm)
+        return -1;
+
+    free(tsm->fifo);
+    free(tsm);
+
+    return 0;
+}
+
+
+/*
+ * Get one frame of 'samples_per_frame' samples. The frame type has the
+ * same meaning as in jbuf_get_frame(), it is the type of the frame the
+ * first returned sample comes from.
+ */
+void jbuf_tsm_get_frame(jbuf_tsm_t *tsm,
+                        int16_t *frame,
+                        char *p_frame_type)
+{
+    unsigned n = tsm->samples_per_frame;
+    unsigned pos = tsm->max_shift;
+    enum tsm_mode mode = TSM_NORMAL;
+    jb_state_t state;
+    int shift = 0;
+    unsigned i;
+
+    /* Decide whether the latency should go down or up */
+    if (tsm->max_shift && jbuf_get_state(tsm->jb, &state) == 0) {
+        unsigned buffered = state.size + tsm->fifo_len / n;
+
+        if (buffered > state.prefetch + TSM_COMPRESS_MARGIN)
+            mode = TSM_COMPRESS;
+        else if (state.prefetch >= 2 && buffered * 2 < state.prefetch)
+            mode = TSM_EXPAND;
+    }
+
+    tsm_fill(tsm, (mode == TSM_COMPRESS) ? n + tsm->max_shift : n);
+
+    if (mode != TSM_NORMAL && !tsm_is_normal(tsm, tsm->fifo_len))
+        mode = TSM_NORMAL;
+
+    *p_frame_type = tsm->frame_type[0];
+
+    if (mode == TSM_NORMAL) {
+        memcpy(frame, tsm->fifo, n * sizeof(frame[0]));
+        tsm_consume(tsm, n);
+        return;
+    }
+
+    /* Skip (compress) or repeat (expand) one pitch period at 'pos',
+     * cross-fading over the overlap to where the waveform matches best.
+     */
+    shift = tsm_find_shift(tsm, pos, (mode == TSM_COMPRESS) ? 1 : -1);
+
+    memcpy(frame, tsm->fifo, pos * sizeof(frame[0]));
+    for (i = 0; i < tsm->overlap; ++i) {
+        int a = tsm->fifo[pos + i];
+        int b = tsm->fifo[pos + i + shift];
+
+        frame[pos + i] = (int16_t)((a * (int)(tsm->overlap - i) +
+                                    b * (int)i) / (int)tsm->overlap);
+    }
+    memcpy(frame + pos + tsm->overlap,
+           tsm->fifo + pos + tsm->overlap + shift,
+           (n - pos - tsm->overlap) * sizeof(frame[0]));
+
+    tsm_consume(tsm, n + shift);
+}
@@ -0,0 +1,30 @@
+#ifndef JTSM_H
+#define JTSM_H
+
+/**
+ * Time scale modification (TSM) playout stage on top of the jitter buffer.
+ *
+ * Instead of discarding whole frames to reduce the latency, the stage
+ * compresses (or expands) the 16 bit mono PCM it gets from the jitter
+ * buffer by one pitch period at a time, using WSOLA (waveform similarity
+ * overlap-add). The latency can then follow the jitter buffer prefetch
+ * continuously and much faster than one frame per discard gap, without
+ * audible drops.
+ *
+ * The stage takes over the latency control, so it disables the discard
+ * algorithm of the jitter buffer. It must be the only consumer of the
+ * jitter buffer.
+ */
+
+typedef struct jbuf_tsm jbuf_tsm_t;
+
+extern int jbuf_tsm_create(jbuf_t *,
+                           unsigned,
+                           unsigned,
+                           jbuf_tsm_t **);
+
+extern int jbuf_tsm_destroy(jbuf_tsm_t *);
+
+extern void jbuf_tsm_get_frame(jbuf_tsm_t *, int16_t *, char *);
+
+#endif
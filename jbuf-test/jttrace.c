@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "jttrace.h"
+
+#define TRACE_HDR_SIZE                   16
+#define TRACE_REC_SIZE                   16
+
+struct jbuf_trace
+{
+    FILE        *file;          /**< the trace file    */
+    int         writing;        /**< opened by jbuf_trace_create()    */
+    pthread_mutex_t lock;       /**< PUT and GET may be recorded by
+                                     different threads    */
+};
+
+
+static void trace_set16(uint8_t *p, unsigned v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void trace_set32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static unsigned trace_get16(const uint8_t *p)
+{
+    return p[0] | ((unsigned)p[1] << 8);
+}
+
+static uint32_t trace_get32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+
+static jbuf_trace_t *trace_new(FILE *file, int writing)
+{
+    jbuf_trace_t *trace;
+
+    trace = (jbuf_trace_t*)calloc(1, sizeof(jbuf_trace_t));
+    if (!trace)
+        return NULL;
+
+    trace->file = file;
+    trace->writing = writing;
+    pthread_mutex_init(&trace->lock, NULL);
+
+    return trace;
+}
+
+
+/*
+ * Create a trace file to record the operations of a jitter buffer.
+ */
+int jbuf_trace_create(const char *path,
+                      const jbuf_trace_hdr_t *hdr,
+                      jbuf_trace_t **p_trace)
+{
+    uint8_t buf[TRACE_HDR_SIZE];
+    FILE *file;
+
+    if (!path || !hdr || !p_trace)
+        return -1;
+
+    file = fopen(path, "wb");
+    if (!file)
+        return -1;
+
+    memcpy(buf, "JBTR", 4);
+    trace_set16(buf + 4, JB_TRACE_VERSION);
+    trace_set16(buf + 6, hdr->ptime);
+    trace_set32(buf + 8, hdr->frame_size);
+    trace_set32(buf + 12, hdr->clock_rate);
+
+    if (fwrite(buf, sizeof(buf), 1, file) != 1) {
+        fclose(file);
+        return -1;
+    }
+
+    *p_trace = trace_new(file, 1);
+    if (!*p_trace) {
+        fclose(file);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Open a trace file to replay it, and read its header.
+ */
+int jbuf_trace_open(const char *path,
+                    jbuf_trace_hdr_t *hdr,
+                    jbuf_trace_t **p_trace)
+{
+    uint8_t buf[TRACE_HDR_SIZE];
+    FILE *file;
+
+    if (!path || !hdr || !p_trace)
+        return -1;
+
+    file = fopen(path, "rb");
+    if (!file)
+        return -1;
+
+    if (fread(buf, sizeof(buf), 1, file) != 1 ||
+        memcmp(buf, "JBTR", 4) != 0 ||
+        trace_get16(buf + 4) != JB_TRACE_VERSION)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    hdr->ptime = trace_get16(buf + 6);
+    hdr->frame_size = trace_get32(buf + 8);
+    hdr->clock_rate = trace_get32(buf + 12);
+
+    *p_trace = trace_new(file, 0);
+    if (!*p_trace) {
+        fclose(file);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int jbuf_trace_write(jbuf_trace_t *trace,
+                     const jbuf_trace_rec_t *rec)
+{
+    uint8_t buf[TRACE_REC_SIZE];
+    int rc;
+
+    if (!trace || !trace->writing || !rec)
+        return -1;
+
+    trace_set32(buf, rec->time);
+    trace_set32(buf + 4, (uint32_t)rec->seq);
+    trace_set32(buf + 8, rec->ts);
+    trace_set16(buf + 12, rec->size > 0xffff ? 0xffff : rec->size);
+    buf[14] = (uint8_t)rec->op;
+    buf[15] = (uint8_t)rec->type;
+
+    pthread_mutex_lock(&trace->lock);
+    rc = fwrite(buf, sizeof(buf), 1, trace->file) == 1 ? 0 : -1;
+    pthread_mutex_unlock(&trace->lock);
+
+    return rc;
+}
+
+
+/*
+ * Read the next record. Return 1 when a record is read, 0 at the end of
+ * the trace, -1 on error.
+ */
+int jbuf_trace_read(jbuf_trace_t *trace,
+                    jbuf_trace_rec_t *rec)
+{
+    uint8_t buf[TRACE_REC_SIZE];
+    size_t n;
+
+    if (!trace || trace->writing || !rec)
+        return -1;
+
+    n = fread(buf, 1, sizeof(buf), trace->file);
+    if (n == 0 && feof(trace->file))
+        return 0;
+    if (n != sizeof(buf))
+        return -1;
+
+    rec->time = trace_get32(buf);
+    rec->seq = (int)trace_get32(buf + 4);
+    rec->ts = trace_get32(buf + 8);
+    rec->size = trace_get16(buf + 12);
+    rec->op = buf[14];
+    rec->type = (char)buf[15];
+
+    return 1;
+}
+
+
+int jbuf_trace_close(jbuf_trace_t *trace)
+{
+    int rc;
+
+    if (!trace)
+        return -1;
+
+    rc = fclose(trace->file) == 0 ? 0 : -1;
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+
+    return rc;
+}
@@ -0,0 +1,72 @@
+#ifndef JTTRACE_H
+#define JTTRACE_H
+
+/**
+ * Binary trace of the operations on a jitter buffer.
+ *
+ * A trace records every PUT (seq, timestamp, size and arrival time) and
+ * every GET (time and frame type returned) of a live session, so the
+ * session can be replayed offline through a jitter buffer with other
+ * settings (see jbsim.c), on a virtual clock.
+ *
+ * The file is a 16 byte header followed by 16 byte records, all the
+ * fields are little endian:
+ *
+ *   header: "JBTR", version (16 bit), ptime (16 bit), frame size (32 bit),
+ *           clock rate (32 bit)
+ *   record: time in ms (32 bit), seq (32 bit), timestamp (32 bit),
+ *           size (16 bit), operation (8 bit), frame type (8 bit)
+ */
+
+#define JB_TRACE_VERSION    1
+
+/**
+ * Operations recorded.
+ */
+#define JB_TRACE_PUT        1
+#define JB_TRACE_GET        2
+
+/**
+ * Trace header.
+ */
+typedef struct jbuf_trace_hdr
+{
+    unsigned frame_size;    /**< Frame size of the jitter buffer, in
+                                 bytes.    */
+    unsigned ptime;         /**< Frame duration, in ms.    */
+    unsigned clock_rate;    /**< Clock rate of the timestamps, in Hz. */
+
+} jbuf_trace_hdr_t;
+
+/**
+ * Trace record.
+ */
+typedef struct jbuf_trace_rec
+{
+    uint32_t time;          /**< Time of the operation, in ms from any
+                                 origin.    */
+    int      seq;           /**< Frame seq, -1 if unknown.    */
+    uint32_t ts;            /**< Frame timestamp (PUT).    */
+    unsigned size;          /**< Frame size (PUT), in bytes.    */
+    unsigned op;            /**< JB_TRACE_PUT or JB_TRACE_GET.    */
+    char     type;          /**< Frame type returned (GET).    */
+
+} jbuf_trace_rec_t;
+
+typedef struct jbuf_trace jbuf_trace_t;
+
+extern int jbuf_trace_create(const char *,
+                             const jbuf_trace_hdr_t *,
+                             jbuf_trace_t **);
+
+extern int jbuf_trace_open(const char *,
+                           jbuf_trace_hdr_t *,
+                           jbuf_trace_t **);
+
+extern int jbuf_trace_write(jbuf_trace_t *, const jbuf_trace_rec_t *);
+
+extern int jbuf_trace_read(jbuf_trace_t *, jbuf_trace_rec_t *);
+
+extern int jbuf_trace_close(jbuf_trace_t *);
+
+#endif
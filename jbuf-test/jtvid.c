@@ -0,0 +1,301 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "jtbuf.h"
+#include "jtvid.h"
+
+/* Maximum number of frames looked at ahead of the head. */
+#define VASM_MAX_FRAMES                  64
+
+/* A frame made of the packets at [first, first + count) from the head. */
+typedef struct vasm_frame
+{
+    unsigned    first;          /**< offset of the first packet    */
+    unsigned    count;          /**< number of packets    */
+    uint32_t    ts;             /**< RTP timestamp    */
+    uint32_t    flags;          /**< packet flags, or'ed    */
+    size_t      size;           /**< size of the packets    */
+    int         has_ts;         /**< a packet has been got    */
+    int         gap;            /**< a packet is missing    */
+    int         lead_gap;       /**< packets are missing before the
+                                     first one got, they may be a
+                                     whole other frame    */
+    int         closed;         /**< no more packet belongs to the
+                                     frame    */
+    int         complete;       /**< all the packets are there    */
+
+} vasm_frame;
+
+struct jbuf_vasm
+{
+    jbuf_t      *jb;            /**< the jitter buffer    */
+
+    /* Settings (consts) */
+    unsigned    max_delay;      /**< complete frames buffered above
+                                     which the latency is reduced    */
+
+    /* States */
+    vasm_frame  frame[VASM_MAX_FRAMES];/**< frames from the head    */
+    unsigned    frame_cnt;      /**< number of frames    */
+    unsigned    complete_cnt;   /**< number of complete frames    */
+    int         head_seq;       /**< seq of the head packet    */
+    int         next_seq;       /**< seq expected at the head, after
+                                     the packets removed    */
+    int         started;        /**< packets have been removed    */
+    jbuf_vasm_state_t state;    /**< statistics    */
+};
+
+
+/* Group the buffered packets into frames. */
+static void vasm_index(jbuf_vasm_t *vasm)
+{
+    vasm_frame *f = NULL;
+    unsigned off;
+
+    vasm->frame_cnt = 0;
+    vasm->complete_cnt = 0;
+
+    for (off = 0; ; ++off) {
+        const void *p;
+        size_t size = 0;
+        char type;
+        uint32_t bit_info = 0, ts = 0;
+        int seq = 0;
+
+        jbuf_peek_frame(vasm->jb, off, &p, &size, &type, &bit_info, &ts,
+                        &seq);
+        if (type == JB_ZERO_EMPTY_FRAME)
+            break;
+        if (off == 0)
+            vasm->head_seq = seq;
+
+        /* A new timestamp without the marker of the open frame */
+        if (type == JB_NORMAL_FRAME && f && !f->closed && f->has_ts &&
+            f->ts != ts)
+        {
+            f->closed = 1;
+        }
+
+        if (!f || f->closed) {
+            if (vasm->frame_cnt == VASM_MAX_FRAMES)
+                break;
+            f = &vasm->frame[vasm->frame_cnt++];
+            bzero(f, sizeof(*f));
+            f->first = off;
+        }
+        f->count++;
+
+        if (type != JB_NORMAL_FRAME) {
+            /* Missing packet, of the open frame or of a new one */
+            f->gap = 1;
+            if (!f->has_ts)
+                f->lead_gap = 1;
+            continue;
+        }
+
+        if (!f->has_ts) {
+            f->ts = ts;
+            f->has_ts = 1;
+        }
+        f->flags |= bit_info;
+        f->size += size;
+        if (bit_info & JB_VIDEO_MARKER)
+            f->closed = 1;
+    }
+
+    /* Packets removed by the jitter buffer itself (when full) */
+    if (vasm->frame_cnt && vasm->started && vasm->head_seq != vasm->next_seq)
+        vasm->frame[0].gap = vasm->frame[0].lead_gap = 1;
+
+    for (off = 0; off < vasm->frame_cnt; ++off) {
+        f = &vasm->frame[off];
+        f->complete = f->has_ts && !f->gap &&
+                      (f->flags & JB_VIDEO_MARKER);
+        if (f->complete)
+            vasm->complete_cnt++;
+    }
+}
+
+
+/* Remove the first 'count' frames. */
+static void vasm_drop(jbuf_vasm_t *vasm, unsigned count)
+{
+    unsigned packets = 0;
+    unsigned i;
+
+    for (i = 0; i < count; ++i)
+        packets += vasm->frame[i].count;
+
+    jbuf_remove_frame(vasm->jb, packets);
+    vasm->next_seq = vasm->head_seq + (int)packets;
+    vasm->started = 1;
+}
+
+
+/*
+ * Create an assembler of the packets of the jitter buffer. When more than
+ * 'max_delay' complete frames are buffered, the assembler drops frames
+ * to reduce the latency, and it waits for the missing packets of a frame
+ * until then.
+ */
+int jbuf_vasm_create(jbuf_t *jb,
+                     unsigned max_delay,
+                     jbuf_vasm_t **p_vasm)
+{
+    jbuf_vasm_t *vasm;
+
+    if (!jb || !max_delay || max_delay >= VASM_MAX_FRAMES || !p_vasm)
+        return -1;
+
+    vasm = (jbuf_vasm_t*)calloc(1, sizeof(jbuf_vasm_t));
+    if (!vasm)
+        return -1;
+
+    vasm->jb = jb;
+    vasm->max_delay = max_delay;
+
+    /* Nothing can be decoded before the first keyframe */
+    vasm->state.need_keyframe = 1;
+
+    jbuf_set_discard(jb, JB_DISCARD_NONE);
+
+    *p_vasm = vasm;
+
+    return 0;
+}
+
+
+int jbuf_vasm_destroy(jbuf_vasm_t *vasm)
+{
+    if (!vasm)
+        return -1;
+
+    free(vasm);
+
+    return 0;
+}
+
+
+/*
+ * Get the next complete frame, i.e: its packets concatenated in 'frame'
+ * of '*size' bytes. Return 1 when a frame is returned, with its size,
+ * timestamp and flags, 0 when no frame is ready yet, -1 when the frame
+ * doesn't fit in 'frame' (it is dropped).
+ */
+int jbuf_vasm_get_frame(jbuf_vasm_t *vasm,
+                        void *frame,
+                        size_t *size,
+                        uint32_t *ts,
+                        uint32_t *flags)
+{
+    jbuf_vasm_state_t *state = &vasm->state;
+
+    while (1) {
+        vasm_frame *f;
+        unsigned i;
+        size_t len = 0;
+
+        vasm_index(vasm);
+        if (vasm->frame_cnt == 0)
+            return 0;
+
+        f = &vasm->frame[0];
+
+        /* Latency too high, drop a non-reference frame, or go to the
+         * next keyframe if any. Reference frames can't be dropped alone.
+         */
+        if (vasm->complete_cnt > vasm->max_delay) {
+            if (f->complete && (f->flags & JB_VIDEO_NONREF)) {
+                vasm_drop(vasm, 1);
+                state->dropped_nonref++;
+                continue;
+            }
+            for (i = 1; i < vasm->frame_cnt; ++i) {
+                if (vasm->frame[i].complete &&
+                    (vasm->frame[i].flags & JB_VIDEO_KEYFRAME))
+                {
+                    break;
+                }
+            }
+            if (i < vasm->frame_cnt) {
+                vasm_drop(vasm, i);
+                state->skipped += i;
+                continue;
+            }
+        }
+
+        if (!f->complete) {
+            /* Wait for the missing packets while the latency allows */
+            if (vasm->complete_cnt < vasm->max_delay &&
+                vasm->frame_cnt < VASM_MAX_FRAMES)
+            {
+                return 0;
+            }
+
+            /* The flags of the packets got don't tell about a whole
+             * frame lost before them
+             */
+            vasm_drop(vasm, 1);
+            state->incomplete++;
+            if (!(f->flags & JB_VIDEO_NONREF) || f->lead_gap)
+                state->need_keyframe = 1;
+            continue;
+        }
+
+        /* Frames referring to a lost one can't be decoded */
+        if (state->need_keyframe && !(f->flags & JB_VIDEO_KEYFRAME)) {
+            vasm_drop(vasm, 1);
+            state->skipped++;
+            continue;
+        }
+
+        if (f->size > *size) {
+            vasm_drop(vasm, 1);
+            state->incomplete++;
+            state->need_keyframe = 1;
+            return -1;
+        }
+
+        for (i = 0; i < f->count; ++i) {
+            const void *p;
+            size_t psize = 0;
+            char type;
+
+            jbuf_peek_frame(vasm->jb, f->first + i, &p, &psize, &type,
+                            NULL, NULL, NULL);
+            memcpy((char*)frame + len, p, psize);
+            len += psize;
+        }
+
+        *size = len;
+        if (ts)
+            *ts = f->ts;
+        if (flags)
+            *flags = f->flags & ~JB_VIDEO_MARKER;
+
+        if (f->flags & JB_VIDEO_KEYFRAME)
+            state->need_keyframe = 0;
+        state->returned++;
+
+        vasm_drop(vasm, 1);
+
+        return 1;
+    }
+}
+
+
+int jbuf_vasm_get_state(jbuf_vasm_t *vasm,
+                        jbuf_vasm_state_t *state)
+{
+    if (!vasm || !state)
+        return -1;
+
+    vasm_index(vasm);
+
+    *state = vasm->state;
+    state->frames = vasm->frame_cnt;
+    state->complete = vasm->complete_cnt;
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef JTVID_H
+#define JTVID_H
+
+/**
+ * Video frame assembler on top of the jitter buffer.
+ *
+ * The jitter buffer holds RTP packets instead of frames: the packets are
+ * put with their RTP sequence number and timestamp, and the bit info
+ * carries the flags below. The assembler groups the packets of the same
+ * timestamp up to the one with the marker bit into frames, and returns
+ * complete frames only.
+ *
+ * When a frame can't be completed in time, or when the latency must go
+ * down, the assembler drops whole non-reference frames or skips to the
+ * next keyframe, so the decoder never gets a frame whose references are
+ * missing. After a reference frame is lost, it asks for a keyframe once
+ * (see need_keyframe in jbuf_vasm_state_t) and drops frames until one
+ * arrives.
+ *
+ * The assembler takes over the latency control, so it disables the
+ * discard algorithm of the jitter buffer. It must be the only consumer
+ * of the jitter buffer.
+ */
+
+/**
+ * Packet flags, in the bit info of the packets put in the jitter buffer.
+ */
+#define JB_VIDEO_MARKER      1  /**< RTP marker bit, last packet of a
+                                     frame    */
+#define JB_VIDEO_KEYFRAME    2  /**< packet of a keyframe, decodable
+                                     without any previous frame    */
+#define JB_VIDEO_NONREF      4  /**< packet of a frame no other frame
+                                     refers to, droppable    */
+
+/**
+ * Assembler state.
+ */
+typedef struct jbuf_vasm_state
+{
+    unsigned frames;        /**< Number of frames buffered, complete or
+                                 not.    */
+    unsigned complete;      /**< Number of complete frames buffered.  */
+    unsigned need_keyframe; /**< Set when frames are dropped until the
+                                 next keyframe, the application should
+                                 request one.    */
+    unsigned returned;      /**< Number of frames returned.    */
+    unsigned incomplete;    /**< Number of frames dropped because they
+                                 were incomplete.    */
+    unsigned dropped_nonref;/**< Number of non-reference frames dropped
+                                 to reduce the latency.    */
+    unsigned skipped;       /**< Number of frames skipped to go to a
+                                 keyframe.    */
+
+} jbuf_vasm_state_t;
+
+typedef struct jbuf_vasm jbuf_vasm_t;
+
+extern int jbuf_vasm_create(jbuf_t *,
+                            unsigned,
+                            jbuf_vasm_t **);
+
+extern int jbuf_vasm_destroy(jbuf_vasm_t *);
+
+extern int jbuf_vasm_get_frame(jbuf_vasm_t *,
+                               void *,
+                               size_t *,
+                               uint32_t *,
+                               uint32_t *);
+
+extern int jbuf_vasm_get_state(jbuf_vasm_t *, jbuf_vasm_state_t *);
+
+#endif
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "eloop.h"
+#include "jtbuf.h"
+#include "nack.h"
+
+//interval of the timer(ms)
+#define NACK_TICK 10
+
+//time a missing frame may still come out of order before it is asked for(ms)
+#define NACK_REORDER 10
+
+//max number of times a frame is asked for
+#define NACK_MAX_RETRIES 3
+
+//time added to rtt before asking again(ms)
+#define NACK_RETRY_MARGIN 10
+
+//max number of missing frames followed, newer gaps are ignored beyond
+#define NACK_MAX_PENDING 512
+
+//rtt until nack_set_rtt is called(ms)
+#define NACK_DEFAULT_RTT 100
+
+typedef struct
+{
+  int seq; //seq of the missing frame
+  long long due; //time of the next NACK(ms)
+  unsigned retries; //number of NACKs sent
+} pending_t;
+
+struct tag_nack
+{
+  eloop_t *loop;
+  event_t *timer;
+  jbuf_t *jb;
+  nack_send_t proc; //callback function
+  void *arg; //point to user data
+  unsigned ptime; //frame duration(ms)
+
+  pthread_mutex_t lock; //the gap callback runs on the thread putting frames
+  unsigned rtt; //round trip time(ms)
+  unsigned rate; //seqs per second, 0 if unlimited
+  double tokens; //seqs which can be sent now
+  long long refilled; //time of the last refill(ms)
+  pending_t pending[NACK_MAX_PENDING]; //missing frames, oldest first
+  unsigned count; //number of missing frames
+  int seqs[NACK_MAX_PENDING]; //seqs of a NACK, loop thread only
+  nack_stat_t stat;
+};
+
+//on the clock of the loop, so the timer and the due times agree
+static long long now_ms(nack_t *nack)
+{
+  return e_loop_now(nack->loop);
+}
+
+//called by the jitter buffer on PUT, without its lock held
+static void on_gap(jbuf_t *jb, int first_seq, unsigned count, void *user_data)
+{
+  nack_t *nack = (nack_t*) user_data;
+  long long due = now_ms(nack) + NACK_REORDER;
+  pending_t *p;
+  unsigned i;
+
+  pthread_mutex_lock(&nack->lock);
+  for (i = 0; i < count && nack->count < NACK_MAX_PENDING; i++) {
+    p = &nack->pending[nack->count++];
+    p->seq = first_seq + (int)i;
+    p->due = due;
+    p->retries = 0;
+  }
+  pthread_mutex_unlock(&nack->lock);
+}
+
+static void refill(nack_t *nack, long long now)
+{
+  if (nack->rate == 0) {
+    return;
+  }
+
+  //allow bursts of up to one tick of the rate
+  nack->tokens += (double)(now - nack->refilled) * nack->rate / 1000;
+  if (nack->tokens > (double)nack->rate * NACK_TICK / 1000 + 1) {
+    nack->tokens = (double)nack->rate * NACK_TICK / 1000 + 1;
+  }
+  nack->refilled = now;
+}
+
+//drop the frames got or played, and collect the seqs due
+static void on_timer(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  nack_t *nack = (nack_t*) arg;
+  long long now = now_ms(nack);
+  unsigned i, kept = 0, n = 0;
+  pending_t *p;
+  int origin, has;
+
+  pthread_mutex_lock(&nack->lock);
+  refill(nack, now);
+
+  if (jbuf_get_origin(nack->jb, &origin) != 0) {
+    origin = -1;
+  }
+
+  for (i = 0; i < nack->count; i++) {
+    p = &nack->pending[i];
+
+    has = jbuf_has_frame(nack->jb, p->seq);
+    if (has != 0) {
+      if (has > 0 && p->retries > 0) {
+        nack->stat.recovered++;
+      } else if (has < 0) {
+        nack->stat.lost++;
+      }
+      continue;
+    }
+    nack->pending[kept++] = *p;
+    p = &nack->pending[kept - 1];
+
+    if (now < p->due || p->retries >= NACK_MAX_RETRIES) {
+      continue;
+    }
+
+    //the retransmission would come after the frame is played
+    if (origin < 0 || (long long)(p->seq - origin) * nack->ptime < nack->rtt) {
+      p->retries = NACK_MAX_RETRIES;
+      continue;
+    }
+
+    if (nack->rate != 0) {
+      if (nack->tokens < 1) {
+        continue;
+      }
+      nack->tokens -= 1;
+    }
+
+    nack->seqs[n++] = p->seq;
+    p->retries++;
+    p->due = now + nack->rtt + NACK_RETRY_MARGIN;
+  }
+  nack->count = kept;
+  nack->stat.requested += n;
+  pthread_mutex_unlock(&nack->lock);
+
+  if (n > 0) {
+    nack->proc(nack, nack->seqs, n, nack->arg);
+  }
+}
+
+nack_t* nack_new(eloop_t *loop, jbuf_t *jb, nack_send_t fn, void *arg)
+{
+  nack_t *nack;
+  jb_state_t state;
+
+  if (loop == NULL || fn == NULL || jbuf_get_state(jb, &state) < 0 ||
+      state.ptime == 0) {
+    printf("params error\n");
+    return NULL;
+  }
+
+  nack = malloc(sizeof(nack_t));
+  if (nack == NULL) {
+    printf("malloc error\n");
+    return NULL;
+  }
+
+  memset(nack,0,sizeof(nack_t));
+  nack->loop = loop;
+  nack->jb = jb;
+  nack->proc = fn;
+  nack->arg = arg;
+  nack->ptime = state.ptime;
+  nack->rtt = NACK_DEFAULT_RTT;
+  nack->refilled = now_ms(nack);
+  pthread_mutex_init(&nack->lock, NULL);
+
+  nack->timer = e_event_new(E_TIMER, NACK_TICK, on_timer, nack);
+  if (nack->timer == NULL) {
+    printf("e_event_new error\n");
+    pthread_mutex_destroy(&nack->lock);
+    free(nack);
+    return NULL;
+  }
+
+  jbuf_set_gap_cb(jb, on_gap, nack);
+  e_event_add(loop, nack->timer);
+  return nack;
+}
+
+void nack_free(nack_t *nack)
+{
+  jbuf_set_gap_cb(nack->jb, NULL, NULL);
+  e_event_del(nack->loop, nack->timer);
+  e_event_free(nack->timer);
+  pthread_mutex_destroy(&nack->lock);
+  free(nack);
+}
+
+void nack_set_rtt(nack_t *nack, unsigned rtt)
+{
+  pthread_mutex_lock(&nack->lock);
+  nack->rtt = rtt;
+  pthread_mutex_unlock(&nack->lock);
+}
+
+void nack_set_rate(nack_t *nack, unsigned rate)
+{
+  pthread_mutex_lock(&nack->lock);
+  nack->rate = rate;
+  nack->tokens = 0;
+  nack->refilled = now_ms(nack);
+  pthread_mutex_unlock(&nack->lock);
+}
+
+void nack_get_stat(nack_t *nack, nack_stat_t *stat)
+{
+  pthread_mutex_lock(&nack->lock);
+  *stat = nack->stat;
+  pthread_mutex_unlock(&nack->lock);
+}
@@ -0,0 +1,69 @@
+#ifndef __NACK__
+#define __NACK__
+
+/*
+handle of a NACK generator, it is told about the gaps of a jitter buffer
+(see jbuf_set_gap_cb) and asks for the missing frames on an eloop timer;
+the retransmitted frames are put into the jitter buffer as usual and fill
+the slots still open, before they are played
+*/
+typedef struct tag_nack nack_t;
+
+/*
+callback function sending a NACK, called on the loop thread
+@nack: the generator
+@seqs: the seqs of the frames asked for, in the order of the gaps
+@count: number of seqs
+@arg: the extra data for the generator
+*/
+typedef void (*nack_send_t)(nack_t *nack,const int *seqs,unsigned count,
+                            void *arg);
+
+/*
+metrics of a generator
+@requested: number of seqs sent in NACKs, retries included
+@recovered: number of frames put after they have been asked for
+@lost: number of missing frames played, asked for or not
+*/
+typedef struct
+{
+  unsigned long requested;
+  unsigned long recovered;
+  unsigned long lost;
+} nack_stat_t;
+
+/*
+create a generator for a jitter buffer and add its timer to a loop, it
+takes over the gap callback of the jitter buffer
+@loop: the loop the timer runs on
+@jb: the jitter buffer
+@fn: the callback function sending the NACKs
+@arg: the extra data passed to fn
+*/
+nack_t* nack_new(eloop_t *loop,jbuf_t *jb,nack_send_t fn,void *arg);
+
+/*
+remove the timer and free the generator, call this on the loop thread
+(or with the loop stopped) once no frame is put into the jitter buffer
+any more
+*/
+void nack_free(nack_t *nack);
+
+/*
+set the round trip time(ms) to the sender, a frame is asked for only if
+its retransmission can come before it is played, and asked again after
+one rtt
+*/
+void nack_set_rtt(nack_t *nack,unsigned rtt);
+
+/*
+set the max number of seqs asked for per second, 0 for no limit
+*/
+void nack_set_rate(nack_t *nack,unsigned rate);
+
+/*
+get the metrics of a generator
+*/
+void nack_get_stat(nack_t *nack,nack_stat_t *stat);
+
+#endif//__NACK__
@@ -1,32 +1,77 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <arpa/inet.h>
 #include "eloop.h"
+#include "impair.h"
 
 #define PACKET_BUF_SIZE 640
 
+//period of the delivery of the impaired packets(ms)
+#define DELIVERY_TICK 1
+
+#define MAX_SCENARIOS 32
+
 eloop_t *loop;
 event_t *wtimer;
 event_t *stimer;
+event_t *dtimer;
+impair_t *gimpair;
 
 int gfd = 0;
 int num = 30;
 int count = 0;
+
+double now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 void s_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
 {
+  impair_stat_t stat;
+
   printf("send %d packets in last second\n",count);
   count = 0;
+  if (gimpair) {
+    impair_get_stat(gimpair, &stat);
+    printf("impair: sent %lu lost %lu reordered %lu duplicated %lu delivered %lu\n",
+           stat.sent, stat.lost, stat.reordered, stat.duplicated, stat.delivered);
+  }
+}
+
+//write the impaired packets due
+void d_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
+{
+  impair_pkt_t pkt;
+
+  while (impair_recv(gimpair, now_ms(), &pkt)) {
+    write(gfd,pkt.data,pkt.size);
+  }
 }
 
 void w_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
 {
+  static uint32_t seq = 0;
   char buf[PACKET_BUF_SIZE] = {0};
-  write(gfd,buf,sizeof(buf));
+  uint32_t n = htonl(++seq);
+
+  //the receiver takes the seq from the payload, the packets may be reordered
+  memcpy(buf, &n, sizeof(n));
+  if (gimpair) {
+    impair_send(gimpair, buf, sizeof(buf), seq, 0, now_ms());
+  } else {
+    write(gfd,buf,sizeof(buf));
+  }
   count++;
   num--;
 
@@ -41,9 +86,34 @@ void w_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
   }
 }
 
-int main()
+//usage: p [config [scenario]], the packets go through an impairment
+//scenario of the config file(see impair.h), the first one by default
+int main(int argc,char *argv[])
 {
+  static impair_cfg_t scenarios[MAX_SCENARIOS];
+  int n,i = 0;
+
   srand(time(0));
+  if (argc > 1) {
+    n = impair_load(argv[1], scenarios, MAX_SCENARIOS);
+    if (n <= 0) {
+      printf("%s: no scenario\n", argv[1]);
+      return -1;
+    }
+    if (argc > 2) {
+      for (i = 0; i < n && strcmp(scenarios[i].name, argv[2]); i++);
+      if (i == n) {
+        printf("%s: no scenario %s\n", argv[1], argv[2]);
+        return -1;
+      }
+    }
+    gimpair = impair_new(&scenarios[i]);
+    if (gimpair == NULL) {
+      return -1;
+    }
+    printf("scenario: %s\n", scenarios[i].name);
+  }
+
   loop = e_loop_new();
   gfd = open("/tmp/pc_fifo",O_WRONLY);
   printf("gfd:%d\n",gfd);
@@ -53,6 +123,10 @@ int main()
 
   e_event_add(loop,wtimer);
   e_event_add(loop,stimer);
+  if (gimpair) {
+    dtimer = e_event_new(E_TIMER,DELIVERY_TICK,d_callback,NULL);
+    e_event_add(loop,dtimer);
+  }
   e_loop_run(loop);
   return 0;
 }
@@ -0,0 +1,62 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "eloop.h"
+#include "jtbuf_shm.h"
+
+#define PACKET_BUF_SIZE 640
+#define PACKET_TS_STEP 320
+
+eloop_t *loop;
+event_t *wtimer;
+event_t *stimer;
+jbuf_shm_t *g_shm;
+
+int seq = 0;
+int num = 30;
+int count = 0;
+void s_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
+{
+  printf("send %d packets in last second\n",count);
+  count = 0;
+}
+
+void w_callback(eloop_t *loop,event_t *evt,long fd,void *arg)
+{
+  char buf[PACKET_BUF_SIZE] = {0};
+  jbuf_shm_put_frame(g_shm,buf,sizeof(buf),0,seq,seq*PACKET_TS_STEP);
+  seq++;
+  count++;
+  num--;
+
+  if(num){
+    int j = rand()%10;//0~99ms jitter
+    e_event_mod(loop,wtimer,20+j);
+  }else{
+    num = rand()%1000+25;//make new packets
+    int s = rand()%30+1; //sleep 0.5~15s
+    e_event_mod(loop,wtimer,500*s);
+    count = 0;
+  }
+}
+
+int main()
+{
+  srand(time(0));
+  loop = e_loop_new();
+
+  //wait for the consumer to create the shared jitter buffer
+  while(jbuf_shm_attach("/dev/shm/pc_jbuf",&g_shm) < 0)
+    sleep(1);
+
+  wtimer = e_event_new(E_TIMER,20,w_callback,NULL);
+  stimer = e_event_new(E_TIMER,1000,s_callback,NULL);
+
+  e_event_add(loop,wtimer);
+  e_event_add(loop,stimer);
+  e_loop_run(loop);
+  return 0;
+}
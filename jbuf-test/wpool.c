@@ -0,0 +1,584 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "eloop.h"
+#include "wpool.h"
+
+//slots of a worker deque, a power of 2, the jobs beyond wait in the
+//worker's backlog
+#define DEQUE_SIZE 1024
+
+//rounds a worker looks for jobs before going to sleep
+#define SPIN_ROUNDS 4
+
+typedef struct tag_wjob wjob_t;
+
+struct tag_wjob
+{
+  wjob_cb_t proc; //job function
+  wdone_cb_t done; //completion function
+  void *arg; //point to user data
+  wport_t *port; //port of the completion
+  long long submitted; //time of submission(ns)
+  long long finished; //time the job function returned(ns)
+  wjob_t *next; //link in an inbox, a backlog or a port
+};
+
+typedef struct
+{
+  wpool_t *pool;
+  int index; //worker index
+  pthread_t thread;
+  int started; //thread is started
+
+  //jobs given to the worker, pushed by any thread, taken by the worker
+  //or by a thief
+  wjob_t *inbox __attribute__((aligned(64)));
+
+  //jobs the deque had no room for, owned by the worker thread
+  wjob_t *backlog;
+  wjob_t *backlog_tail;
+
+  //the deque, pushed at the bottom by the worker, taken at the top by
+  //the worker and the thieves, so the jobs start in submission order
+  long top __attribute__((aligned(64)));
+  long bottom __attribute__((aligned(64)));
+  wjob_t *slots[DEQUE_SIZE];
+
+  //metrics, written by the worker thread only
+  unsigned long completed __attribute__((aligned(64)));
+  unsigned long steals;
+  unsigned long wait_sum; //ns
+  unsigned long wait_max; //ns
+  unsigned long run_sum; //ns
+  unsigned long run_max; //ns
+} worker_t;
+
+struct tag_wpool
+{
+  worker_t *workers;
+  int nworker;
+  unsigned long next; //worker given the next submission
+  unsigned long submitted; //bumped once the job is queued, wakes the sleepers
+  unsigned long depth; //jobs submitted and not started
+  unsigned long depth_max;
+  int sleepers; //workers waiting on cond
+  int stop; //tell the workers to exit once the jobs are run
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+struct tag_wport
+{
+  eloop_t *loop; //loop the completions are called on
+  int fd; //eventfd signalled when the list turns non empty
+  event_t *evt; //read event of fd
+  wjob_t *done; //jobs done, pushed by the workers
+
+  //metrics, loop thread only
+  unsigned long delivered;
+  unsigned long deliver_sum; //ns
+  unsigned long deliver_max; //ns
+};
+
+//worker of the calling thread, NULL out of the pools
+static __thread worker_t *self;
+
+static long long now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void max_update(unsigned long *max, unsigned long v)
+{
+  unsigned long cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+  while (v > cur && !__atomic_compare_exchange_n(max, &cur, v, 1,
+                                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+//push on a list shared by threads, return the previous head
+static wjob_t* list_push(wjob_t **head, wjob_t *job)
+{
+  wjob_t *old = __atomic_load_n(head, __ATOMIC_RELAXED);
+
+  do {
+    job->next = old;
+  } while (!__atomic_compare_exchange_n(head, &old, job, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return old;
+}
+
+//the lists are pushed at the head, turn them back to submission order
+static wjob_t* list_reverse(wjob_t *job)
+{
+  wjob_t *prev = NULL, *next;
+
+  for (; job != NULL; job = next) {
+    next = job->next;
+    job->next = prev;
+    prev = job;
+  }
+  return prev;
+}
+
+//worker thread only
+static int deque_push(worker_t *w, wjob_t *job)
+{
+  long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+
+  if (b - t >= DEQUE_SIZE) {
+    return -1;
+  }
+
+  __atomic_store_n(&w->slots[b & (DEQUE_SIZE - 1)], job, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+//any thread, a slot is read before its top is claimed, the claim fails
+//if the slot was taken meanwhile
+static wjob_t* deque_take(worker_t *w)
+{
+  long t, b;
+  wjob_t *job;
+
+  for (;;) {
+    t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+      return NULL;
+    }
+
+    job = __atomic_load_n(&w->slots[t & (DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (__atomic_compare_exchange_n(&w->top, &t, t + 1, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      return job;
+    }
+  }
+}
+
+//append a list to the backlog and move what fits into the deque,
+//worker thread only
+static void backlog_flush(worker_t *w, wjob_t *list)
+{
+  wjob_t *job, *next;
+
+  if (list != NULL) {
+    if (w->backlog == NULL) {
+      w->backlog = list;
+    }
+    else {
+      w->backlog_tail->next = list;
+    }
+    for (job = list; job->next != NULL; job = job->next);
+    w->backlog_tail = job;
+  }
+
+  //next is read first, a job pushed may be run and freed at once
+  while ((job = w->backlog) != NULL) {
+    next = job->next;
+    if (deque_push(w, job) < 0) {
+      break;
+    }
+    w->backlog = next;
+  }
+}
+
+static wjob_t* next_job(worker_t *w)
+{
+  wpool_t *pool = w->pool;
+  worker_t *v;
+  wjob_t *job;
+  int i;
+
+  backlog_flush(w, list_reverse(__atomic_exchange_n(&w->inbox, NULL, __ATOMIC_ACQUIRE)));
+  if ((job = deque_take(w)) != NULL) {
+    return job;
+  }
+
+  //steal from the deques of the others, then from their inboxes,
+  //which a worker busy with a long job doesn't drain
+  for (i = 1; i < pool->nworker; i++) {
+    v = &pool->workers[(w->index + i) % pool->nworker];
+    if ((job = deque_take(v)) != NULL) {
+      goto stolen;
+    }
+  }
+
+  for (i = 1; i < pool->nworker; i++) {
+    v = &pool->workers[(w->index + i) % pool->nworker];
+    if (__atomic_load_n(&v->inbox, __ATOMIC_RELAXED) == NULL) {
+      continue;
+    }
+    backlog_flush(w, list_reverse(__atomic_exchange_n(&v->inbox, NULL, __ATOMIC_ACQUIRE)));
+    if ((job = deque_take(w)) != NULL) {
+      goto stolen;
+    }
+  }
+
+  return NULL;
+
+ stolen:
+  __atomic_store_n(&w->steals, w->steals + 1, __ATOMIC_RELAXED);
+  return job;
+}
+
+static void run(worker_t *w, wjob_t *job)
+{
+  wport_t *port = job->port;
+  uint64_t one = 1;
+  long long start, end;
+  unsigned long wait, busy;
+
+  //the last job of a pool being freed, let the sleepers exit
+  if (__atomic_sub_fetch(&w->pool->depth, 1, __ATOMIC_SEQ_CST) == 0 &&
+      __atomic_load_n(&w->pool->stop, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&w->pool->lock);
+    pthread_cond_broadcast(&w->pool->cond);
+    pthread_mutex_unlock(&w->pool->lock);
+  }
+
+  start = now_ns();
+  job->proc(job->arg);
+  end = now_ns();
+
+  wait = start > job->submitted ? start - job->submitted : 0;
+  busy = end - start;
+  __atomic_store_n(&w->completed, w->completed + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->wait_sum, w->wait_sum + wait, __ATOMIC_RELAXED);
+  if (wait > w->wait_max) {
+    __atomic_store_n(&w->wait_max, wait, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&w->run_sum, w->run_sum + busy, __ATOMIC_RELAXED);
+  if (busy > w->run_max) {
+    __atomic_store_n(&w->run_max, busy, __ATOMIC_RELAXED);
+  }
+
+  if (port == NULL) {
+    free(job);
+    return;
+  }
+
+  //the loop takes the whole list at once, signal the first job only;
+  //job belongs to the loop once pushed, it may be freed at once
+  job->finished = end;
+  if (list_push(&port->done, job) == NULL &&
+      write(port->fd, &one, sizeof(one)) < 0) {
+    printf("write error\n");
+  }
+}
+
+//sleep until a job is submitted after the scan which found nothing,
+//seen is the submission count before it; the jobs left in the backlog of
+//a busy worker are not worth waking for, no thief can reach them;
+//a submitter seeing no sleeper is seen by the sleeper checking the count
+static void idle(wpool_t *pool, unsigned long seen)
+{
+  pthread_mutex_lock(&pool->lock);
+  __atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&pool->submitted, __ATOMIC_SEQ_CST) == seen &&
+         !(__atomic_load_n(&pool->stop, __ATOMIC_SEQ_CST) &&
+           __atomic_load_n(&pool->depth, __ATOMIC_SEQ_CST) == 0)) {
+    pthread_cond_wait(&pool->cond, &pool->lock);
+  }
+  __atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void* worker_run(void *arg)
+{
+  worker_t *w = (worker_t*) arg;
+  wpool_t *pool = w->pool;
+  unsigned long seen;
+  wjob_t *job;
+  int rounds = 0;
+
+  self = w;
+  for (;;) {
+    //read before the scan, a job queued after it changes the count
+    seen = __atomic_load_n(&pool->submitted, __ATOMIC_SEQ_CST);
+    if ((job = next_job(w)) != NULL) {
+      run(w, job);
+      rounds = 0;
+      continue;
+    }
+
+    if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE) &&
+        __atomic_load_n(&pool->depth, __ATOMIC_SEQ_CST) == 0) {
+      break;
+    }
+
+    if (++rounds < SPIN_ROUNDS) {
+      sched_yield();
+      continue;
+    }
+    idle(pool, seen);
+    rounds = 0;
+  }
+
+  return NULL;
+}
+
+wpool_t* wpool_new(int threads)
+{
+  wpool_t *pool;
+  int i;
+
+  if (threads <= 0) {
+    printf("params error\n");
+    return NULL;
+  }
+
+  pool = malloc(sizeof(wpool_t));
+  if (pool == NULL) {
+    printf("malloc error\n");
+    return NULL;
+  }
+
+  memset(pool,0,sizeof(wpool_t));
+  if (posix_memalign((void**)&pool->workers, 64, threads * sizeof(worker_t))) {
+    printf("malloc error\n");
+    free(pool);
+    return NULL;
+  }
+  memset(pool->workers, 0, threads * sizeof(worker_t));
+  pool->nworker = threads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  for (i = 0; i < threads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (pthread_create(&pool->workers[i].thread, NULL, worker_run, &pool->workers[i]) != 0) {
+      printf("pthread_create error\n");
+      wpool_free(pool);
+      return NULL;
+    }
+    pool->workers[i].started = 1;
+  }
+
+  return pool;
+}
+
+void wpool_free(wpool_t *pool)
+{
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->nworker; i++) {
+    if (pool->workers[i].started) {
+      pthread_join(pool->workers[i].thread, NULL);
+    }
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
+  free(pool->workers);
+  free(pool);
+}
+
+int wpool_submit(wpool_t *pool, wport_t *port, wjob_cb_t fn, wdone_cb_t done, void *arg)
+{
+  wjob_t *job;
+  unsigned long depth;
+
+  if (fn == NULL || (done != NULL && port == NULL)) {
+    printf("params error\n");
+    return -1;
+  }
+
+  job = malloc(sizeof(wjob_t));
+  if (job == NULL) {
+    printf("malloc error\n");
+    return -1;
+  }
+
+  memset(job,0,sizeof(wjob_t));
+  job->proc = fn;
+  job->done = done;
+  job->arg = arg;
+  job->port = port;
+  job->submitted = now_ns();
+
+  depth = __atomic_add_fetch(&pool->depth, 1, __ATOMIC_SEQ_CST);
+  max_update(&pool->depth_max, depth);
+
+  //a job submitted by a job stays on its worker, the others are spread
+  if (self != NULL && self->pool == pool) {
+    backlog_flush(self, job);
+  }
+  else {
+    list_push(&pool->workers[__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) %
+                             pool->nworker].inbox, job);
+  }
+
+  //counted once queued, so a worker seeing it sees the job
+  __atomic_add_fetch(&pool->submitted, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool->sleepers, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return 0;
+}
+
+int wpool_stat(wpool_t *pool, wpool_stat_t *stat)
+{
+  unsigned long wait_sum = 0, run_sum = 0, v;
+  worker_t *w;
+  int i;
+
+  if (stat == NULL) {
+    return -1;
+  }
+
+  memset(stat,0,sizeof(wpool_stat_t));
+  stat->threads = pool->nworker;
+  stat->submitted = __atomic_load_n(&pool->submitted, __ATOMIC_RELAXED);
+  stat->depth = __atomic_load_n(&pool->depth, __ATOMIC_RELAXED);
+  stat->depth_max = __atomic_load_n(&pool->depth_max, __ATOMIC_RELAXED);
+
+  for (i = 0; i < pool->nworker; i++) {
+    w = &pool->workers[i];
+    stat->completed += __atomic_load_n(&w->completed, __ATOMIC_RELAXED);
+    stat->steals += __atomic_load_n(&w->steals, __ATOMIC_RELAXED);
+    wait_sum += __atomic_load_n(&w->wait_sum, __ATOMIC_RELAXED);
+    run_sum += __atomic_load_n(&w->run_sum, __ATOMIC_RELAXED);
+    v = __atomic_load_n(&w->wait_max, __ATOMIC_RELAXED);
+    if (v / 1000.0 > stat->wait_max) {
+      stat->wait_max = v / 1000.0;
+    }
+    v = __atomic_load_n(&w->run_max, __ATOMIC_RELAXED);
+    if (v / 1000.0 > stat->run_max) {
+      stat->run_max = v / 1000.0;
+    }
+  }
+
+  if (stat->completed) {
+    stat->wait_avg = wait_sum / 1000.0 / stat->completed;
+    stat->run_avg = run_sum / 1000.0 / stat->completed;
+  }
+  return 0;
+}
+
+//call the completions of the jobs done, return how many
+static int port_deliver(wport_t *port)
+{
+  wjob_t *job, *next;
+  unsigned long delay;
+  int n = 0;
+
+  job = list_reverse(__atomic_exchange_n(&port->done, NULL, __ATOMIC_ACQUIRE));
+  for (; job != NULL; job = next) {
+    next = job->next;
+
+    delay = now_ns() - job->finished;
+    port->delivered++;
+    port->deliver_sum += delay;
+    if (delay > port->deliver_max) {
+      port->deliver_max = delay;
+    }
+
+    if (job->done) {
+      job->done(port->loop, job->arg);
+    }
+    free(job);
+    n++;
+  }
+  return n;
+}
+
+static void port_proc(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  uint64_t cnt;
+
+  //clear the counter before taking the list, a job done in between
+  //signals again
+  if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+    return;
+  }
+
+  port_deliver((wport_t*) arg);
+}
+
+wport_t* wport_new(eloop_t *loop)
+{
+  wport_t *port = malloc(sizeof(wport_t));
+  if (port == NULL) {
+    printf("malloc error\n");
+    return NULL;
+  }
+
+  memset(port,0,sizeof(wport_t));
+  port->loop = loop;
+  port->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (port->fd < 0) {
+    printf("eventfd error\n");
+    free(port);
+    return NULL;
+  }
+
+  port->evt = e_event_new(E_READ, port->fd, port_proc, port);
+  if (port->evt == NULL) {
+    close(port->fd);
+    free(port);
+    return NULL;
+  }
+
+  e_event_add(loop, port->evt);
+  return port;
+}
+
+int wport_drain(wport_t *port)
+{
+  uint64_t cnt;
+
+  //the signal of these jobs is consumed too
+  if (read(port->fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+    printf("read error\n");
+  }
+  return port_deliver(port);
+}
+
+void wport_free(wport_t *port)
+{
+  wjob_t *job, *next;
+
+  e_event_del(port->loop, port->evt);
+  e_event_free(port->evt);
+  close(port->fd);
+
+  for (job = port->done; job != NULL; job = next) {
+    next = job->next;
+    free(job);
+  }
+  free(port);
+}
+
+int wport_stat(wport_t *port, wport_stat_t *stat)
+{
+  if (stat == NULL) {
+    return -1;
+  }
+
+  stat->delivered = port->delivered;
+  stat->deliver_avg = port->delivered ? port->deliver_sum / 1000.0 / port->delivered : 0;
+  stat->deliver_max = port->deliver_max / 1000.0;
+  return 0;
+}
@@ -0,0 +1,121 @@
+#ifndef __WPOOL__
+#define __WPOOL__
+#include "eloop.h"
+
+/*
+handle of a worker pool, it runs blocking jobs (file I/O, codec work...)
+off the loops so their timers keep on time; each worker owns a deque
+filled from its inbox, idle workers steal from the others
+*/
+typedef struct tag_wpool wpool_t;
+
+/*
+handle of a completion port, it delivers the completions of the jobs
+to a loop, the workers signal it through an eventfd
+*/
+typedef struct tag_wport wport_t;
+
+/*
+job function, called on a worker thread
+@arg: the extra data given to wpool_submit
+*/
+typedef void (*wjob_cb_t)(void *arg);
+
+/*
+completion function, called on the loop of the port once the job is done
+@loop: the loop of the port
+@arg: the extra data given to wpool_submit
+*/
+typedef void (*wdone_cb_t)(eloop_t *loop,void *arg);
+
+/*
+metrics of a pool, the times are in us
+@threads: number of workers
+@submitted: number of jobs submitted
+@completed: number of jobs run
+@depth: number of jobs waiting for a worker
+@depth_max: max of depth
+@steals: number of times a worker took jobs given to another
+@wait_avg: average time from submission to start
+@wait_max: max time from submission to start
+@run_avg: average time of the job function
+@run_max: max time of the job function
+*/
+typedef struct
+{
+  int threads;
+  unsigned long submitted;
+  unsigned long completed;
+  unsigned long depth;
+  unsigned long depth_max;
+  unsigned long steals;
+  double wait_avg;
+  double wait_max;
+  double run_avg;
+  double run_max;
+} wpool_stat_t;
+
+/*
+metrics of a port, the times are in us
+@delivered: number of completions called
+@deliver_avg: average time from the end of a job to its completion
+@deliver_max: max time from the end of a job to its completion
+*/
+typedef struct
+{
+  unsigned long delivered;
+  double deliver_avg;
+  double deliver_max;
+} wport_stat_t;
+
+/*
+create a pool
+@threads: number of workers
+*/
+wpool_t* wpool_new(int threads);
+
+/*
+run the jobs queued, stop the workers and free the pool;
+the completions of these jobs are still posted to their ports
+*/
+void wpool_free(wpool_t *pool);
+
+/*
+create a completion port on a loop, in the loop's thread
+*/
+wport_t* wport_new(eloop_t *loop);
+
+/*
+call the completions the port holds now, without waiting for the loop,
+in the loop's thread; e.g. after wpool_free so that none is dropped
+return the number of completions called
+*/
+int wport_drain(wport_t *port);
+
+/*
+free a port, the completions not delivered yet are dropped, see
+wport_drain; no job submitted with the port may be running or queued
+*/
+void wport_free(wport_t *port);
+
+/*
+submit a job, can be called in any thread, including from a job
+@port: the port the completion goes to, NULL for none
+@fn: the job function
+@done: the completion function, NULL for none
+@arg: extra data for user,it will pass to fn and done
+return 0 on success,-1 on error
+*/
+int wpool_submit(wpool_t *pool,wport_t *port,wjob_cb_t fn,wdone_cb_t done,void *arg);
+
+/*
+get the metrics of a pool
+*/
+int wpool_stat(wpool_t *pool,wpool_stat_t *stat);
+
+/*
+get the metrics of a port, in the loop's thread
+*/
+int wport_stat(wport_t *port,wport_stat_t *stat);
+
+#endif//__WPOOL__
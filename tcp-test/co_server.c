@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "eloop.h"
+#include "coro.h"
+
+//usage: co_server [port]
+//the echo server of server.c, written with one coroutine per connection,
+//a coroutine accepting them, and one printing the counters each second
+
+#define DEFAULT_PORT 5050
+
+static long g_conns; //connections open
+static long g_bytes; //bytes echoed in the last second
+
+static void conn_proc(coro_t *co, void *arg)
+{
+  int fd = (int)(long) arg;
+  char buf[4096];
+  ssize_t n;
+
+  g_conns++;
+  while ((n = co_read(co, fd, buf, sizeof(buf))) > 0) {
+    if (co_write(co, fd, buf, n) < 0) {
+      break;
+    }
+    g_bytes += n;
+  }
+
+  g_conns--;
+  close(fd);
+}
+
+static void accept_proc(coro_t *co, void *arg)
+{
+  int fd = (int)(long) arg;
+  int cfd;
+
+  while ((cfd = co_accept(co, fd, NULL, NULL)) >= 0) {
+    if (co_spawn(co_loop(co), conn_proc, (void*)(long) cfd) < 0) {
+      close(cfd);
+    }
+  }
+
+  printf("accept error %d\n", errno);
+  e_loop_cancel(co_loop(co));
+}
+
+static void stat_proc(coro_t *co, void *arg)
+{
+  for (;;) {
+    co_sleep(co, 1000);
+    printf("connections:%ld echoed:%ld bytes/s\n", g_conns, g_bytes);
+    g_bytes = 0;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in addr;
+  int fd, on = 1;
+  eloop_t *loop;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(argc > 1 ? atoi(argv[1]) : DEFAULT_PORT);
+  addr.sin_addr.s_addr = inet_addr("0.0.0.0");
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    printf("bind error\n");
+    close(fd);
+    return -1;
+  }
+
+  if (listen(fd, 128) < 0) {
+    printf("listen error\n");
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  loop = e_loop_new();
+  if (co_spawn(loop, accept_proc, (void*)(long) fd) < 0 ||
+      co_spawn(loop, stat_proc, NULL) < 0) {
+    printf("co_spawn error\n");
+    return -1;
+  }
+
+  e_loop_run(loop);
+
+  e_loop_free(loop);
+  co_pool_clear();
+  close(fd);
+  return 0;
+}
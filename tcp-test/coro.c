@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "coro.h"
+
+//mapping of a coroutine: guard page, stack, then the coro_t at the top
+#ifndef CO_STACK_SIZE
+#define CO_STACK_SIZE (64 * 1024)
+#endif
+
+//stacks a thread keeps for its next coroutines, the rest are unmapped
+#define CO_POOL_MAX 256
+
+//hand-written switch on x86-64, ucontext elsewhere
+#if defined(__x86_64__) && !defined(CO_UCONTEXT)
+#define CO_ASM
+#endif
+
+#ifdef CO_ASM
+typedef struct
+{
+  void *sp; //the callee-saved registers and the return address are on the stack
+} co_ctx_t;
+#else
+#include <ucontext.h>
+typedef ucontext_t co_ctx_t;
+#endif
+
+struct tag_coro
+{
+  co_ctx_t ctx; //context of the coroutine
+  co_ctx_t caller; //context which resumed it
+  eloop_t *loop; //loop it suspends on
+  coro_fn_t fn; //function of the coroutine
+  void *arg; //point to user data
+  int done; //fn returned
+  event_t *rd; //read event,kept for the next wait on the same fd
+  int rd_fd;
+  event_t *wr; //write event,likewise
+  int wr_fd;
+  event_t *timer; //co_sleep timer
+  char *base; //the mapping
+  struct tag_coro *next; //next in the pool
+};
+
+//a pool per thread, a coroutine never leaves the thread of its loop
+static __thread coro_t *pool;
+static __thread int pool_count;
+
+__attribute__((visibility("hidden"))) void co_main(coro_t *co);
+
+#ifdef CO_ASM
+/*
+save the callee-saved registers of from on its stack, and restore the
+ones of to from its own, the rest are caller-saved by the ABI;
+a new context returns to co_boot which calls co_main(r12)
+*/
+__attribute__((visibility("hidden"))) void co_switch(co_ctx_t *from, co_ctx_t *to);
+__attribute__((visibility("hidden"))) void co_boot(void);
+__asm__(
+  ".text\n"
+  ".p2align 4\n"
+  ".globl co_switch\n"
+  ".hidden co_switch\n"
+  ".type co_switch,@function\n"
+  "co_switch:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq (%rsi), %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".size co_switch,.-co_switch\n"
+  ".p2align 4\n"
+  ".globl co_boot\n"
+  ".hidden co_boot\n"
+  ".type co_boot,@function\n"
+  "co_boot:\n"
+  "  movq %r12, %rdi\n"
+  "  call co_main\n"
+  "  ud2\n"
+  ".size co_boot,.-co_boot\n"
+);
+
+static void ctx_make(coro_t *co)
+{
+  //r15 r14 r13 r12 rbx rbp, the return address, and padding so that
+  //co_boot starts 16 bytes aligned, co itself is 64 bytes aligned
+  void **sp = (void**)((char*)co - 9 * sizeof(void*));
+
+  memset(sp, 0, 9 * sizeof(void*));
+  sp[3] = co;
+  sp[6] = (void*) co_boot;
+  co->ctx.sp = sp;
+}
+#else
+static void co_switch(co_ctx_t *from, co_ctx_t *to)
+{
+  swapcontext(from, to);
+}
+
+//makecontext passes ints only
+static void co_start(unsigned int lo, unsigned int hi)
+{
+  co_main((coro_t*)(uintptr_t)(((uint64_t)hi << 32) | lo));
+}
+
+static void ctx_make(coro_t *co)
+{
+  long page = sysconf(_SC_PAGESIZE);
+
+  getcontext(&co->ctx);
+  co->ctx.uc_stack.ss_sp = co->base + page;
+  co->ctx.uc_stack.ss_size = (char*)co - (co->base + page);
+  co->ctx.uc_link = NULL;
+  makecontext(&co->ctx, (void (*)(void)) co_start, 2,
+              (unsigned int)(uintptr_t)co, (unsigned int)((uint64_t)(uintptr_t)co >> 32));
+}
+#endif
+
+static coro_t* stack_get(void)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  coro_t *co;
+  char *base;
+
+  if (pool != NULL) {
+    co = pool;
+    pool = co->next;
+    pool_count--;
+    return co;
+  }
+
+  base = mmap(NULL, CO_STACK_SIZE, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (base == MAP_FAILED) {
+    printf("mmap error\n");
+    return NULL;
+  }
+
+  //the stack grows down into the guard page
+  if (mprotect(base, page, PROT_NONE) < 0) {
+    printf("mprotect error\n");
+    munmap(base, CO_STACK_SIZE);
+    return NULL;
+  }
+
+  co = (coro_t*)((uintptr_t)(base + CO_STACK_SIZE - sizeof(coro_t)) & ~(uintptr_t)63);
+  co->base = base;
+  return co;
+}
+
+static void stack_put(coro_t *co)
+{
+  if (pool_count >= CO_POOL_MAX) {
+    munmap(co->base, CO_STACK_SIZE);
+    return;
+  }
+
+  co->next = pool;
+  pool = co;
+  pool_count++;
+}
+
+static void resume(coro_t *co)
+{
+  co_switch(&co->caller, &co->ctx);
+
+  //its stack can't be released while running on it, so here
+  if (co->done) {
+    stack_put(co);
+  }
+}
+
+static void suspend(coro_t *co)
+{
+  co_switch(&co->ctx, &co->caller);
+}
+
+void co_main(coro_t *co)
+{
+  co->fn(co, co->arg);
+
+  //the events are deleted on each wakeup
+  if (co->rd) e_event_free(co->rd);
+  if (co->wr) e_event_free(co->wr);
+  if (co->timer) e_event_free(co->timer);
+  co->done = 1;
+  suspend(co);
+}
+
+static void wake(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  resume((coro_t*) arg);
+}
+
+//suspend until fd is ready,the event is reused while the fd is the same
+static int wait_fd(coro_t *co, event_t **evt, int *efd, int type, int fd)
+{
+  if (*evt == NULL || *efd != fd) {
+    if (*evt) {
+      e_event_free(*evt);
+    }
+    *evt = e_event_new(type, fd, wake, co);
+    if (*evt == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    *efd = fd;
+  }
+
+  e_event_add(co->loop, *evt);
+  suspend(co);
+  e_event_del(co->loop, *evt);
+  return 0;
+}
+
+int co_spawn(eloop_t *loop, coro_fn_t fn, void *arg)
+{
+  coro_t *co = stack_get();
+  char *base;
+
+  if (co == NULL) {
+    return -1;
+  }
+
+  base = co->base;
+  memset(co, 0, sizeof(coro_t));
+  co->base = base;
+  co->loop = loop;
+  co->fn = fn;
+  co->arg = arg;
+  co->rd_fd = -1;
+  co->wr_fd = -1;
+  ctx_make(co);
+
+  //run until it first suspends
+  resume(co);
+  return 0;
+}
+
+eloop_t* co_loop(coro_t *co)
+{
+  return co->loop;
+}
+
+ssize_t co_read(coro_t *co, int fd, void *buf, size_t count)
+{
+  ssize_t n;
+
+  //try first, the data is often there already
+  for (;;) {
+    n = read(fd, buf, count);
+    if (n >= 0) {
+      return n;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+        wait_fd(co, &co->rd, &co->rd_fd, E_READ, fd) < 0) {
+      return -1;
+    }
+  }
+}
+
+ssize_t co_write(coro_t *co, int fd, const void *buf, size_t count)
+{
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < count) {
+    n = write(fd, (const char*)buf + done, count - done);
+    if (n >= 0) {
+      done += n;
+      continue;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+        wait_fd(co, &co->wr, &co->wr_fd, E_WRITE, fd) < 0) {
+      return -1;
+    }
+  }
+  return count;
+}
+
+int co_accept(coro_t *co, int fd, struct sockaddr *addr, socklen_t *len)
+{
+  int cfd;
+
+  for (;;) {
+    cfd = accept4(fd, addr, len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd >= 0) {
+      return cfd;
+    }
+    if (errno == EINTR || errno == ECONNABORTED) {
+      continue;
+    }
+    if ((errno != EAGAIN && errno != EWOULDBLOCK) ||
+        wait_fd(co, &co->rd, &co->rd_fd, E_READ, fd) < 0) {
+      return -1;
+    }
+  }
+}
+
+void co_sleep(coro_t *co, long ms)
+{
+  if (ms < 0) {
+    ms = 0;
+  }
+
+  if (co->timer == NULL) {
+    co->timer = e_event_new(E_TIMER, ms, wake, co);
+    if (co->timer == NULL) {
+      return;
+    }
+  }
+  else {
+    e_event_mod(co->loop, co->timer, ms);
+  }
+
+  e_event_add(co->loop, co->timer);
+  suspend(co);
+  e_event_del(co->loop, co->timer);
+}
+
+void co_pool_clear(void)
+{
+  coro_t *co;
+
+  while ((co = pool) != NULL) {
+    pool = co->next;
+    munmap(co->base, CO_STACK_SIZE);
+  }
+  pool_count = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef __CORO__
+#define __CORO__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "eloop.h"
+
+/*
+handle of a coroutine,a stackful coroutine runs on a loop, in the loop's
+thread only, and suspends on the loop's events rather than blocking it;
+it is freed when its function returns
+*/
+typedef struct tag_coro coro_t;
+
+/*
+function of a coroutine
+@co: the coroutine itself,pass it to the co_xxx routines
+@arg: the extra data given to co_spawn
+*/
+typedef void (*coro_fn_t)(coro_t *co,void *arg);
+
+/*
+create a coroutine and run it until it first suspends,
+can be called in the loop's thread only, from a coroutine or not;
+the stack is taken from a pool of the thread, with a guard page
+below it, so an overflow faults rather than corrupting memory
+@loop: the loop the coroutine suspends on
+@fn: the function of the coroutine
+@arg: extra data for user,it will pass to fn
+return 0 on success,-1 on error
+*/
+int co_spawn(eloop_t *loop,coro_fn_t fn,void *arg);
+
+/*
+the loop of a coroutine
+*/
+eloop_t* co_loop(coro_t *co);
+
+/*
+read from a nonblocking fd,suspend until it is readable
+return the bytes read,0 at the end of file,-1 on error
+*/
+ssize_t co_read(coro_t *co,int fd,void *buf,size_t count);
+
+/*
+write all of buf to a nonblocking fd,suspend while it is not writable
+return count,-1 on error
+*/
+ssize_t co_write(coro_t *co,int fd,const void *buf,size_t count);
+
+/*
+accept a connection on a nonblocking listening fd,
+suspend until one is pending;
+return the fd of the connection,nonblocking,-1 on error
+*/
+int co_accept(coro_t *co,int fd,struct sockaddr *addr,socklen_t *len);
+
+/*
+suspend for ms,0 gives the other events of the loop a round
+*/
+void co_sleep(coro_t *co,long ms);
+
+/*
+unmap the stacks pooled by the calling thread,
+call it before a thread which ran coroutines exits
+*/
+void co_pool_clear(void);
+
+#endif//__CORO__
@@ -0,0 +1,567 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+#include "eloop.h"
+
+//usage: eloop_bench [-c] [-b backend]
+//  -c  csv output, one line per result
+//  -b  run one backend only
+//benchmarks of the event loop, on pipes only, no network needed:
+//  timer_add/timer_del: insert/cancel N timers, no loop running
+//  timer_fire: N timers due at once, fired and deleted by the loop
+//  dispatch: iterations of a loop with idle pipes plus K active ones
+//  churn: add+del of a read event while idle pipes are registered
+//  wakeup: another thread writes to a pipe the loop sleeps on
+//latencies are from the time a callback is due (timer added, byte
+//written) to the callback
+
+//loop iterations timed by the dispatch benchmark
+#define DISPATCH_ITERATIONS 2000
+
+#define CHURN_OPS 20000
+
+#define WAKEUPS 2000
+
+//pause of the waker thread, so the loop is asleep in the backend
+#define WAKEUP_PAUSE_US 200
+
+//fds of the process not used by the benchmark
+#define SPARE_FDS 16
+
+typedef struct
+{
+  const char *name;
+  eloop_t* (*create)(void);
+  long max_fd; //highest fd the backend can watch + 1, 0 if no limit
+} backend_t;
+
+typedef struct
+{
+  eloop_t *loop;
+  unsigned long count; //callbacks to go
+  unsigned long fired;
+  double *lat; //latency samples(us)
+  double start; //when the timers were added(ns)
+} timer_ctx_t;
+
+typedef struct
+{
+  eloop_t *loop;
+  event_t *tick;
+  int *rfd; //active pipes, read end
+  int *wfd; //active pipes, write end
+  unsigned active;
+  unsigned long iterations;
+  unsigned long callbacks;
+  double written; //when the active pipes were written(ns)
+  double *lat;
+  unsigned long nlat;
+} dispatch_ctx_t;
+
+typedef struct
+{
+  eloop_t *loop;
+  int rfd;
+  int wfd;
+  unsigned long count;
+  double *lat;
+} wakeup_ctx_t;
+
+//every backend is benchmarked, add an entry per new one
+static const backend_t backends[] = {
+  {"select", e_loop_new, FD_SETSIZE},
+};
+
+static const unsigned long timer_counts[] = {100,1000,10000,100000,1000000};
+static const unsigned idle_counts[] = {10,100,500,1000,10000,50000};
+static const unsigned active_counts[] = {1,10,100};
+
+static int csv = 0;
+
+static double now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+//p99 of the samples(us), the samples are sorted
+static double p99(double *lat, unsigned long n)
+{
+  if (n == 0) {
+    return -1;
+  }
+  qsort(lat, n, sizeof(double), cmp_double);
+  return lat[(n * 99 - 1) / 100];
+}
+
+static void report(const backend_t *b, const char *bench, unsigned long n,
+                   unsigned active, double ops_per_sec, double lat_p99)
+{
+  char lat[32] = "";
+
+  //no latency measured
+  if (lat_p99 >= 0) {
+    snprintf(lat, sizeof(lat), "%.1f", lat_p99);
+  }
+  if (csv) {
+    printf("%s,%s,%lu,%u,%.0f,%s\n", b->name, bench, n, active,
+           ops_per_sec, lat);
+  } else {
+    printf("%-8s %-10s %8lu %6u %14.0f %10s\n", b->name, bench, n, active,
+           ops_per_sec, lat[0] ? lat : "-");
+  }
+}
+
+static void skip(const backend_t *b, const char *bench, unsigned long n,
+                 unsigned active, const char *why)
+{
+  if (csv) {
+    printf("%s,%s,%lu,%u,,\n", b->name, bench, n, active);
+  } else {
+    printf("%-8s %-10s %8lu %6u %14s %10s  %s\n", b->name, bench, n, active,
+           "-", "-", why);
+  }
+}
+
+//more fds than the backend can watch, see make_pipes
+static int too_many_fds(const backend_t *b, unsigned idle, unsigned active)
+{
+  return b->max_fd && (long)(idle + 1 + active * 2 + SPARE_FDS) > b->max_fd;
+}
+
+static void cancel_cb(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  e_loop_cancel(loop);
+}
+
+//run the loop once, it frees the holds of the deleted events
+static void drain(eloop_t *loop)
+{
+  event_t *e = e_event_new(E_TIMER, 0, cancel_cb, NULL);
+
+  e_event_add(loop, e);
+  e_loop_run(loop);
+  e_event_free(e);
+}
+
+static void close_pipes(unsigned n, int *rfd, int *wfd)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++) {
+    if (rfd[i] >= 0) {
+      close(rfd[i]);
+    }
+    if (wfd[i] >= 0) {
+      close(wfd[i]);
+    }
+  }
+}
+
+//'idle' read ends never written, then 'active' pipes; the idle ones are
+//dups of the read end of a single pipe, so they take one fd each and
+//more of them fit under the limit of the backend
+static int make_pipes(unsigned idle, unsigned active, int *rfd, int *wfd)
+{
+  int fds[2];
+  unsigned i;
+
+  for (i = 0; i < idle + active; i++) {
+    rfd[i] = wfd[i] = -1;
+  }
+  for (i = 0; i < idle + active; i++) {
+    if (i > 0 && i < idle) {
+      rfd[i] = dup(rfd[0]);
+      if (rfd[i] < 0) {
+        close_pipes(idle + active, rfd, wfd);
+        return -1;
+      }
+      continue;
+    }
+    if (pipe(fds) != 0) {
+      close_pipes(idle + active, rfd, wfd);
+      return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    rfd[i] = fds[0];
+    wfd[i] = fds[1];
+  }
+  return 0;
+}
+
+static void idle_cb(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+}
+
+static void fire_cb(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  timer_ctx_t *ctx = (timer_ctx_t*) arg;
+
+  ctx->lat[ctx->fired++] = (now_ns() - ctx->start) / 1000;
+  e_event_del(loop, evt);
+  if (--ctx->count == 0) {
+    e_loop_cancel(loop);
+  }
+}
+
+static void bench_timers(const backend_t *b, unsigned long n)
+{
+  eloop_t *loop;
+  event_t **evts;
+  timer_ctx_t ctx;
+  double t0, t1;
+  unsigned long i;
+
+  loop = b->create();
+  evts = malloc(n * sizeof(event_t*));
+  ctx.lat = malloc(n * sizeof(double));
+  if (loop == NULL || evts == NULL || ctx.lat == NULL) {
+    printf("malloc error\n");
+    goto out;
+  }
+  ctx.loop = loop;
+  ctx.count = n;
+  ctx.fired = 0;
+  //far away, so none fires before timer_fire
+  for (i = 0; i < n; i++) {
+    evts[i] = e_event_new(E_TIMER, 3600000, fire_cb, &ctx);
+  }
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    e_event_add(loop, evts[i]);
+  }
+  t1 = now_ns();
+  report(b, "timer_add", n, 0, n / ((t1 - t0) / 1e9), -1);
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    e_event_del(loop, evts[i]);
+  }
+  t1 = now_ns();
+  report(b, "timer_del", n, 0, n / ((t1 - t0) / 1e9), -1);
+  drain(loop);
+
+  //all due at once, the latency is the wait behind the other callbacks
+  for (i = 0; i < n; i++) {
+    e_event_mod(loop, evts[i], 0);
+  }
+  ctx.start = t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    e_event_add(loop, evts[i]);
+  }
+  e_loop_run(loop);
+  t1 = now_ns();
+  report(b, "timer_fire", n, 0, ctx.fired / ((t1 - t0) / 1e9),
+         p99(ctx.lat, ctx.fired));
+
+  for (i = 0; i < n; i++) {
+    e_event_free(evts[i]);
+  }
+
+out:
+  free(ctx.lat);
+  free(evts);
+  if (loop) {
+    e_loop_free(loop);
+  }
+}
+
+static void active_cb(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  dispatch_ctx_t *ctx = (dispatch_ctx_t*) arg;
+  char buf[64];
+
+  if (read(fd, buf, sizeof(buf)) > 0 && ctx->nlat < DISPATCH_ITERATIONS * ctx->active) {
+    ctx->lat[ctx->nlat++] = (now_ns() - ctx->written) / 1000;
+  }
+  ctx->callbacks++;
+}
+
+//a 0 ms timer fires on every iteration, it makes the active pipes ready
+//for the next one
+static void tick_cb(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  dispatch_ctx_t *ctx = (dispatch_ctx_t*) arg;
+  unsigned i;
+
+  if (++ctx->iterations > DISPATCH_ITERATIONS) {
+    e_loop_cancel(loop);
+    return;
+  }
+  ctx->written = now_ns();
+  for (i = 0; i < ctx->active; i++) {
+    if (write(ctx->wfd[i], "x", 1) != 1) {
+      printf("write error\n");
+    }
+  }
+}
+
+static void bench_dispatch(const backend_t *b, unsigned idle, unsigned active)
+{
+  dispatch_ctx_t ctx;
+  event_t **evts = NULL;
+  int *rfd, *wfd;
+  unsigned n = idle + active, i;
+  double t0, t1;
+
+  if (too_many_fds(b, idle, active)) {
+    skip(b, "dispatch", idle, active, "too many fds");
+    return;
+  }
+
+  memset(&ctx, 0, sizeof(ctx));
+  rfd = malloc(n * sizeof(int));
+  wfd = malloc(n * sizeof(int));
+  evts = calloc(n, sizeof(event_t*));
+  ctx.lat = malloc((unsigned long)DISPATCH_ITERATIONS * active * sizeof(double));
+  ctx.loop = b->create();
+  if (rfd == NULL || wfd == NULL || evts == NULL || ctx.lat == NULL ||
+      ctx.loop == NULL) {
+    printf("malloc error\n");
+    goto out;
+  }
+  if (make_pipes(idle, active, rfd, wfd) != 0) {
+    skip(b, "dispatch", idle, active, strerror(errno));
+    goto out;
+  }
+
+  //the active pipes are the last ones, with the highest fds
+  ctx.rfd = rfd + idle;
+  ctx.wfd = wfd + idle;
+  ctx.active = active;
+  for (i = 0; i < n; i++) {
+    evts[i] = e_event_new(E_READ, rfd[i], i < idle ? idle_cb : active_cb, &ctx);
+    e_event_add(ctx.loop, evts[i]);
+  }
+  ctx.tick = e_event_new(E_TIMER, 0, tick_cb, &ctx);
+  e_event_add(ctx.loop, ctx.tick);
+
+  t0 = now_ns();
+  e_loop_run(ctx.loop);
+  t1 = now_ns();
+  report(b, "dispatch", idle, active, DISPATCH_ITERATIONS / ((t1 - t0) / 1e9),
+         p99(ctx.lat, ctx.nlat));
+
+  e_event_free(ctx.tick);
+  for (i = 0; i < n; i++) {
+    e_event_free(evts[i]);
+  }
+  close_pipes(n, rfd, wfd);
+
+out:
+  free(ctx.lat);
+  free(evts);
+  free(rfd);
+  free(wfd);
+  if (ctx.loop) {
+    e_loop_free(ctx.loop);
+  }
+}
+
+static void bench_churn(const backend_t *b, unsigned idle)
+{
+  eloop_t *loop;
+  event_t **evts = NULL, *e;
+  int *rfd, *wfd;
+  unsigned n = idle + 1, i;
+  double t0, t1;
+
+  if (too_many_fds(b, idle, 1)) {
+    skip(b, "churn", idle, 1, "too many fds");
+    return;
+  }
+
+  loop = b->create();
+  rfd = malloc(n * sizeof(int));
+  wfd = malloc(n * sizeof(int));
+  evts = calloc(n, sizeof(event_t*));
+  if (loop == NULL || rfd == NULL || wfd == NULL || evts == NULL) {
+    printf("malloc error\n");
+    goto out;
+  }
+  if (make_pipes(idle, 1, rfd, wfd) != 0) {
+    skip(b, "churn", idle, 1, strerror(errno));
+    goto out;
+  }
+
+  for (i = 0; i < idle; i++) {
+    evts[i] = e_event_new(E_READ, rfd[i], idle_cb, NULL);
+    e_event_add(loop, evts[i]);
+  }
+  e = evts[idle] = e_event_new(E_READ, rfd[idle], idle_cb, NULL);
+
+  t0 = now_ns();
+  for (i = 0; i < CHURN_OPS; i++) {
+    e_event_add(loop, e);
+    e_event_del(loop, e);
+  }
+  t1 = now_ns();
+  report(b, "churn", idle, 1, CHURN_OPS / ((t1 - t0) / 1e9), -1);
+
+  drain(loop);
+  for (i = 0; i < n; i++) {
+    e_event_free(evts[i]);
+  }
+  close_pipes(n, rfd, wfd);
+
+out:
+  free(evts);
+  free(rfd);
+  free(wfd);
+  if (loop) {
+    e_loop_free(loop);
+  }
+}
+
+static void wakeup_cb(eloop_t *loop, event_t *evt, long fd, void *arg)
+{
+  wakeup_ctx_t *ctx = (wakeup_ctx_t*) arg;
+  double sent;
+
+  while (read(fd, &sent, sizeof(sent)) == sizeof(sent)) {
+    if (sent < 0) {
+      e_loop_cancel(loop);
+      return;
+    }
+    if (ctx->count < WAKEUPS) {
+      ctx->lat[ctx->count++] = (now_ns() - sent) / 1000;
+    }
+  }
+}
+
+static void* waker_run(void *arg)
+{
+  wakeup_ctx_t *ctx = (wakeup_ctx_t*) arg;
+  struct timespec pause = {0, WAKEUP_PAUSE_US * 1000};
+  double sent;
+  int i;
+
+  for (i = 0; i <= WAKEUPS; i++) {
+    nanosleep(&pause, NULL);
+    //a negative time stops the loop
+    sent = i < WAKEUPS ? now_ns() : -1;
+    if (write(ctx->wfd, &sent, sizeof(sent)) != sizeof(sent)) {
+      printf("write error\n");
+    }
+  }
+  return NULL;
+}
+
+static void bench_wakeup(const backend_t *b)
+{
+  wakeup_ctx_t ctx;
+  event_t *e;
+  pthread_t tid;
+  double t0, t1;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.loop = b->create();
+  ctx.lat = malloc(WAKEUPS * sizeof(double));
+  if (ctx.loop == NULL || ctx.lat == NULL ||
+      make_pipes(0, 1, &ctx.rfd, &ctx.wfd) != 0) {
+    printf("malloc error\n");
+    goto out;
+  }
+
+  e = e_event_new(E_READ, ctx.rfd, wakeup_cb, &ctx);
+  e_event_add(ctx.loop, e);
+  if (pthread_create(&tid, NULL, waker_run, &ctx) != 0) {
+    printf("pthread_create error\n");
+    e_event_del(ctx.loop, e);
+    e_event_free(e);
+    close_pipes(1, &ctx.rfd, &ctx.wfd);
+    goto out;
+  }
+
+  t0 = now_ns();
+  e_loop_run(ctx.loop);
+  t1 = now_ns();
+  pthread_join(tid, NULL);
+  report(b, "wakeup", WAKEUPS, 1, ctx.count / ((t1 - t0) / 1e9),
+         p99(ctx.lat, ctx.count));
+
+  e_event_free(e);
+  close_pipes(1, &ctx.rfd, &ctx.wfd);
+
+out:
+  free(ctx.lat);
+  if (ctx.loop) {
+    e_loop_free(ctx.loop);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const char *only = NULL;
+  struct rlimit rl;
+  unsigned i, j, k;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "cb:")) != -1) {
+    switch (opt) {
+    case 'c':
+      csv = 1;
+      break;
+    case 'b':
+      only = optarg;
+      break;
+    default:
+      printf("usage: eloop_bench [-c] [-b backend]\n");
+      return 1;
+    }
+  }
+
+  //as many fds as allowed, for the idle pipes
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  if (csv) {
+    printf("backend,bench,n,active,ops_per_sec,p99_us\n");
+  } else {
+    printf("%-8s %-10s %8s %6s %14s %10s\n", "backend", "bench", "n",
+           "active", "ops/s", "p99(us)");
+  }
+
+  for (k = 0; k < sizeof(backends) / sizeof(backends[0]); k++) {
+    const backend_t *b = &backends[k];
+
+    if (only && strcmp(only, b->name)) {
+      continue;
+    }
+
+    for (i = 0; i < sizeof(timer_counts) / sizeof(timer_counts[0]); i++) {
+      bench_timers(b, timer_counts[i]);
+    }
+
+    for (i = 0; i < sizeof(idle_counts) / sizeof(idle_counts[0]); i++) {
+      for (j = 0; j < sizeof(active_counts) / sizeof(active_counts[0]); j++) {
+        bench_dispatch(b, idle_counts[i], active_counts[j]);
+      }
+    }
+
+    for (i = 0; i < sizeof(idle_counts) / sizeof(idle_counts[0]); i++) {
+      bench_churn(b, idle_counts[i]);
+    }
+
+    bench_wakeup(b);
+  }
+  return 0;
+}
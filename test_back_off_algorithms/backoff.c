@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include "backoff.h"
+
+//2^attempt stops growing there, base*2^31 is past any cap
+#define MAX_SHIFT 31
+
+//random in [lo,hi]
+static unsigned int between(backoff_t *b,unsigned int lo,unsigned int hi)
+{
+  if(hi <= lo)
+    return lo;
+  return lo + (unsigned int)((double)rand_r(&b->seed) / ((double)RAND_MAX + 1) * (hi - lo + 1));
+}
+
+//min(cap,base*2^attempt)
+static unsigned int expo(backoff_t *b)
+{
+  unsigned long long v = (unsigned long long)b->base << (b->attempt < MAX_SHIFT ? b->attempt : MAX_SHIFT);
+  return v > b->cap ? b->cap : (unsigned int)v;
+}
+
+void backoff_init(backoff_t *b,int algo,unsigned int base,unsigned int cap,unsigned int seed)
+{
+  b->algo = algo;
+  b->base = base;
+  b->cap = cap < base ? base : cap;
+  b->seed = seed;
+  backoff_reset(b);
+}
+
+void backoff_reset(backoff_t *b)
+{
+  b->attempt = 0;
+  b->prev = b->base;
+}
+
+unsigned int backoff_next(backoff_t *b)
+{
+  unsigned int v;
+
+  switch(b->algo){
+  case BACKOFF_FIXED:
+    v = b->base;
+    break;
+  case BACKOFF_UNIFORM:
+    v = between(b,b->base,b->cap);
+    break;
+  case BACKOFF_EXPO:
+    v = expo(b);
+    break;
+  case BACKOFF_FULL_JITTER:
+    v = between(b,0,expo(b));
+    break;
+  case BACKOFF_EQUAL_JITTER:
+    v = expo(b);
+    v = v / 2 + between(b,0,v - v / 2);
+    break;
+  case BACKOFF_DECORRELATED:
+    //grows from the last delay rather than from the attempt count
+    v = between(b,b->base,b->prev > b->cap / 3 ? b->cap : b->prev * 3);
+    break;
+  default:
+    v = b->base;
+    break;
+  }
+
+  if(b->attempt < MAX_SHIFT)
+    b->attempt++;
+  b->prev = v;
+  return v;
+}
+
+unsigned int backoff_schedule(eloop_t *loop,event_t *evt,backoff_t *b)
+{
+  unsigned int v = backoff_next(b);
+  e_mod_timer_event(loop,evt,v / 1000,(v % 1000) * 1000);
+  return v;
+}
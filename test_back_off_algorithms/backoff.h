@@ -0,0 +1,62 @@
+#ifndef __BACKOFF__
+#define __BACKOFF__
+#include "eloop.h"
+
+/*
+back-off algorithms, the delay before the next attempt(ms):
+BACKOFF_FIXED: base
+BACKOFF_UNIFORM: random in [base,cap]
+BACKOFF_EXPO: min(cap,base*2^attempt), no jitter
+BACKOFF_FULL_JITTER: random in [0,min(cap,base*2^attempt)]
+BACKOFF_EQUAL_JITTER: half of min(cap,base*2^attempt), plus random in
+                      [0,the other half]
+BACKOFF_DECORRELATED: min(cap,random in [base,previous delay*3])
+*/
+enum{
+  BACKOFF_FIXED,
+  BACKOFF_UNIFORM,
+  BACKOFF_EXPO,
+  BACKOFF_FULL_JITTER,
+  BACKOFF_EQUAL_JITTER,
+  BACKOFF_DECORRELATED
+};
+
+/*
+state of a back-off, one per client, not thread safe;
+the fields are internal use only
+*/
+typedef struct
+{
+  int algo;
+  unsigned int base; //ms
+  unsigned int cap; //ms
+  unsigned int attempt; //attempts since the last reset
+  unsigned int prev; //last delay(ms)
+  unsigned int seed; //rand_r state
+}backoff_t;
+
+/*
+init a back-off
+@algo: BACKOFF_XXX
+@base: the base delay(ms)
+@cap: the max delay(ms), not used by BACKOFF_FIXED
+@seed: seed of the random delays, give each client its own
+*/
+void backoff_init(backoff_t *b,int algo,unsigned int base,unsigned int cap,unsigned int seed);
+
+/*
+get the delay(ms) before the next attempt, and count the attempt
+*/
+unsigned int backoff_next(backoff_t *b);
+
+/*
+the attempt succeeded, start again from the base delay
+*/
+void backoff_reset(backoff_t *b);
+
+/*
+rearm a timer event with the next delay, return the delay(ms)
+*/
+unsigned int backoff_schedule(eloop_t *loop,event_t *evt,backoff_t *b);
+
+#endif//__BACKOFF__
@@ -17,13 +17,7 @@ typedef struct
 static void print_count(eloop_t *loop)
 {
   hold_t *h;
-  int timers = 0,read_fds = 0, write_fds = 0;
-
-  list_for_each_entry(h,&loop->timer_head,list){
-      if(h->ptr){
-        timers++;
-      }
-  }
+  int timers = loop->timer_count,read_fds = 0, write_fds = 0;
 
   list_for_each_entry(h,&loop->read_head,list){
       if(h->ptr){
@@ -64,30 +58,111 @@ static void recalculate_max_fd(eloop_t *loop)
     }
 }
 
-static void timer_next(eloop_t *loop,struct timeval *tv)
+static void heap_swap(eloop_t *loop,int i,int j)
 {
-    hold_t *h;
-    event_t *e,*p = NULL;
-    struct timeval now;
+    event_t *e = loop->timers[i];
 
-    //get first timer
-    list_for_each_entry(h,&loop->timer_head,list){
-      //printf("h->ptr:%p\n",h->ptr);
-      if(h->ptr){
-        p = (event_t*)h->ptr;
-        //printf("%d:%d\n",p->timeout.tv_sec,p->timeout.tv_usec);
+    loop->timers[i] = loop->timers[j];
+    loop->timers[j] = e;
+    loop->timers[i]->index = i;
+    loop->timers[j]->index = j;
+}
+
+static void heap_up(eloop_t *loop,int i)
+{
+    while(i > 0 && timercmp(&loop->timers[i]->timeout,&loop->timers[(i - 1) / 2]->timeout,<)){
+      heap_swap(loop,i,(i - 1) / 2);
+      i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(eloop_t *loop,int i)
+{
+    int c;
+
+    while((c = 2 * i + 1) < loop->timer_count){
+      if(c + 1 < loop->timer_count &&
+         timercmp(&loop->timers[c + 1]->timeout,&loop->timers[c]->timeout,<))
+        c++;
+      if(!timercmp(&loop->timers[c]->timeout,&loop->timers[i]->timeout,<))
         break;
-      }
+      heap_swap(loop,i,c);
+      i = c;
     }
+}
 
-    //find minimum timeout timer
-    list_for_each_entry(h,&loop->timer_head,list){
-      if(h->ptr){
-        e = (event_t*)h->ptr;
-        if(timercmp(&e->timeout, &p->timeout,<)){
-          p = e;
-        }
-      }
+static int heap_push(eloop_t *loop,event_t *e)
+{
+    event_t **p;
+
+    if(loop->timer_count == loop->timer_size){
+      p = realloc(loop->timers,(loop->timer_size ? loop->timer_size * 2 : 64) * sizeof(event_t*));
+      if(p == NULL)
+        return -1;
+      loop->timers = p;
+      loop->timer_size = loop->timer_size ? loop->timer_size * 2 : 64;
+    }
+
+    e->index = loop->timer_count++;
+    loop->timers[e->index] = e;
+    heap_up(loop,e->index);
+    return 0;
+}
+
+static void heap_remove(eloop_t *loop,event_t *e)
+{
+    int i = e->index;
+
+    if(i != --loop->timer_count){
+      heap_swap(loop,i,loop->timer_count);
+      heap_down(loop,i);
+      heap_up(loop,i);
+    }
+}
+
+//monotonic, setting the wall clock doesn't fire or stall the timers
+static void monotonic(struct timeval *tv)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+}
+
+void e_get_time(eloop_t* loop,struct timeval *tv)
+{
+    if(loop->virtual_time)
+      *tv = loop->now;
+    else if(loop->clock)
+      loop->clock(tv,loop->clock_arg);
+    else
+      monotonic(tv);
+}
+
+void e_set_clock(eloop_t* loop,clock_fn_t fn,void *arg)
+{
+    loop->clock = fn;
+    loop->clock_arg = arg;
+    loop->virtual_time = 0;
+}
+
+void e_set_virtual_time(eloop_t* loop,const struct timeval *start)
+{
+    loop->virtual_time = 1;
+    loop->now = *start;
+}
+
+static void timer_next(eloop_t *loop,struct timeval *tv)
+{
+    event_t *p = loop->timer_count ? loop->timers[0] : NULL;
+    struct timeval now;
+
+    //virtual time doesn't wait, it goes to the first timer
+    if(loop->virtual_time){
+      if(p && timercmp(&p->timeout, &loop->now, >))
+        loop->now = p->timeout;
+      timerclear(tv);
+      return;
     }
 
     //if timer list is empty,use default tv(5S)
@@ -95,7 +170,7 @@ static void timer_next(eloop_t *loop,struct timeval *tv)
       tv->tv_sec = 5;
       tv->tv_usec = 0;
     }else{
-      gettimeofday(&now, NULL);
+      e_get_time(loop,&now);
       if(timercmp(&p->timeout, &now, <=)){
         timerclear(tv);
       }else{
@@ -143,35 +218,29 @@ static void process_fds(struct list_head *rw_head,fd_set *fds,fd_set *origin)
 
 static void process_timer(eloop_t *loop)
 {
-    hold_t *h,*t;
     event_t *e;
     struct timeval now,tv;
 
-    gettimeofday(&now, NULL);
-
-    list_for_each_entry_safe(h,t,&loop->timer_head,list){
-      /*the hold point to NULL should be delete and free*/
-      if(h->ptr == NULL){
-          list_del(&h->list);
-          free(h);
-          continue;
-      }
+    e_get_time(loop,&now);
+    loop->round++;
 
-      e = (event_t*)h->ptr;
+    //a timer fires once per round, even when its interval is 0 or when
+    //a callback adds it again
+    while(loop->timer_count > 0){
+      e = loop->timers[0];
+      if(timercmp(&now,&e->timeout, <) || e->round == loop->round)
+        break;
 
-      if(timercmp(&now,&e->timeout, >=)){
-        //proc timer
-        e->proc(e);
+      //recalculate next expire time first, the callback may delete or
+      //modify the timer
+      e->round = loop->round;
+      tv.tv_sec = e->secs;
+      tv.tv_usec = e->usecs;
+      timeradd(&now, &tv, &e->timeout);
+      heap_down(loop,0);
 
-        //h->ptr not null indicates the timer still alive otherwise e is not valid
-        if(h->ptr){
-          //recalculate next expire time
-          tv.tv_sec = e->secs;
-          tv.tv_usec = e->usecs;
-          //printf("%d,%d\n",e->secs,e->usecs);
-          timeradd(&now, &tv, &e->timeout);
-        }
-      }
+      //proc timer
+      e->proc(e);
     }
 }
 
@@ -213,7 +282,6 @@ void* e_get_event_arg(event_t *e)
 void e_init(eloop_t* loop)
 {
     memset(loop,0,sizeof(*loop));
-    INIT_LIST_HEAD(&loop->timer_head);
     INIT_LIST_HEAD(&loop->read_head);
     INIT_LIST_HEAD(&loop->write_head);
     FD_ZERO(&loop->read_set);/*初始化描述符集*/
@@ -230,6 +298,24 @@ void e_add_event(eloop_t* loop,event_t *e)
       return;
     }
 
+    if(e->flag & F_TIMER){
+        //caculate next expire time
+        struct timeval now,tv;
+        tv.tv_sec = e->secs;
+        tv.tv_usec = e->usecs;
+        e_get_time(loop,&now);
+        timeradd(&now, &tv, &e->timeout);
+        //not fired before the next round, when added by a timer callback
+        e->round = loop->round;
+        //add to timer heap
+        if(heap_push(loop,e) != 0){
+          printf("malloc error");
+          return;
+        }
+        e->flag |= F_ADD;
+        return;
+    }
+
     h = malloc(sizeof(hold_t));
     if(h == NULL)
     {
@@ -241,27 +327,16 @@ void e_add_event(eloop_t* loop,event_t *e)
     h->ptr = e;
     e->ptr = h;
 
-    if(e->flag & F_TIMER){
-        //caculate next expire time
-        struct timeval now,tv;
-        tv.tv_sec = e->secs;
-        tv.tv_usec = e->usecs;
-        gettimeofday(&now, NULL);
-        timeradd(&now, &tv, &e->timeout);
-        //add to hold list
-        list_add(&h->list,&loop->timer_head);
-    }else{
-      if(e->fd > loop->max_fd){
-        loop->max_fd = e->fd;
-      }
+    if(e->fd > loop->max_fd){
+      loop->max_fd = e->fd;
+    }
 
-      if(e->flag & F_READ){
-        FD_SET(e->fd,&loop->read_set);
-        list_add(&h->list,&loop->read_head);
-      }else{
-        FD_SET(e->fd,&loop->write_set);
-        list_add(&h->list,&loop->write_head);
-      }
+    if(e->flag & F_READ){
+      FD_SET(e->fd,&loop->read_set);
+      list_add(&h->list,&loop->read_head);
+    }else{
+      FD_SET(e->fd,&loop->write_set);
+      list_add(&h->list,&loop->write_head);
     }
 
     e->flag |= F_ADD;
@@ -277,6 +352,12 @@ void e_del_event(eloop_t* loop,event_t *e)
       return;
     }
 
+    if(e->flag & F_TIMER){
+      heap_remove(loop,e);
+      e->flag &= ~F_ADD;
+      return;
+    }
+
     //detach from hold
     h = (hold_t*)e->ptr;
     h->ptr = NULL;
@@ -322,10 +403,19 @@ int e_dispatch_event(eloop_t* loop)
 #ifdef ELOOP_DEBUG_OPEN
         print_count(loop);
 #endif
+        //virtual time: nothing can happen any more
+        if(loop->virtual_time && loop->timer_count == 0 &&
+           list_empty(&loop->read_head) && list_empty(&loop->write_head))
+          break;
+
         //pick next expired time
         timer_next(loop,&tv);
         //printf("picked:%d,%d\n",tv.tv_sec,tv.tv_usec);
-        if((ret = select(loop->max_fd + 1,&read_set,&write_set,NULL,&tv)) < 0){
+        if(loop->virtual_time && list_empty(&loop->read_head) && list_empty(&loop->write_head)){
+          //timers only, no need to poll
+          FD_ZERO(&read_set);
+          FD_ZERO(&write_set);
+        }else if((ret = select(loop->max_fd + 1,&read_set,&write_set,NULL,&tv)) < 0){
           if (errno != EINTR) {
             printf("****************select error**********************max_fd:%d,sec:%ld,usec:%ld\n",loop->max_fd,tv.tv_sec,tv.tv_usec);
             ret = -1;
@@ -348,7 +438,11 @@ end:
     /*when canceled loop clean hold list*/
     clean_list(&loop->read_head);
     clean_list(&loop->write_head);
-    clean_list(&loop->timer_head);
+    while(loop->timer_count > 0)
+      loop->timers[--loop->timer_count]->flag &= ~F_ADD;
+    free(loop->timers);
+    loop->timers = NULL;
+    loop->timer_size = 0;
     return ret;
 }
 
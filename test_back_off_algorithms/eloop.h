@@ -10,20 +10,30 @@
 
 //#define ELOOP_DEBUG_OPEN 1
 
+typedef struct tag_event event_t;
+
+/*时钟：取当前时间，arg为e_set_clock传入的用户数据*/
+typedef void (*clock_fn_t)(struct timeval *tv,void *arg);
+
 /*事件循环，每个线程定义一个*/
 typedef struct
 {
-  struct list_head timer_head;
+  event_t **timers;//定时器最小堆，按超时时间排序
+  int timer_count;
+  int timer_size;
+  unsigned int round;//循环次数
   struct list_head read_head;
   struct list_head write_head;
   fd_set read_set;
   fd_set write_set;
   int max_fd;
   int runing;
+  int virtual_time;//虚拟时间，时间直接跳到下一个定时器
+  struct timeval now;//虚拟时间的当前时间
+  clock_fn_t clock;//时钟，NULL为单调时钟
+  void *clock_arg;
 }eloop_t;
 
-typedef struct tag_event event_t;
-
 typedef void (*callback_t)(event_t *evt);
 
 //该结构体字段仅内部用，不要直接访问
@@ -34,6 +44,8 @@ struct tag_event
     int secs;//seconds
     int usecs;//useconds
     struct timeval timeout;//expire use
+    int index;//index in the timer heap
+    unsigned int round;//round it was fired in
     callback_t proc;//callback function
     void *arg;//point to user data
     void *ptr;//point to list element
@@ -59,6 +71,21 @@ void e_del_event(eloop_t* loop,event_t *evt);
 
 int  e_dispatch_event(eloop_t* loop);
 
+/*
+使用虚拟时间：不再等待，每次循环时间直接跳到最早的定时器，
+没有定时器也没有fd时e_dispatch_event返回;start为开始时间
+*/
+void e_set_virtual_time(eloop_t* loop,const struct timeval *start);
+
+/*
+替换循环的时钟，在添加定时器前调用;fn为NULL时恢复默认的单调时钟，
+select按该时钟的时间等待，比真实时间快的时钟其定时器会晚到
+*/
+void e_set_clock(eloop_t* loop,clock_fn_t fn,void *arg);
+
+/*取循环的当前时间，时钟的时间或虚拟时间*/
+void e_get_time(eloop_t* loop,struct timeval *tv);
+
 void e_dispatch_cancel(eloop_t* loop);
 
 #endif//__ELOOP__
@@ -1,132 +1,302 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <time.h>
 #include <math.h>
 #include <pthread.h>
 #include "eloop.h"
+#include "backoff.h"
 
 #define SECS_TO_COUNT 100//线程创建完毕后统计多少秒
 
-static time_t g_base;
-static int g_count[SECS_TO_COUNT];
-static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int fix; //for fix alogrithm
-static int begin,end;//for random alogrithm
-static void (*g_func)(eloop_t *loop,event_t *evt);
+#define DEFAULT_OUTAGE 10//服务端断开多少秒
 
-void alogrithm_fix_time(eloop_t *loop,event_t *evt)
+//per thread counters, a cache line apart so the threads don't share lines
+typedef struct
 {
-  e_mod_timer_event(loop,evt,fix,0);
-}
+  unsigned long count[SECS_TO_COUNT];//attempts in each second
+}__attribute__((aligned(64))) shard_t;
 
-void alogrithm_rand_time(eloop_t *loop,event_t *evt)
+//a client, one per thread, or all of them on the loop of the simulation
+typedef struct
 {
-  e_mod_timer_event(loop,evt,rand()%(end-begin+1)+begin,0);
-}
+  eloop_t *loop;
+  event_t timer;
+  backoff_t backoff;
+  shard_t *shard;
+  int connected;//second of the successful attempt, -1 if none
+}client_t;
 
-void alogrithm_multiple_time(eloop_t *loop,event_t *evt)
+static long long g_base;//ms, when all the clients lost the server
+static long long g_outage;//ms
+static unsigned long g_capacity;//attempts accepted per second, 0 no limit
+static unsigned long g_accepted[SECS_TO_COUNT];
+static pthread_barrier_t g_barrier;
+static int g_algo;
+static unsigned int g_min,g_max;//ms
+static int g_sim;//all the clients in one thread, on virtual time
+
+static long long now_ms(eloop_t *loop)
 {
-  static int i=0,v[4]={1,2,4,8};
-  e_mod_timer_event(loop,evt,v[i],0);
-  i=(i+1)%4;
+  struct timeval tv;
+  e_get_time(loop,&tv);
+  return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
 }
 
-void print_and_leave()
+//the client is done, the simulation ends with the last timer
+static void client_stop(client_t *c,event_t *evt)
 {
-  int i=0;
-  printf("------------------------------------------------RESULT---------------------------------------------\n");
-  for(i=0;i<SECS_TO_COUNT;i++)
-    printf("%d ",g_count[i]);
-  printf("\n");
-  printf("---------------------------------------------------------------------------------------------------\n");
-  exit(0);
+  e_del_event(c->loop,evt);
+  if(!g_sim)
+    e_dispatch_cancel(c->loop);
 }
 
+//an attempt to reconnect, it fails while the server is down or when it
+//has accepted its capacity in this second
 void timer_proc(event_t *evt)
 {
-  eloop_t *loop = e_get_event_arg(evt);
-  pthread_mutex_lock(&g_mutex);
-  if(g_base == 0){
-    goto end;
+  client_t *c = e_get_event_arg(evt);
+  long long now = now_ms(c->loop);
+  int index = (now - g_base) / 1000;
+
+  if(index >= SECS_TO_COUNT){
+    client_stop(c,evt);
+    return;
   }
 
-  int index = (time(0) - g_base);
+  //no lock, each thread counts in its own shard
+  c->shard->count[index]++;
 
-  if(index >= SECS_TO_COUNT)
-    print_and_leave();
+  if(now - g_base >= g_outage &&
+     (g_capacity == 0 || __atomic_fetch_add(&g_accepted[index],1,__ATOMIC_RELAXED) < g_capacity)){
+    backoff_reset(&c->backoff);
+    c->connected = index;
+    client_stop(c,evt);
+    return;
+  }
 
-  g_count[index]++;
-  //printf("thread %lu increase the number in %d second\n",pthread_self(),index);
+  backoff_schedule(c->loop,evt,&c->backoff);
+}
 
- end:
-  g_func(loop,evt);//modify timer
-  pthread_mutex_unlock(&g_mutex);
+void* work_thread(void *arg)
+{
+  client_t *c = arg;
+  eloop_t loop;
+
+  e_init(&loop);
+  c->loop = &loop;
+  e_init_timer_event(&c->timer,0,0,timer_proc,c);
+
+  //all the clients lose the server at g_base
+  pthread_barrier_wait(&g_barrier);
+
+  backoff_schedule(c->loop,&c->timer,&c->backoff);
+  e_add_event(c->loop,&c->timer);
+
+  e_dispatch_event(c->loop);
+  return NULL;
 }
 
-void* work_thread()
+//all the clients on one loop, whose time goes from one timer to the next
+//without waiting, the result is the same as with threads, in far less time
+void simulate(client_t *clients,int n)
 {
   eloop_t loop;
-	event_t timer;
+  struct timeval start = {0,0};
+  int i;
+
+  e_init(&loop);
+  e_set_virtual_time(&loop,&start);
+  g_base = 0;
+
+  for(i=0;i<n;i++){
+    clients[i].loop = &loop;
+    e_init_timer_event(&clients[i].timer,0,0,timer_proc,&clients[i]);
+    backoff_schedule(&loop,&clients[i].timer,&clients[i].backoff);
+    e_add_event(&loop,&clients[i].timer);
+  }
+
+  //returns when the last client is done
+  e_dispatch_event(&loop);
+}
 
-	e_init(&loop);
+void print_result(client_t *clients,shard_t *shards,int n,int nshard)
+{
+  unsigned long total[SECS_TO_COUNT] = {0};
+  unsigned long peak = 0,sum = 0;
+  int i,j,last = -1,connected = 0,connected_at = -1;
 
-	e_init_timer_event(&timer,0,0,timer_proc,&loop);
+  //the threads are joined, their shards are read without any lock
+  for(j=0;j<nshard;j++){
+    for(i=0;i<SECS_TO_COUNT;i++)
+      total[i] += shards[j].count[i];
+  }
+  for(j=0;j<n;j++){
+    if(clients[j].connected >= 0){
+      connected++;
+      if(clients[j].connected > connected_at)
+        connected_at = clients[j].connected;
+    }
+  }
 
-  e_add_event(&loop,&timer);
+  for(i=0;i<SECS_TO_COUNT;i++){
+    if(total[i]){
+      last = i;
+    }
+    if(total[i] > peak)
+      peak = total[i];
+    sum += total[i];
+  }
 
-	e_dispatch_event(&loop);
+  printf("------------------------------------------------RESULT---------------------------------------------\n");
+  for(i=0;i<SECS_TO_COUNT;i++)
+    printf("%lu ",total[i]);
+  printf("\n");
+  printf("---------------------------------------------------------------------------------------------------\n");
+  //the mean over the seconds until the last attempt
+  printf("attempts:%lu peak:%lu/s mean:%.1f/s peak-to-mean:%.2f\n",sum,peak,
+         last >= 0 ? (double)sum / (last + 1) : 0,
+         sum ? peak / ((double)sum / (last + 1)) : 0);
+  printf("connected:%d/%d",connected,n);
+  if(connected == n)
+    printf(" all by second %d",connected_at);
+  printf("\n");
 }
 
 void usage()
 {
-  printf("usage:\n");
-  printf("\t./tt c f N   (c-thread count,f N - use fixed alogrithm and the interval is N seconds)\n");
-  printf("\t./tt c r B E (c-thread count,r B E - use random alogrithm and the random seconds is between B and E,E must greater than B)\n");
-  printf("\t./tt c m     (c-thread count,m - multiple alogrithm)\n");
+  printf("usage: ./tt [-s] [-o S] [-k K] c ALGO\n");
+  printf("\tc-thread count, each thread is a client which lost the server and reconnects\n");
+  printf("\t-s: simulate the c clients in one thread, on virtual time\n");
+  printf("\t-o S: the server is down for S seconds(default %d)\n",DEFAULT_OUTAGE);
+  printf("\t-k K: the server accepts K attempts per second(default no limit)\n");
+  printf("ALGO:\n");
+  printf("\tf N   (fixed alogrithm,the interval is N seconds)\n");
+  printf("\tr B E (random alogrithm,the random seconds is between B and E,E must greater than B)\n");
+  printf("\tm     (multiple alogrithm,1/2/4/8 seconds then 8 seconds)\n");
+  printf("\te B C (exponential,B base ms,C cap ms)\n");
+  printf("\tj B C (exponential with full jitter)\n");
+  printf("\tq B C (exponential with equal jitter)\n");
+  printf("\td B C (decorrelated jitter)\n");
   exit(0);
 }
 
 int main(int argc,char** argv)
 {
-  int i=0,n = 10;
-  pthread_t id;
+  int i,n,opt,nshard;
+  pthread_t *ids = NULL;
+  client_t *clients;
+  shard_t *shards;
+  struct timespec ts;
 
-  if(argc == 1){
+  g_outage = DEFAULT_OUTAGE * 1000LL;
+  while((opt = getopt(argc,argv,"so:k:")) != -1){
+    switch(opt){
+    case 's':
+      g_sim = 1;
+      break;
+    case 'o':
+      g_outage = atoi(optarg) * 1000LL;
+      break;
+    case 'k':
+      g_capacity = strtoul(optarg,NULL,10);
+      break;
+    default:
+      usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
+
+  if(argc < 2)
+    usage();
+  n = atoi(argv[0]);
+  if(n <= 0)
+    usage();
+
+  switch(*argv[1]){
+  case 'f':
+    if(argc < 3)
+      usage();
+    g_algo = BACKOFF_FIXED;
+    g_min = g_max = atoi(argv[2]) * 1000;
+    break;
+  case 'r':
+    if(argc < 4)
+      usage();
+    g_algo = BACKOFF_UNIFORM;
+    g_min = atoi(argv[2]) * 1000;
+    g_max = atoi(argv[3]) * 1000;
+    break;
+  case 'm':
+    g_algo = BACKOFF_EXPO;
+    g_min = 1000;
+    g_max = 8000;
+    break;
+  case 'e':
+  case 'j':
+  case 'q':
+  case 'd':
+    if(argc < 4)
+      usage();
+    g_algo = *argv[1] == 'e' ? BACKOFF_EXPO :
+             *argv[1] == 'j' ? BACKOFF_FULL_JITTER :
+             *argv[1] == 'q' ? BACKOFF_EQUAL_JITTER : BACKOFF_DECORRELATED;
+    g_min = atoi(argv[2]);
+    g_max = atoi(argv[3]);
+    break;
+  default:
     usage();
-  }else if(*argv[2] == 'f'){
-    fix = atoi(argv[3]);
-    g_func = alogrithm_fix_time;
-  }else if(*argv[2] == 'r'){
-    begin = atoi(argv[3]);
-    end = atoi(argv[4]);
-    g_func = alogrithm_rand_time;
-  }else if(*argv[2] == 'm'){
-    g_func = alogrithm_multiple_time;
   }
 
-  n = atoi(argv[1]);
+  //one shard per thread
+  nshard = g_sim ? 1 : n;
+  if(!g_sim)
+    ids = calloc(n,sizeof(pthread_t));
+  clients = calloc(n,sizeof(client_t));
+  if((!g_sim && ids == NULL) || clients == NULL ||
+     posix_memalign((void**)&shards,64,nshard * sizeof(shard_t))){
+    printf("malloc error\n");
+    return -1;
+  }
+  memset(shards,0,nshard * sizeof(shard_t));
 
   srand(time(0));
+  for(i=0;i<n;i++){
+    clients[i].connected = -1;
+    clients[i].shard = &shards[g_sim ? 0 : i];
+    backoff_init(&clients[i].backoff,g_algo,g_min,g_max,rand());
+  }
 
-  //create threads in random time
-  //printf("create threads randomly\n");
-  while(1){
-    if(rand()%100==0) {
-      pthread_create(&id,NULL,work_thread,NULL);
-      //printf("create thread(%d) tid:%lu succeeded\n",i,id);
-      usleep(rand()%500000);
-      i++;
-    }
+  if(g_sim){
+    simulate(clients,n);
+    print_result(clients,shards,n,nshard);
+    free(shards);
+    free(clients);
+    return 0;
+  }
 
-    if(i==n)
-      break;
+  pthread_barrier_init(&g_barrier,NULL,n + 1);
+  for(i=0;i<n;i++){
+    if(pthread_create(&ids[i],NULL,work_thread,&clients[i]) != 0){
+      printf("create thread(%d) failed\n",i);
+      exit(-1);
+    }
   }
-  //printf("threads created over\n");
 
-  pthread_mutex_lock(&g_mutex);
-  g_base = time(0);
-  pthread_mutex_unlock(&g_mutex);
+  //the loops are on the monotonic clock
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  g_base = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+  pthread_barrier_wait(&g_barrier);
 
-  while(1){
-    sleep(1);
-  }
+  for(i=0;i<n;i++)
+    pthread_join(ids[i],NULL);
+
+  print_result(clients,shards,n,nshard);
+  pthread_barrier_destroy(&g_barrier);
+  free(shards);
+  free(clients);
+  free(ids);
+  return 0;
 }